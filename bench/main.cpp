@@ -0,0 +1,598 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_main.h>
+
+#include "chunk_cache.h"
+#include "core.h"
+#include "error.h"
+#include "flood_fill.h"
+#include "scope.h"
+#include "texture.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    constexpr int32 BENCH_REPEAT_COUNT = 7;
+    constexpr int32 BENCH_VIEWPORT_WIDTH = 1280;
+    constexpr int32 BENCH_VIEWPORT_HEIGHT = 720;
+    constexpr int32 BENCH_TILE_SIZE = 16;
+    constexpr float32 BENCH_DEFAULT_THRESHOLD = 0.1f;
+    
+    constexpr const char* BENCH_TEMP_TILEMAP_FILENAME = "bench.sbm";
+    constexpr const char* BENCH_TEMP_IMAGE_FILENAME = "bench.bmp";
+    
+    struct BenchMetric
+    {
+        std::string name;
+        double value = 0.0;
+        const char* unit = nullptr;
+        bool higher_is_better = false;
+    };
+    
+    struct BenchOptions
+    {
+        const char* baseline_path = nullptr;
+        const char* save_baseline_path = nullptr;
+        float32 threshold = BENCH_DEFAULT_THRESHOLD;
+        int32 repeat_count = BENCH_REPEAT_COUNT;
+    };
+    
+    static std::vector<BenchMetric> s_Metrics;
+    static std::string s_TempTilemapPath;
+    static std::string s_TempImagePath;
+    
+    static uint32 NextRandom(uint32& state)
+    {
+        // xorshift32, seeded with a constant so every run sees the same maps
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    
+    static void ReportMetric(const std::string& name, double value, const char* unit, bool higher_is_better)
+    {
+        SDL_Log("%-36s %14.3f %s", name.c_str(), value, unit);
+        
+        BenchMetric& metric = s_Metrics.emplace_back();
+        metric.name = name;
+        metric.value = value;
+        metric.unit = unit;
+        metric.higher_is_better = higher_is_better;
+    }
+    
+    // Returns the median time of one iteration in nanoseconds
+    template<typename TFunction>
+    static double MeasureNanoseconds(const BenchOptions& options, int32 iteration_count, TFunction function)
+    {
+        std::vector<double> samples;
+        for (int32 repeat = 0; repeat < options.repeat_count; repeat++)
+        {
+            uint64 begin = SDL_GetPerformanceCounter();
+            for (int32 i = 0; i < iteration_count; i++)
+                function();
+            uint64 end = SDL_GetPerformanceCounter();
+            
+            double elapsed = (double)(end - begin) * 1e9 / (double)SDL_GetPerformanceFrequency();
+            samples.push_back(elapsed / (double)iteration_count);
+        }
+        
+        std::sort(samples.begin(), samples.end());
+        return samples[samples.size() / 2];
+    }
+    
+    static SDL_Surface* CreateAtlasSurface(int32 width, int32 height)
+    {
+        SDL_Surface* surface = SDL_CreateSurface(width, height, SDL_PIXELFORMAT_RGBA32);
+        if (!surface)
+            return nullptr;
+        
+        const SDL_PixelFormatDetails* format_details = SDL_GetPixelFormatDetails(surface->format);
+        
+        uint32 random_state = 0x9E3779B9;
+        for (int32 y = 0; y < height; y += BENCH_TILE_SIZE)
+        {
+            for (int32 x = 0; x < width; x += BENCH_TILE_SIZE)
+            {
+                uint32 random = NextRandom(random_state);
+                uint32 color = SDL_MapRGBA(format_details, nullptr,
+                    (uint8)random, (uint8)(random >> 8), (uint8)(random >> 16), 255);
+                
+                SDL_Rect dest_rect;
+                dest_rect.x = x;
+                dest_rect.y = y;
+                dest_rect.w = BENCH_TILE_SIZE;
+                dest_rect.h = BENCH_TILE_SIZE;
+                
+                SDL_FillSurfaceRect(surface, &dest_rect, color);
+            }
+        }
+        
+        return surface;
+    }
+    
+    static Tilemap CreateRandomTilemap(const Tileset& tileset, int32 width, int32 height)
+    {
+        Tilemap tilemap;
+        tilemap.tileset = tileset;
+        tilemap.width = width;
+        tilemap.height = height;
+        
+        uint32 random_state = 0x2545F491;
+        for (int32 y = 0; y < height; y++)
+        {
+            for (int32 x = 0; x < width; x++)
+            {
+                uint32 random = NextRandom(random_state);
+                if (random % 10 == 0)
+                    continue;
+                
+                Tilemap::Cell cell;
+                SetCellTile(cell, (int32)((random >> 4) % (uint32)tileset.width), (int32)((random >> 12) % (uint32)tileset.height));
+                SetCellFlags(cell, (random >> 20) & 0x7);
+                SetTilemapCell(tilemap, x, y, cell);
+            }
+        }
+        
+        return tilemap;
+    }
+    
+    static int32 RenderViewport(SDL_Renderer* renderer, ChunkCache& chunk_cache, const Tilemap& tilemap, float32 scale)
+    {
+        const Tileset& tileset = tilemap.tileset;
+        
+        chunk_cache.BeginFrame(tilemap);
+        int32 level = chunk_cache.GetLevelForScale(scale);
+        
+        float32 chunk_width_scaled = (float32)(chunk_cache.GetChunkWidth(level) * tileset.tile_width) * scale;
+        float32 chunk_height_scaled = (float32)(chunk_cache.GetChunkHeight(level) * tileset.tile_height) * scale;
+        
+        int32 end_chunk_x = SDL_min((int32)SDL_ceilf((float32)BENCH_VIEWPORT_WIDTH / chunk_width_scaled),
+            GetChunkCount(tilemap.width, chunk_cache.GetChunkWidth(level)));
+        int32 end_chunk_y = SDL_min((int32)SDL_ceilf((float32)BENCH_VIEWPORT_HEIGHT / chunk_height_scaled),
+            GetChunkCount(tilemap.height, chunk_cache.GetChunkHeight(level)));
+        
+        SDL_SetRenderDrawColor(renderer, 32, 32, 40, 255);
+        SDL_RenderClear(renderer);
+        
+        for (int32 chunk_y = 0; chunk_y < end_chunk_y; chunk_y++)
+        {
+            for (int32 chunk_x = 0; chunk_x < end_chunk_x; chunk_x++)
+            {
+                const Texture2D* chunk_texture = chunk_cache.GetChunkTexture(tilemap, level, chunk_x, chunk_y);
+                if (!chunk_texture)
+                    continue;
+                
+                SDL_FRect dest_rect;
+                dest_rect.x = (float32)chunk_x * chunk_width_scaled;
+                dest_rect.y = (float32)chunk_y * chunk_height_scaled;
+                dest_rect.w = (float32)(chunk_texture->width << level) * scale;
+                dest_rect.h = (float32)(chunk_texture->height << level) * scale;
+                
+                SDL_RenderTexture(renderer, chunk_texture->handle, nullptr, &dest_rect);
+            }
+        }
+        
+        SDL_FlushRenderer(renderer);
+        
+        int32 visible_width = SDL_min((int32)SDL_ceilf((float32)BENCH_VIEWPORT_WIDTH / ((float32)tileset.tile_width * scale)), tilemap.width);
+        int32 visible_height = SDL_min((int32)SDL_ceilf((float32)BENCH_VIEWPORT_HEIGHT / ((float32)tileset.tile_height * scale)), tilemap.height);
+        
+        return visible_width * visible_height;
+    }
+    
+    static void RunRenderBench(const BenchOptions& options, SDL_Renderer* renderer, const Tilemap& tilemap)
+    {
+        static const float32 scales[] = { 1.0f, 0.25f, 1.0f / 16.0f };
+        
+        for (float32 scale : scales)
+        {
+            char name[64];
+            SDL_snprintf(name, sizeof(name), "render_%d_x%.4f", tilemap.width, (double)scale);
+            
+            ChunkCache chunk_cache = ChunkCache::Create(renderer);
+            int32 visible_cell_count = RenderViewport(renderer, chunk_cache, tilemap, scale);
+            
+            double cold_time = MeasureNanoseconds(options, 1, [&]()
+            {
+                chunk_cache.InvalidateAll();
+                RenderViewport(renderer, chunk_cache, tilemap, scale);
+            });
+            
+            double warm_time = MeasureNanoseconds(options, 20, [&]()
+            {
+                RenderViewport(renderer, chunk_cache, tilemap, scale);
+            });
+            
+            ReportMetric(std::string(name) + "_cold", cold_time / (double)visible_cell_count, "ns/cell", false);
+            ReportMetric(std::string(name) + "_warm", 1e9 / warm_time, "fps", true);
+        }
+    }
+    
+    static void RunTilemapIOBench(const BenchOptions& options, const Tilemap& tilemap, TilemapFileVersion version)
+    {
+        auto save_result = SaveTilemapToDisk(tilemap, s_TempTilemapPath.c_str(), version);
+        if (!save_result)
+        {
+            SDL_Log("Failed to save tilemap: %s", save_result.GetError().message);
+            return;
+        }
+        
+        SDL_PathInfo path_info;
+        SDL_GetPathInfo(s_TempTilemapPath.c_str(), &path_info);
+        
+        double file_size = (double)path_info.size;
+        double cell_count = (double)tilemap.width * (double)tilemap.height;
+        
+        double save_time = MeasureNanoseconds(options, 3, [&]()
+        {
+            SaveTilemapToDisk(tilemap, s_TempTilemapPath.c_str(), version);
+        });
+        
+        double load_time = MeasureNanoseconds(options, 3, [&]()
+        {
+            LoadTilemapFromDisk(s_TempTilemapPath.c_str(), tilemap.tileset.width, tilemap.tileset.height);
+        });
+        
+        double inspect_time = MeasureNanoseconds(options, 3, [&]()
+        {
+            InspectTilemapFile(s_TempTilemapPath.c_str());
+        });
+        
+        char name[64];
+        if (version == TilemapFileVersion::V1Compact)
+            SDL_snprintf(name, sizeof(name), "tilemap_%d", tilemap.width);
+        else if (version == TilemapFileVersion::V1)
+            SDL_snprintf(name, sizeof(name), "tilemap_legacy_%d", tilemap.width);
+        else
+            SDL_snprintf(name, sizeof(name), "tilemap_v%d_%d", (int)version, tilemap.width);
+        
+        ReportMetric(std::string(name) + "_file_size", file_size / cell_count, "B/cell", false);
+        ReportMetric(std::string(name) + "_save", save_time / cell_count, "ns/cell", false);
+        ReportMetric(std::string(name) + "_save_rate", file_size / save_time * 1e3, "MB/s", true);
+        ReportMetric(std::string(name) + "_load", load_time / cell_count, "ns/cell", false);
+        ReportMetric(std::string(name) + "_load_rate", file_size / load_time * 1e3, "MB/s", true);
+        ReportMetric(std::string(name) + "_inspect_rate", file_size / inspect_time * 1e3, "MB/s", true);
+        
+        SDL_RemovePath(s_TempTilemapPath.c_str());
+    }
+    
+    // Autosave takes this snapshot on the main thread
+    static void RunTilemapSnapshotBench(const BenchOptions& options, const Tilemap& tilemap)
+    {
+        double snapshot_time = MeasureNanoseconds(options, 16, [&]()
+        {
+            Tilemap snapshot = CopyTilemapCells(tilemap);
+        });
+        
+        char name[64];
+        SDL_snprintf(name, sizeof(name), "tilemap_%d_snapshot", tilemap.width);
+        
+        ReportMetric(name, snapshot_time / 1e3, "us", false);
+    }
+    
+    // Appends a record of three changed chunks, the size of a few brush strokes
+    static void RunTilemapJournalBench(const BenchOptions& options, const Tilemap& tilemap)
+    {
+        auto save_result = SaveTilemapToDisk(tilemap, s_TempTilemapPath.c_str());
+        if (!save_result)
+        {
+            SDL_Log("Failed to save tilemap: %s", save_result.GetError().message);
+            return;
+        }
+        
+        std::vector<uint32> chunk_keys;
+        for (const auto& [key, chunk] : tilemap.chunks)
+        {
+            if (chunk_keys.size() == 3)
+                break;
+            
+            chunk_keys.push_back(key);
+        }
+        
+        int64 journal_size = 0;
+        int32 record_count = 0;
+        
+        double append_time = MeasureNanoseconds(options, 16, [&]()
+        {
+            auto result = AppendTilemapJournal(tilemap, s_TempTilemapPath.c_str(), chunk_keys.data(), chunk_keys.size());
+            if (result)
+                journal_size = result.GetValue();
+            
+            record_count++;
+        });
+        
+        char name[64];
+        SDL_snprintf(name, sizeof(name), "tilemap_%d", tilemap.width);
+        
+        ReportMetric(std::string(name) + "_journal_save", append_time / 1e3, "us", false);
+        ReportMetric(std::string(name) + "_journal_record", (double)journal_size / (double)SDL_max(record_count, 1), "B", false);
+        
+        // Removes the journal along with the file
+        SaveTilemapToDisk(tilemap, s_TempTilemapPath.c_str());
+        SDL_RemovePath(s_TempTilemapPath.c_str());
+    }
+    
+    // Fills a whole empty map with one tile, the largest region a fill can cover
+    static void RunFloodFillBench(const BenchOptions& options, const Tilemap& tilemap)
+    {
+        Tilemap::Cell tile_cell;
+        SetCellTile(tile_cell, 0, 0);
+        
+        double fill_time = MeasureNanoseconds(options, 4, [&]()
+        {
+            Tilemap filled;
+            filled.tileset = tilemap.tileset;
+            filled.width = tilemap.width;
+            filled.height = tilemap.height;
+            
+            FloodFillTiles(filled, 0, 0, tile_cell);
+        });
+        
+        char name[64];
+        SDL_snprintf(name, sizeof(name), "tilemap_%d_flood_fill", tilemap.width);
+        
+        ReportMetric(name, fill_time / 1e6, "ms", false);
+    }
+    
+    static void RunTextureLoadBench(const BenchOptions& options, SDL_Renderer* renderer, int32 size)
+    {
+        auto surface = MakeScope(CreateAtlasSurface(size, size), SDL_DestroySurface);
+        if (!surface || !SDL_SaveBMP(surface.Get(), s_TempImagePath.c_str()))
+        {
+            SDL_Log("Failed to create image: %s", SDL_GetError());
+            return;
+        }
+        
+        // The same two steps as opening an atlas, without the worker thread
+        double load_time = MeasureNanoseconds(options, 3, [&]()
+        {
+            auto result = DecodeImage(s_TempImagePath.c_str());
+            if (result)
+                CreatePagedTexture(result.GetValue(), TILESET_PAGE_OVERLAP, renderer);
+        });
+        
+        double pixel_size = (double)size * (double)size * 4.0;
+        
+        char name[64];
+        SDL_snprintf(name, sizeof(name), "texture_%d_load_rate", size);
+        ReportMetric(name, pixel_size / load_time * 1e3, "MB/s", true);
+        
+        SDL_RemovePath(s_TempImagePath.c_str());
+    }
+    
+    // Catches files left by benches that stopped early
+    static void RemoveTempFiles()
+    {
+        SDL_RemovePath(s_TempTilemapPath.c_str());
+        SDL_RemovePath((s_TempTilemapPath + ".journal").c_str());
+        SDL_RemovePath(s_TempImagePath.c_str());
+    }
+    
+    static bool SaveBaseline(const char* filepath)
+    {
+        std::string buffer = "{\n";
+        for (size_t i = 0; i < s_Metrics.size(); i++)
+        {
+            char line[128];
+            SDL_snprintf(line, sizeof(line), "    \"%s\": %.6f%s\n",
+                s_Metrics[i].name.c_str(), s_Metrics[i].value, i + 1 < s_Metrics.size() ? "," : "");
+            buffer += line;
+        }
+        
+        buffer += "}\n";
+        
+        return SDL_SaveFile(filepath, buffer.data(), buffer.size());
+    }
+    
+    // Only understands the flat object written by SaveBaseline
+    static bool LoadBaseline(const char* filepath, std::vector<BenchMetric>& metrics)
+    {
+        size_t file_size;
+        auto file_data = MakeScope((char*)SDL_LoadFile(filepath, &file_size), SDL_free);
+        if (!file_data)
+            return false;
+        
+        const char* cursor = file_data.Get();
+        while ((cursor = SDL_strchr(cursor, '"')) != nullptr)
+        {
+            const char* name_begin = cursor + 1;
+            const char* name_end = SDL_strchr(name_begin, '"');
+            if (!name_end)
+                break;
+            
+            const char* value_begin = SDL_strchr(name_end, ':');
+            if (!value_begin)
+                break;
+            
+            char* value_end = nullptr;
+            double value = SDL_strtod(value_begin + 1, &value_end);
+            
+            BenchMetric& metric = metrics.emplace_back();
+            metric.name.assign(name_begin, (size_t)(name_end - name_begin));
+            metric.value = value;
+            
+            cursor = value_end;
+        }
+        
+        return true;
+    }
+    
+    static int32 CompareBaseline(const BenchOptions& options)
+    {
+        std::vector<BenchMetric> baseline;
+        if (!LoadBaseline(options.baseline_path, baseline))
+        {
+            SDL_Log("Could not load baseline '%s': %s", options.baseline_path, SDL_GetError());
+            return -1;
+        }
+        
+        SDL_Log("Comparing against '%s' (threshold %.1f%%)", options.baseline_path, (double)options.threshold * 100.0);
+        
+        int32 regression_count = 0;
+        for (const BenchMetric& metric : s_Metrics)
+        {
+            auto baseline_metric = std::find_if(baseline.begin(), baseline.end(),
+                [&](const BenchMetric& other) { return other.name == metric.name; });
+            
+            if (baseline_metric == baseline.end() || baseline_metric->value <= 0.0)
+                continue;
+            
+            double change = (metric.value - baseline_metric->value) / baseline_metric->value;
+            double loss = metric.higher_is_better ? -change : change;
+            
+            const char* verdict = "ok";
+            if (loss > (double)options.threshold)
+            {
+                verdict = "REGRESSION";
+                regression_count++;
+            }
+            else if (-loss > (double)options.threshold)
+            {
+                verdict = "improved";
+            }
+            
+            SDL_Log("%-36s %+8.1f%% %s", metric.name.c_str(), change * 100.0, verdict);
+        }
+        
+        return regression_count;
+    }
+    
+    static bool ParseOptions(int argc, char** argv, BenchOptions& options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const char* argument = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+            
+            if (SDL_strcmp(argument, "--baseline") == 0 && value)
+                options.baseline_path = argv[++i];
+            else if (SDL_strcmp(argument, "--save-baseline") == 0 && value)
+                options.save_baseline_path = argv[++i];
+            else if (SDL_strcmp(argument, "--threshold") == 0 && value)
+                options.threshold = (float32)SDL_atof(argv[++i]) / 100.0f;
+            else if (SDL_strcmp(argument, "--repeat") == 0 && value)
+                options.repeat_count = SDL_max(SDL_atoi(argv[++i]), 1);
+            else
+                return false;
+        }
+        
+        return true;
+    }
+    
+    static int RunBenchSuite(const BenchOptions& options)
+    {
+        auto target = MakeScope(SDL_CreateSurface(BENCH_VIEWPORT_WIDTH, BENCH_VIEWPORT_HEIGHT, SDL_PIXELFORMAT_RGBA32), SDL_DestroySurface);
+        if (!target)
+        {
+            SDL_Log("Could not create render surface: %s", SDL_GetError());
+            return 1;
+        }
+        
+        auto renderer = MakeScope(SDL_CreateSoftwareRenderer(target.Get()), SDL_DestroyRenderer);
+        if (!renderer)
+        {
+            SDL_Log("Could not create software renderer: %s", SDL_GetError());
+            return 1;
+        }
+        
+        auto atlas_surface = MakeScope(CreateAtlasSurface(256, 256), SDL_DestroySurface);
+        if (!atlas_surface)
+        {
+            SDL_Log("Could not create atlas: %s", SDL_GetError());
+            return 1;
+        }
+        
+        auto atlas_result = CreatePagedTexture(atlas_surface.Get(), TILESET_PAGE_OVERLAP, renderer.Get());
+        if (!atlas_result)
+        {
+            SDL_Log("Could not create atlas: %s", atlas_result.GetError().message);
+            return 1;
+        }
+        
+        auto tileset_result = CreateTileset(atlas_result.GetValue(), BENCH_TILE_SIZE, BENCH_TILE_SIZE);
+        if (!tileset_result)
+        {
+            SDL_Log("Could not create tileset: %s", tileset_result.GetError().message);
+            return 1;
+        }
+        
+        const Tileset& tileset = tileset_result.GetValue();
+        
+        static const int32 tilemap_sizes[] = { 64, 256, 1024 };
+        for (int32 tilemap_size : tilemap_sizes)
+        {
+            Tilemap tilemap = CreateRandomTilemap(tileset, tilemap_size, tilemap_size);
+            RunRenderBench(options, renderer.Get(), tilemap);
+            RunTilemapIOBench(options, tilemap, TilemapFileVersion::V1);
+            RunTilemapIOBench(options, tilemap, TilemapFileVersion::V1Compact);
+            RunTilemapIOBench(options, tilemap, TilemapFileVersion::V2);
+            RunTilemapJournalBench(options, tilemap);
+            RunTilemapSnapshotBench(options, tilemap);
+            RunFloodFillBench(options, tilemap);
+        }
+        
+        static const int32 texture_sizes[] = { 256, 1024, 4096 };
+        for (int32 texture_size : texture_sizes)
+            RunTextureLoadBench(options, renderer.Get(), texture_size);
+        
+        if (options.save_baseline_path && !SaveBaseline(options.save_baseline_path))
+        {
+            SDL_Log("Could not save baseline '%s': %s", options.save_baseline_path, SDL_GetError());
+            return 1;
+        }
+        
+        if (options.baseline_path)
+        {
+            int32 regression_count = CompareBaseline(options);
+            if (regression_count != 0)
+                return 1;
+        }
+        
+        return 0;
+    }
+    
+    static int RunBench(int argc, char** argv)
+    {
+        BenchOptions options;
+        if (!ParseOptions(argc, argv, options))
+        {
+            SDL_Log("Usage: SBMapBench [--baseline FILE] [--save-baseline FILE] [--threshold PERCENT] [--repeat COUNT]");
+            return 2;
+        }
+        
+        // Nothing is shown on screen, all rendering goes through the software renderer
+        SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen,dummy");
+        if (!SDL_Init(SDL_INIT_VIDEO))
+        {
+            SDL_Log("Could not initialize SDL: %s", SDL_GetError());
+            return 1;
+        }
+        
+        char* pref_path = SDL_GetPrefPath("Zake", "SBMap");
+        if (!pref_path)
+        {
+            SDL_Log("Could not find a directory for temporary files: %s", SDL_GetError());
+            SDL_Quit();
+            return 1;
+        }
+        
+        s_TempTilemapPath = std::string(pref_path) + BENCH_TEMP_TILEMAP_FILENAME;
+        s_TempImagePath = std::string(pref_path) + BENCH_TEMP_IMAGE_FILENAME;
+        SDL_free(pref_path);
+        
+        int result = RunBenchSuite(options);
+        RemoveTempFiles();
+        SDL_Quit();
+        
+        return result;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    return SBMap::RunBench(argc, argv);
+}
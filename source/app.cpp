@@ -4,7 +4,9 @@
 #include "embedded.h"
 #include "error_popup.h"
 #include "error.h"
+#include "job.h"
 #include "map_viewport.h"
+#include "performance_window.h"
 #include "scope.h"
 #include "tile_palette.h"
 
@@ -144,6 +146,8 @@ namespace SBMap
     
     AppContext::~AppContext()
     {
+        WaitForJobs();
+        
         if (m_ImGuiInit)
         {
             ImGui_ImplSDLRenderer3_Shutdown();
@@ -224,6 +228,7 @@ namespace SBMap
         
         m_TilePalette = TilePalette::Create(*this);
         m_MapViewport = MapViewport::Create(*this);
+        m_PerformanceWindow = PerformanceWindow::Create(*this);
         
         auto result = CreateCheckerboardTexture(m_Renderer);
         if (!result)
@@ -233,6 +238,7 @@ namespace SBMap
         }
         
         m_Checkerboard = result.GetValue();
+        m_ActiveFrames = APP_ACTIVE_FRAME_COUNT;
         
         return true;
     }
@@ -261,8 +267,28 @@ namespace SBMap
                     
                     if (ImGui::MenuItem("Open Tilemap...", "Ctrl+Shift+O"))
                         m_MapViewport.OpenTilemap();
-                    if (ImGui::MenuItem("Save Tilemap...", "Ctrl+Shift+S"))
+                    if (ImGui::MenuItem("Save Tilemap", "Ctrl+S"))
                         m_MapViewport.SaveTilemap();
+                    if (ImGui::MenuItem("Save Tilemap As...", "Ctrl+Shift+S"))
+                        m_MapViewport.SaveTilemapAs();
+                    
+                    ImGui::EndMenu();
+                }
+                
+                if (ImGui::BeginMenu("Edit"))
+                {
+                    if (ImGui::MenuItem("Undo", "Ctrl+Z", false, m_MapViewport.CanUndo()))
+                        m_MapViewport.Undo();
+                    if (ImGui::MenuItem("Redo", "Ctrl+Y", false, m_MapViewport.CanRedo()))
+                        m_MapViewport.Redo();
+                    
+                    ImGui::EndMenu();
+                }
+                
+                if (ImGui::BeginMenu("View"))
+                {
+                    if (ImGui::MenuItem("Performance", "F3", m_PerformanceWindow.IsOpen()))
+                        m_PerformanceWindow.SetOpen(!m_PerformanceWindow.IsOpen());
                     
                     ImGui::EndMenu();
                 }
@@ -272,58 +298,137 @@ namespace SBMap
             
             ImGui::DockSpaceOverViewport();
             
+            m_PerformanceWindow.BeginPhase(FramePhase::TilePalette);
             m_TilePalette.ShowUI();
+            m_PerformanceWindow.EndPhase(FramePhase::TilePalette);
+            
+            m_PerformanceWindow.BeginPhase(FramePhase::MapViewport);
             m_MapViewport.ShowUI();
+            m_PerformanceWindow.EndPhase(FramePhase::MapViewport);
+            
+            m_PerformanceWindow.ShowUI();
             
             ShowErrorPopup();
             
+            if (m_MapViewport.IsReadyToQuit())
+            {
+                m_MapViewport.Shutdown();
+                m_Running = false;
+            }
+            
+            m_Animating = ImGui::IsPopupOpen(nullptr, ImGuiPopupFlags_AnyPopupId | ImGuiPopupFlags_AnyPopupLevel) ||
+                ImGui::GetIO().WantTextInput;
+            
             SDL_SetRenderDrawColor(m_Renderer, 32, 32, 40, 255);
             SDL_RenderClear(m_Renderer);
             
+            m_PerformanceWindow.BeginPhase(FramePhase::ImGuiRender);
             ImGui::Render();
+            m_PerformanceWindow.EndPhase(FramePhase::ImGuiRender);
+            
+            m_PerformanceWindow.BeginPhase(FramePhase::RenderDrawData);
             ImGui_ImplSDLRenderer3_RenderDrawData(ImGui::GetDrawData(), m_Renderer);
+            m_PerformanceWindow.EndPhase(FramePhase::RenderDrawData);
             
+            m_PerformanceWindow.BeginPhase(FramePhase::RenderPresent);
             SDL_RenderPresent(m_Renderer);
+            m_PerformanceWindow.EndPhase(FramePhase::RenderPresent);
+            
+            m_PerformanceWindow.EndFrame(ImGui::GetDrawData(), m_MapViewport.GetVisibleCellCount());
+            
+            if (m_ActiveFrames > 0)
+                m_ActiveFrames--;
         }
     }
     
     void AppContext::ProcessEvents()
     {
         SDL_Event event;
+        bool has_event = IsIdle() && SDL_WaitEventTimeout(&event, APP_IDLE_TIMEOUT);
+        
+        m_PerformanceWindow.BeginFrame();
+        m_PerformanceWindow.BeginPhase(FramePhase::ProcessEvents);
+        
+        if (has_event)
+            ProcessEvent(event);
+        
         while (SDL_PollEvent(&event))
+            ProcessEvent(event);
+        
+        m_PerformanceWindow.EndPhase(FramePhase::ProcessEvents);
+    }
+    
+    void AppContext::ProcessEvent(const SDL_Event& event)
+    {
+        // ImGui needs a few frames to settle after any input, e.g. hover states
+        m_ActiveFrames = APP_ACTIVE_FRAME_COUNT;
+        
+        ImGui_ImplSDL3_ProcessEvent(&event);
+        
+        switch (event.type)
         {
-            ImGui_ImplSDL3_ProcessEvent(&event);
-            
-            switch (event.type)
-            {
-                case SDL_EVENT_QUIT: {
-                    m_Running = false;
-                } break;
-                case SDL_EVENT_KEY_DOWN: {
-                    if (event.key.key == SDLK_F11)
-                    {
-                        m_Fullscreen = !m_Fullscreen;
-                        SDL_SetWindowFullscreen(m_Window, m_Fullscreen);
-                    }
-                    else if (event.key.key == SDLK_O)
-                    {
-                        if ((event.key.mod & SDL_KMOD_CTRL) && (event.key.mod & SDL_KMOD_SHIFT))
-                            m_MapViewport.OpenTilemap();
-                        else if (event.key.mod & SDL_KMOD_CTRL)
-                            m_TilePalette.OpenAtlas();
-                    }
-                    else if (event.key.key == SDLK_R)
-                    {
-                        if (event.key.mod & SDL_KMOD_CTRL)
-                            m_TilePalette.RemoveAtlas();
-                    }
-                    else if (event.key.key == SDLK_S)
-                    {
-                        if (event.key.mod & SDL_KMOD_CTRL)
-                            m_MapViewport.SaveTilemap();
-                    }
-                } break;
-            }
+            case SDL_EVENT_QUIT: {
+                m_MapViewport.RequestQuit();
+            } break;
+            case SDL_EVENT_RENDER_TARGETS_RESET:
+            case SDL_EVENT_RENDER_DEVICE_RESET: {
+                m_MapViewport.InvalidateRenderCache();
+            } break;
+            case SDL_EVENT_MOUSE_MOTION: {
+                if (event.motion.state & (SDL_BUTTON_LMASK | SDL_BUTTON_RMASK))
+                    m_MapViewport.AddStrokeSample(event.motion.x, event.motion.y);
+            } break;
+            case SDL_EVENT_KEY_DOWN: {
+                if (event.key.key == SDLK_F11)
+                {
+                    m_Fullscreen = !m_Fullscreen;
+                    SDL_SetWindowFullscreen(m_Window, m_Fullscreen);
+                }
+                else if (event.key.key == SDLK_F3)
+                {
+                    m_PerformanceWindow.SetOpen(!m_PerformanceWindow.IsOpen());
+                }
+                else if (event.key.key == SDLK_O)
+                {
+                    if ((event.key.mod & SDL_KMOD_CTRL) && (event.key.mod & SDL_KMOD_SHIFT))
+                        m_MapViewport.OpenTilemap();
+                    else if (event.key.mod & SDL_KMOD_CTRL)
+                        m_TilePalette.OpenAtlas();
+                }
+                else if (event.key.key == SDLK_R)
+                {
+                    if (event.key.mod & SDL_KMOD_CTRL)
+                        m_TilePalette.RemoveAtlas();
+                }
+                else if (event.key.key == SDLK_S)
+                {
+                    if ((event.key.mod & SDL_KMOD_CTRL) && (event.key.mod & SDL_KMOD_SHIFT))
+                        m_MapViewport.SaveTilemapAs();
+                    else if (event.key.mod & SDL_KMOD_CTRL)
+                        m_MapViewport.SaveTilemap();
+                }
+                // Text fields have their own undo
+                else if (event.key.key == SDLK_Z && !ImGui::GetIO().WantTextInput)
+                {
+                    if ((event.key.mod & SDL_KMOD_CTRL) && (event.key.mod & SDL_KMOD_SHIFT))
+                        m_MapViewport.Redo();
+                    else if (event.key.mod & SDL_KMOD_CTRL)
+                        m_MapViewport.Undo();
+                }
+                else if (event.key.key == SDLK_Y && !ImGui::GetIO().WantTextInput)
+                {
+                    if (event.key.mod & SDL_KMOD_CTRL)
+                        m_MapViewport.Redo();
+                }
+            } break;
         }
     }
+    
+    bool AppContext::IsIdle() const
+    {
+        if (m_ActiveFrames > 0 || m_Animating)
+            return false;
+        
+        return GetBackgroundJobCount() == 0;
+    }
 }
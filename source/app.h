@@ -4,11 +4,15 @@
 
 #include "core.h"
 #include "map_viewport.h"
+#include "performance_window.h"
 #include "texture.h"
 #include "tile_palette.h"
 
 namespace SBMap
 {
+    constexpr int32 APP_ACTIVE_FRAME_COUNT = 3;
+    constexpr int32 APP_IDLE_TIMEOUT = 500;
+    
     class AppContext
     {
     public:
@@ -25,14 +29,19 @@ namespace SBMap
         
     private:
         void ProcessEvents();
+        void ProcessEvent(const SDL_Event& event);
+        bool IsIdle() const;
         
     private:
         SDL_Window* m_Window = nullptr;
         SDL_Renderer* m_Renderer = nullptr;
         TilePalette m_TilePalette;
         MapViewport m_MapViewport;
+        PerformanceWindow m_PerformanceWindow;
         Texture2D m_Checkerboard;
         float32 m_DisplayScale = 0.0f;
+        int32 m_ActiveFrames = 0;
+        bool m_Animating = false;
         bool m_ImGuiInit = false;
         bool m_Fullscreen = false;
         bool m_Running = false;
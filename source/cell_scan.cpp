@@ -0,0 +1,231 @@
+#include <SDL3/SDL.h>
+
+#include "cell_scan.h"
+#include "core.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    using ScanCellsFunction = int32(*)(const Tilemap::Cell*, Tilemap::Cell*, int32, int32, int32, CellScan&);
+    
+    static void ScanCellsScalar(const Tilemap::Cell* cells, Tilemap::Cell* tiles, int32 count, int32 tileset_width, int32 tileset_height, CellScan& scan)
+    {
+        for (int32 i = 0; i < count; i++)
+        {
+            uint32 bits = cells[i].bits;
+            tiles[i].bits = bits & ~TILEMAP_CELL_FLAGS_MASK;
+            
+            uint32 has_tile = (bits & TILEMAP_CELL_TILE_BIT) != 0;
+            uint32 allowed_bits = TILEMAP_CELL_FLAGS_MASK | (TILEMAP_CELL_VALID_MASK & (0 - has_tile));
+            uint32 tile_x = (bits >> TILEMAP_CELL_TILE_X_SHIFT) & (TILEMAP_CELL_TILE_LIMIT - 1);
+            uint32 tile_y = (bits >> TILEMAP_CELL_TILE_Y_SHIFT) & (TILEMAP_CELL_TILE_LIMIT - 1);
+            uint32 out_of_bounds = has_tile & (uint32)(tile_x >= (uint32)tileset_width || tile_y >= (uint32)tileset_height);
+            
+            scan.used_mask |= (uint32)(bits != 0) << i;
+            scan.invalid_mask |= (uint32)((bits & ~allowed_bits) != 0) << i;
+            scan.out_of_bounds_mask |= out_of_bounds << i;
+            scan.tile_mask |= has_tile << i;
+            
+            for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                scan.flag_masks[plane] |= ((bits >> plane) & 1) << i;
+        }
+    }
+    
+    // Without vector support every cell is left to the scalar tail
+    static int32 ScanCellsNone(const Tilemap::Cell*, Tilemap::Cell*, int32, int32, int32, CellScan&)
+    {
+        return 0;
+    }
+    
+    static void ScanCellsTail(const Tilemap::Cell* cells, Tilemap::Cell* tiles, int32 begin, int32 count, int32 tileset_width, int32 tileset_height, CellScan& scan)
+    {
+        if (begin >= count)
+            return;
+        
+        CellScan tail_scan;
+        ScanCellsScalar(cells + begin, tiles + begin, count - begin, tileset_width, tileset_height, tail_scan);
+        
+        scan.used_mask |= tail_scan.used_mask << begin;
+        scan.invalid_mask |= tail_scan.invalid_mask << begin;
+        scan.out_of_bounds_mask |= tail_scan.out_of_bounds_mask << begin;
+        scan.tile_mask |= tail_scan.tile_mask << begin;
+        
+        for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+            scan.flag_masks[plane] |= tail_scan.flag_masks[plane] << begin;
+    }
+    
+    #ifdef SDL_SSE2_INTRINSICS
+    static int32 ScanCellsSSE2(const Tilemap::Cell* cells, Tilemap::Cell* tiles, int32 count, int32 tileset_width, int32 tileset_height, CellScan& scan)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i flags_mask = _mm_set1_epi32((int32)TILEMAP_CELL_FLAGS_MASK);
+        const __m128i tile_bit = _mm_set1_epi32((int32)TILEMAP_CELL_TILE_BIT);
+        const __m128i valid_mask = _mm_set1_epi32((int32)TILEMAP_CELL_VALID_MASK);
+        const __m128i coordinate_mask = _mm_set1_epi32((int32)(TILEMAP_CELL_TILE_LIMIT - 1));
+        const __m128i width = _mm_set1_epi32(tileset_width);
+        const __m128i height = _mm_set1_epi32(tileset_height);
+        
+        int32 i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i bits = _mm_loadu_si128((const __m128i*)(cells + i));
+            _mm_storeu_si128((__m128i*)(tiles + i), _mm_andnot_si128(flags_mask, bits));
+            
+            __m128i has_tile = _mm_cmpeq_epi32(_mm_and_si128(bits, tile_bit), tile_bit);
+            __m128i allowed_bits = _mm_or_si128(flags_mask, _mm_and_si128(has_tile, valid_mask));
+            __m128i invalid_bits = _mm_andnot_si128(allowed_bits, bits);
+            
+            // Coordinates are 12 bits, so signed compares are safe
+            __m128i tile_x = _mm_and_si128(_mm_srli_epi32(bits, TILEMAP_CELL_TILE_X_SHIFT), coordinate_mask);
+            __m128i tile_y = _mm_and_si128(_mm_srli_epi32(bits, TILEMAP_CELL_TILE_Y_SHIFT), coordinate_mask);
+            __m128i in_bounds = _mm_and_si128(_mm_cmplt_epi32(tile_x, width), _mm_cmplt_epi32(tile_y, height));
+            __m128i out_of_bounds = _mm_andnot_si128(in_bounds, has_tile);
+            
+            uint32 empty = (uint32)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(bits, zero)));
+            uint32 valid = (uint32)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(invalid_bits, zero)));
+            
+            scan.used_mask |= (~empty & 0xF) << i;
+            scan.invalid_mask |= (~valid & 0xF) << i;
+            scan.out_of_bounds_mask |= (uint32)_mm_movemask_ps(_mm_castsi128_ps(out_of_bounds)) << i;
+            scan.tile_mask |= (uint32)_mm_movemask_ps(_mm_castsi128_ps(has_tile)) << i;
+            
+            // Moves each flag bit into the sign bit, which movemask collects
+            for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+            {
+                __m128i plane_bits = _mm_sll_epi32(bits, _mm_cvtsi32_si128(31 - plane));
+                scan.flag_masks[plane] |= (uint32)_mm_movemask_ps(_mm_castsi128_ps(plane_bits)) << i;
+            }
+        }
+        
+        return i;
+    }
+    #endif
+    
+    #ifdef SDL_AVX2_INTRINSICS
+    static SDL_TARGETING("avx2") int32 ScanCellsAVX2(const Tilemap::Cell* cells, Tilemap::Cell* tiles, int32 count, int32 tileset_width, int32 tileset_height, CellScan& scan)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i flags_mask = _mm256_set1_epi32((int32)TILEMAP_CELL_FLAGS_MASK);
+        const __m256i tile_bit = _mm256_set1_epi32((int32)TILEMAP_CELL_TILE_BIT);
+        const __m256i valid_mask = _mm256_set1_epi32((int32)TILEMAP_CELL_VALID_MASK);
+        const __m256i coordinate_mask = _mm256_set1_epi32((int32)(TILEMAP_CELL_TILE_LIMIT - 1));
+        const __m256i width = _mm256_set1_epi32(tileset_width);
+        const __m256i height = _mm256_set1_epi32(tileset_height);
+        
+        int32 i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i bits = _mm256_loadu_si256((const __m256i*)(cells + i));
+            _mm256_storeu_si256((__m256i*)(tiles + i), _mm256_andnot_si256(flags_mask, bits));
+            
+            __m256i has_tile = _mm256_cmpeq_epi32(_mm256_and_si256(bits, tile_bit), tile_bit);
+            __m256i allowed_bits = _mm256_or_si256(flags_mask, _mm256_and_si256(has_tile, valid_mask));
+            __m256i invalid_bits = _mm256_andnot_si256(allowed_bits, bits);
+            
+            __m256i tile_x = _mm256_and_si256(_mm256_srli_epi32(bits, TILEMAP_CELL_TILE_X_SHIFT), coordinate_mask);
+            __m256i tile_y = _mm256_and_si256(_mm256_srli_epi32(bits, TILEMAP_CELL_TILE_Y_SHIFT), coordinate_mask);
+            __m256i in_bounds = _mm256_and_si256(_mm256_cmpgt_epi32(width, tile_x), _mm256_cmpgt_epi32(height, tile_y));
+            __m256i out_of_bounds = _mm256_andnot_si256(in_bounds, has_tile);
+            
+            uint32 empty = (uint32)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(bits, zero)));
+            uint32 valid = (uint32)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(invalid_bits, zero)));
+            
+            scan.used_mask |= (~empty & 0xFF) << i;
+            scan.invalid_mask |= (~valid & 0xFF) << i;
+            scan.out_of_bounds_mask |= (uint32)_mm256_movemask_ps(_mm256_castsi256_ps(out_of_bounds)) << i;
+            scan.tile_mask |= (uint32)_mm256_movemask_ps(_mm256_castsi256_ps(has_tile)) << i;
+            
+            for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+            {
+                __m256i plane_bits = _mm256_sll_epi32(bits, _mm_cvtsi32_si128(31 - plane));
+                scan.flag_masks[plane] |= (uint32)_mm256_movemask_ps(_mm256_castsi256_ps(plane_bits)) << i;
+            }
+        }
+        
+        return i;
+    }
+    #endif
+    
+    #ifdef SDL_NEON_INTRINSICS
+    // NEON has no movemask, so lanes are weighted by their bit and summed
+    static uint32 GetNEONLaneMask(uint32x4_t lanes)
+    {
+        static const uint32 lane_bits[4] = { 1, 2, 4, 8 };
+        uint32x4_t weighted = vandq_u32(lanes, vld1q_u32(lane_bits));
+        uint32x2_t sum = vpadd_u32(vget_low_u32(weighted), vget_high_u32(weighted));
+        sum = vpadd_u32(sum, sum);
+        
+        return vget_lane_u32(sum, 0);
+    }
+    
+    static int32 ScanCellsNEON(const Tilemap::Cell* cells, Tilemap::Cell* tiles, int32 count, int32 tileset_width, int32 tileset_height, CellScan& scan)
+    {
+        const uint32x4_t zero = vdupq_n_u32(0);
+        const uint32x4_t flags_mask = vdupq_n_u32(TILEMAP_CELL_FLAGS_MASK);
+        const uint32x4_t tile_bit = vdupq_n_u32(TILEMAP_CELL_TILE_BIT);
+        const uint32x4_t valid_mask = vdupq_n_u32(TILEMAP_CELL_VALID_MASK);
+        const uint32x4_t coordinate_mask = vdupq_n_u32(TILEMAP_CELL_TILE_LIMIT - 1);
+        const uint32x4_t width = vdupq_n_u32((uint32)tileset_width);
+        const uint32x4_t height = vdupq_n_u32((uint32)tileset_height);
+        
+        int32 i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            uint32x4_t bits = vld1q_u32((const uint32*)(cells + i));
+            vst1q_u32((uint32*)(tiles + i), vbicq_u32(bits, flags_mask));
+            
+            uint32x4_t has_tile = vtstq_u32(bits, tile_bit);
+            uint32x4_t allowed_bits = vorrq_u32(flags_mask, vandq_u32(has_tile, valid_mask));
+            uint32x4_t invalid_bits = vbicq_u32(bits, allowed_bits);
+            
+            uint32x4_t tile_x = vandq_u32(vshrq_n_u32(bits, TILEMAP_CELL_TILE_X_SHIFT), coordinate_mask);
+            uint32x4_t tile_y = vandq_u32(vshrq_n_u32(bits, TILEMAP_CELL_TILE_Y_SHIFT), coordinate_mask);
+            uint32x4_t in_bounds = vandq_u32(vcltq_u32(tile_x, width), vcltq_u32(tile_y, height));
+            uint32x4_t out_of_bounds = vbicq_u32(has_tile, in_bounds);
+            
+            scan.used_mask |= GetNEONLaneMask(vmvnq_u32(vceqq_u32(bits, zero))) << i;
+            scan.invalid_mask |= GetNEONLaneMask(vmvnq_u32(vceqq_u32(invalid_bits, zero))) << i;
+            scan.out_of_bounds_mask |= GetNEONLaneMask(out_of_bounds) << i;
+            scan.tile_mask |= GetNEONLaneMask(has_tile) << i;
+            
+            for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+            {
+                uint32x4_t plane_bits = vtstq_u32(bits, vdupq_n_u32(1u << plane));
+                scan.flag_masks[plane] |= GetNEONLaneMask(plane_bits) << i;
+            }
+        }
+        
+        return i;
+    }
+    #endif
+    
+    static ScanCellsFunction SelectScanCellsFunction()
+    {
+    #ifdef SDL_AVX2_INTRINSICS
+        if (SDL_HasAVX2())
+            return ScanCellsAVX2;
+    #endif
+    #ifdef SDL_SSE2_INTRINSICS
+        if (SDL_HasSSE2())
+            return ScanCellsSSE2;
+    #endif
+    #ifdef SDL_NEON_INTRINSICS
+        if (SDL_HasNEON())
+            return ScanCellsNEON;
+    #endif
+        return ScanCellsNone;
+    }
+    
+    CellScan ScanCells(const Tilemap::Cell* cells, Tilemap::Cell* tiles, int32 count, int32 tileset_width, int32 tileset_height)
+    {
+        SDL_assert(count >= 0 && count <= CELL_SCAN_MAXIMUM_COUNT);
+        
+        static const ScanCellsFunction s_ScanCells = SelectScanCellsFunction();
+        
+        CellScan scan;
+        int32 vector_count = s_ScanCells(cells, tiles, count, tileset_width, tileset_height, scan);
+        ScanCellsTail(cells, tiles, vector_count, count, tileset_width, tileset_height, scan);
+        
+        return scan;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "core.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    constexpr int32 CELL_SCAN_MAXIMUM_COUNT = 32;
+    
+    static_assert(TILEMAP_CHUNK_WIDTH <= CELL_SCAN_MAXIMUM_COUNT, "A chunk row is scanned at once");
+    
+    // One bit per cell of the span, in the same layout as a flag plane row
+    struct CellScan
+    {
+        uint32 used_mask = 0;
+        uint32 invalid_mask = 0;
+        uint32 out_of_bounds_mask = 0;
+        uint32 tile_mask = 0;
+        uint32 flag_masks[TILEMAP_FLAG_PLANE_COUNT] = {};
+    };
+    
+    // Also writes the cells to tiles with their flags stripped
+    CellScan ScanCells(const Tilemap::Cell* cells, Tilemap::Cell* tiles, int32 count, int32 tileset_width, int32 tileset_height);
+}
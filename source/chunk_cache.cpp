@@ -0,0 +1,533 @@
+#include <SDL3/SDL.h>
+
+#include "chunk_cache.h"
+#include "core.h"
+#include "error.h"
+#include "texture.h"
+#include "tile_batch.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    static size_t GetTextureSize(const Texture2D& texture)
+    {
+        return (size_t)texture.width * (size_t)texture.height * 4;
+    }
+    
+    static SDL_FRect GetChunkCellRect(const CellRange& chunk_range, const CellRange& range, SDL_FPoint cell_size)
+    {
+        SDL_FRect rect;
+        rect.x = (float32)(range.begin_x - chunk_range.begin_x) * cell_size.x;
+        rect.y = (float32)(range.begin_y - chunk_range.begin_y) * cell_size.y;
+        rect.w = (float32)(range.end_x - range.begin_x) * cell_size.x;
+        rect.h = (float32)(range.end_y - range.begin_y) * cell_size.y;
+        
+        return rect;
+    }
+    
+    ChunkCache ChunkCache::Create(SDL_Renderer* renderer)
+    {
+        SDL_assert(renderer != nullptr);
+        
+        ChunkCache instance;
+        instance.m_Renderer = renderer;
+        instance.m_MaximumTextureSize = SDL_min(GetMaximumTextureSize(renderer), CHUNK_MAXIMUM_TEXTURE_SIZE);
+        
+        return instance;
+    }
+    
+    void ChunkCache::BeginFrame(const Tilemap& tilemap)
+    {
+        const Tileset& tileset = tilemap.tileset;
+        
+        bool layout_changed =
+            !IsSamePagedTexture(m_Atlas, tileset.atlas) ||
+            m_TileWidth != tileset.tile_width ||
+            m_TileHeight != tileset.tile_height ||
+            GetChunkCount(m_Width, m_ChunkWidth) != GetChunkCount(tilemap.width, m_ChunkWidth) ||
+            GetChunkCount(m_Height, m_ChunkHeight) != GetChunkCount(tilemap.height, m_ChunkHeight);
+        
+        m_Width = tilemap.width;
+        m_Height = tilemap.height;
+        
+        if (layout_changed)
+        {
+            m_Levels.clear();
+            m_Atlas = tileset.atlas;
+            m_TileWidth = tileset.tile_width;
+            m_TileHeight = tileset.tile_height;
+            m_NewestChunk = nullptr;
+            m_OldestChunk = nullptr;
+            m_ResidentSize = 0;
+            m_Revision++;
+            
+            m_ChunkWidth = CHUNK_MAXIMUM_WIDTH;
+            m_ChunkHeight = CHUNK_MAXIMUM_HEIGHT;
+            while (m_ChunkWidth > 1 && m_ChunkWidth * m_TileWidth > m_MaximumTextureSize)
+                m_ChunkWidth /= 2;
+            while (m_ChunkHeight > 1 && m_ChunkHeight * m_TileHeight > m_MaximumTextureSize)
+                m_ChunkHeight /= 2;
+            
+            // Add levels until a single chunk covers the whole map
+            for (int32 level = 0;; level++)
+            {
+                m_Levels.emplace_back();
+                
+                if (GetChunkCount(m_Width, GetChunkWidth(level)) == 1 && GetChunkCount(m_Height, GetChunkHeight(level)) == 1)
+                    break;
+            }
+        }
+        
+        m_Frame++;
+        
+        if (m_Frame % CHUNK_CACHE_PRUNE_INTERVAL == 0)
+            PruneChunks();
+    }
+    
+    const Texture2D* ChunkCache::GetChunkTexture(const Tilemap& tilemap, int32 level, int32 chunk_x, int32 chunk_y)
+    {
+        Chunk* chunk = AcquireChunk(tilemap, level, chunk_x, chunk_y);
+        if (!chunk || chunk->empty || !IsTextureValid(chunk->texture))
+            return nullptr;
+        
+        return &chunk->texture;
+    }
+    
+    ChunkCache::Chunk* ChunkCache::AcquireChunk(const Tilemap& tilemap, int32 level, int32 chunk_x, int32 chunk_y)
+    {
+        SDL_assert(level >= 0 && level < GetLevelCount());
+        SDL_assert(chunk_x >= 0 && chunk_x < GetChunkCount(m_Width, GetChunkWidth(level)));
+        SDL_assert(chunk_y >= 0 && chunk_y < GetChunkCount(m_Height, GetChunkHeight(level)));
+        
+        Level& chunk_level = m_Levels[(size_t)level];
+        uint32 chunk_key = GetTilemapChunkKey(chunk_x, chunk_y);
+        
+        // A level 0 chunk without tilemap storage is known to be empty without an entry
+        if (level == 0 && !FindTilemapChunk(tilemap, chunk_x * m_ChunkWidth / TILEMAP_CHUNK_WIDTH, chunk_y * m_ChunkHeight / TILEMAP_CHUNK_HEIGHT))
+        {
+            auto it = chunk_level.chunks.find(chunk_key);
+            if (it != chunk_level.chunks.end())
+            {
+                ReleaseChunk(it->second);
+                chunk_level.chunks.erase(it);
+            }
+            
+            return nullptr;
+        }
+        
+        auto [it, inserted] = chunk_level.chunks.try_emplace(chunk_key);
+        Chunk& chunk = it->second;
+        
+        if (inserted)
+        {
+            chunk.dirty_range = GetChunkCellRange(level, chunk_x, chunk_y);
+            chunk.key = chunk_key;
+            chunk.level = level;
+        }
+        
+        chunk.last_used_frame = m_Frame;
+        
+        if (IsTextureValid(chunk.texture))
+        {
+            UnlinkChunk(chunk);
+            LinkChunk(chunk);
+        }
+        
+        // A chunk that failed to bake stays dirty
+        if (!IsCellRangeEmpty(chunk.dirty_range))
+            BakeChunk(tilemap, level, chunk_x, chunk_y, chunk);
+        
+        return &chunk;
+    }
+    
+    void ChunkCache::InvalidateCell(int32 cell_x, int32 cell_y)
+    {
+        if (cell_x < 0 || cell_y < 0 || cell_x >= m_Width || cell_y >= m_Height)
+            return;
+        
+        CellRange cell_range;
+        cell_range.begin_x = cell_x;
+        cell_range.begin_y = cell_y;
+        cell_range.end_x = cell_x + 1;
+        cell_range.end_y = cell_y + 1;
+        
+        for (size_t level = 0; level < m_Levels.size(); level++)
+        {
+            Level& chunk_level = m_Levels[level];
+            int32 chunk_x = cell_x / GetChunkWidth((int32)level);
+            int32 chunk_y = cell_y / GetChunkHeight((int32)level);
+            
+            auto it = chunk_level.chunks.find(GetTilemapChunkKey(chunk_x, chunk_y));
+            if (it != chunk_level.chunks.end())
+                it->second.dirty_range = UniteCellRange(it->second.dirty_range, cell_range);
+        }
+    }
+    
+    void ChunkCache::InvalidateRows(int32 begin_y, int32 end_y)
+    {
+        CellRange row_range;
+        row_range.begin_x = 0;
+        row_range.begin_y = begin_y;
+        row_range.end_x = m_Width;
+        row_range.end_y = end_y;
+        
+        for (size_t level = 0; level < m_Levels.size(); level++)
+        {
+            for (auto& [chunk_key, chunk] : m_Levels[level].chunks)
+            {
+                CellRange chunk_range = GetChunkCellRange((int32)level, chunk_key);
+                CellRange dirty_range = IntersectCellRange(chunk_range, row_range);
+                chunk.dirty_range = UniteCellRange(chunk.dirty_range, dirty_range);
+            }
+        }
+    }
+    
+    void ChunkCache::InvalidateAll()
+    {
+        for (size_t level = 0; level < m_Levels.size(); level++)
+        {
+            for (auto& [chunk_key, chunk] : m_Levels[level].chunks)
+                chunk.dirty_range = GetChunkCellRange((int32)level, chunk_key);
+        }
+    }
+    
+    int32 ChunkCache::GetLevelForScale(float32 scale) const
+    {
+        // Texels are kept no smaller than half a screen pixel
+        int32 level = 0;
+        while (level + 1 < GetLevelCount() && scale * (float32)(2 << level) <= 1.0f)
+            level++;
+        
+        return level;
+    }
+    
+    CellRange ChunkCache::GetChunkCellRange(int32 level, int32 chunk_x, int32 chunk_y) const
+    {
+        int32 chunk_width = GetChunkWidth(level);
+        int32 chunk_height = GetChunkHeight(level);
+        
+        CellRange range;
+        range.begin_x = chunk_x * chunk_width;
+        range.begin_y = chunk_y * chunk_height;
+        range.end_x = SDL_min(range.begin_x + chunk_width, m_Width);
+        range.end_y = SDL_min(range.begin_y + chunk_height, m_Height);
+        
+        return range;
+    }
+    
+    CellRange ChunkCache::GetChunkCellRange(int32 level, uint32 chunk_key) const
+    {
+        return GetChunkCellRange(level, (int32)(chunk_key & 0xFFFF), (int32)(chunk_key >> 16));
+    }
+    
+    bool ChunkCache::BakeChunk(const Tilemap& tilemap, int32 level, int32 chunk_x, int32 chunk_y, Chunk& chunk)
+    {
+        CellRange chunk_range = GetChunkCellRange(level, chunk_x, chunk_y);
+        
+        int32 chunk_cell_width = chunk_range.end_x - chunk_range.begin_x;
+        int32 chunk_cell_height = chunk_range.end_y - chunk_range.begin_y;
+        
+        // The chunk quad stretches the texture over its cells, so its size can be rounded freely
+        int32 texture_width = (chunk_cell_width * m_TileWidth + (1 << level) - 1) >> level;
+        int32 texture_height = (chunk_cell_height * m_TileHeight + (1 << level) - 1) >> level;
+        texture_width = SDL_clamp(texture_width, TEXTURE_MINIMUM_WIDTH, m_MaximumTextureSize);
+        texture_height = SDL_clamp(texture_height, TEXTURE_MINIMUM_HEIGHT, m_MaximumTextureSize);
+        
+        SDL_FPoint cell_size;
+        cell_size.x = (float32)texture_width / (float32)chunk_cell_width;
+        cell_size.y = (float32)texture_height / (float32)chunk_cell_height;
+        
+        bool full_bake =
+            !IsTextureValid(chunk.texture) ||
+            chunk.texture.width != texture_width ||
+            chunk.texture.height != texture_height;
+        
+        CellRange bake_range = full_bake ? chunk_range : IntersectCellRange(chunk.dirty_range, chunk_range);
+        chunk.dirty_range = {};
+        
+        // Level 0 draws tiles, higher levels downsample the chunks of the level below
+        Chunk* children[4] = {};
+        bool empty = true;
+        
+        if (level == 0)
+        {
+            BatchChunkTiles(tilemap, chunk_range, bake_range, cell_size);
+            empty = m_BakeBatch.IsEmpty();
+        }
+        else
+        {
+            if (!AcquireChildChunks(tilemap, level, chunk_x, chunk_y, bake_range, children))
+            {
+                chunk.dirty_range = chunk_range;
+                return false;
+            }
+            
+            for (Chunk* child : children)
+                empty = empty && !child;
+        }
+        
+        if (full_bake)
+        {
+            ReleaseChunk(chunk);
+            chunk.empty = empty;
+            if (empty)
+                return true;
+            
+            EvictChunks((size_t)texture_width * (size_t)texture_height * 4);
+            
+            // Leave the chunk dirty so it is baked again on a later frame
+            auto result = CreateRenderTexture(texture_width, texture_height, m_Renderer);
+            if (!result)
+            {
+                for (Chunk* child : children)
+                {
+                    if (child)
+                        DemoteChunk(*child);
+                }
+                
+                chunk.dirty_range = chunk_range;
+                return false;
+            }
+            
+            chunk.texture = std::move(result.GetValue());
+            m_ResidentSize += GetTextureSize(chunk.texture);
+            m_Revision++;
+            LinkChunk(chunk);
+        }
+        
+        SDL_Texture* previous_target = SDL_GetRenderTarget(m_Renderer);
+        SDL_SetRenderTarget(m_Renderer, chunk.texture.handle);
+        
+        if (full_bake)
+        {
+            SDL_SetRenderDrawColor(m_Renderer, 0, 0, 0, 0);
+            SDL_RenderClear(m_Renderer);
+        }
+        else
+        {
+            SDL_FRect clear_rect = GetChunkCellRect(chunk_range, bake_range, cell_size);
+            
+            SDL_BlendMode draw_blend_mode = SDL_BLENDMODE_NONE;
+            SDL_GetRenderDrawBlendMode(m_Renderer, &draw_blend_mode);
+            SDL_SetRenderDrawBlendMode(m_Renderer, SDL_BLENDMODE_NONE);
+            SDL_SetRenderDrawColor(m_Renderer, 0, 0, 0, 0);
+            SDL_RenderFillRect(m_Renderer, &clear_rect);
+            SDL_SetRenderDrawBlendMode(m_Renderer, draw_blend_mode);
+        }
+        
+        if (level == 0)
+        {
+            // Blending happens when the chunk is drawn. All pages share the same modes.
+            const std::vector<Texture2D>& atlas_pages = tilemap.tileset.atlas.pages;
+            
+            SDL_BlendMode atlas_blend_mode = SDL_BLENDMODE_BLEND;
+            SDL_GetTextureBlendMode(atlas_pages[0].handle, &atlas_blend_mode);
+            
+            for (const Texture2D& atlas_page : atlas_pages)
+                SDL_SetTextureBlendMode(atlas_page.handle, SDL_BLENDMODE_NONE);
+            
+            m_BakeBatch.Render(m_Renderer);
+            
+            for (const Texture2D& atlas_page : atlas_pages)
+                SDL_SetTextureBlendMode(atlas_page.handle, atlas_blend_mode);
+        }
+        else
+        {
+            for (Chunk* child : children)
+            {
+                if (!child)
+                    continue;
+                
+                CellRange child_range = GetChunkCellRange(level - 1, child->key);
+                SDL_FRect dest_rect = GetChunkCellRect(chunk_range, child_range, cell_size);
+                
+                SDL_Texture* child_texture = child->texture.handle;
+                SDL_SetTextureBlendMode(child_texture, SDL_BLENDMODE_NONE);
+                SDL_SetTextureScaleMode(child_texture, SDL_SCALEMODE_LINEAR);
+                SDL_RenderTexture(m_Renderer, child_texture, nullptr, &dest_rect);
+                SDL_SetTextureScaleMode(child_texture, SDL_SCALEMODE_NEAREST);
+                SDL_SetTextureBlendMode(child_texture, SDL_BLENDMODE_BLEND);
+                
+                // Children only needed for downsampling are the first to go
+                DemoteChunk(*child);
+            }
+        }
+        
+        SDL_SetRenderTarget(m_Renderer, previous_target);
+        
+        return true;
+    }
+    
+    void ChunkCache::BatchChunkTiles(const Tilemap& tilemap, const CellRange& chunk_range, const CellRange& bake_range, SDL_FPoint cell_size)
+    {
+        const Tileset& tileset = tilemap.tileset;
+        const std::vector<Texture2D>& atlas_pages = tileset.atlas.pages;
+        const TileUV* tile_uvs = tileset.tile_uvs->data();
+        
+        m_BakeBatch.Clear();
+        
+        // Level 0 chunks never cross a storage chunk boundary
+        const Tilemap::Chunk* storage = FindTilemapChunk(tilemap, chunk_range.begin_x / TILEMAP_CHUNK_WIDTH, chunk_range.begin_y / TILEMAP_CHUNK_HEIGHT);
+        if (!storage)
+            return;
+        
+        for (int32 y = bake_range.begin_y; y < bake_range.end_y; y++)
+        {
+            const Tilemap::Cell* row = storage->cells + (y % TILEMAP_CHUNK_HEIGHT) * TILEMAP_CHUNK_WIDTH;
+            for (int32 x = bake_range.begin_x; x < bake_range.end_x; x++)
+            {
+                const Tilemap::Cell& cell = row[x % TILEMAP_CHUNK_WIDTH];
+                if (!HasCellTile(cell))
+                    continue;
+                
+                int32 tile_x = GetCellTileX(cell);
+                int32 tile_y = GetCellTileY(cell);
+                
+                // Cells may still point past the tileset after the tile size grew
+                if (tile_x >= tileset.width || tile_y >= tileset.height)
+                    continue;
+                
+                const TileUV& tile_uv = tile_uvs[tile_x + tile_y * tileset.width];
+                
+                SDL_FRect dest_rect;
+                dest_rect.x = (float32)(x - chunk_range.begin_x) * cell_size.x;
+                dest_rect.y = (float32)(y - chunk_range.begin_y) * cell_size.y;
+                dest_rect.w = cell_size.x;
+                dest_rect.h = cell_size.y;
+                
+                m_BakeBatch.AddQuad(atlas_pages[(size_t)tile_uv.page].handle, dest_rect, tile_uv.rect);
+            }
+        }
+    }
+    
+    bool ChunkCache::AcquireChildChunks(const Tilemap& tilemap, int32 level, int32 chunk_x, int32 chunk_y, CellRange& bake_range, Chunk* (&children)[4])
+    {
+        int32 child_count_x = GetChunkCount(m_Width, GetChunkWidth(level - 1));
+        int32 child_count_y = GetChunkCount(m_Height, GetChunkHeight(level - 1));
+        
+        CellRange redraw_range = {};
+        
+        for (int32 i = 0; i < 4; i++)
+        {
+            int32 child_x = chunk_x * 2 + (i & 1);
+            int32 child_y = chunk_y * 2 + (i >> 1);
+            if (child_x >= child_count_x || child_y >= child_count_y)
+                continue;
+            
+            // Redraw whole quadrants so the parent never mixes old and new child texels
+            CellRange child_range = GetChunkCellRange(level - 1, child_x, child_y);
+            if (IsCellRangeEmpty(IntersectCellRange(child_range, bake_range)))
+                continue;
+            
+            redraw_range = UniteCellRange(redraw_range, child_range);
+            
+            Chunk* child = AcquireChunk(tilemap, level - 1, child_x, child_y);
+            if (child && !IsCellRangeEmpty(child->dirty_range))
+            {
+                for (Chunk* acquired : children)
+                {
+                    if (acquired)
+                        DemoteChunk(*acquired);
+                }
+                
+                return false;
+            }
+            
+            if (child && !child->empty && IsTextureValid(child->texture))
+                children[i] = child;
+        }
+        
+        bake_range = redraw_range;
+        return true;
+    }
+    
+    void ChunkCache::EvictChunks(size_t required_size)
+    {
+        while (m_ResidentSize + required_size > CHUNK_CACHE_MAXIMUM_SIZE)
+        {
+            Chunk* oldest_chunk = m_OldestChunk;
+            if (!oldest_chunk || oldest_chunk->last_used_frame == m_Frame)
+                return;
+            
+            ReleaseChunk(*oldest_chunk);
+            m_Levels[(size_t)oldest_chunk->level].chunks.erase(oldest_chunk->key);
+        }
+    }
+    
+    void ChunkCache::PruneChunks()
+    {
+        for (Level& chunk_level : m_Levels)
+        {
+            for (auto it = chunk_level.chunks.begin(); it != chunk_level.chunks.end();)
+            {
+                Chunk& chunk = it->second;
+                if (!IsTextureValid(chunk.texture) && chunk.last_used_frame + CHUNK_CACHE_PRUNE_INTERVAL < m_Frame)
+                    it = chunk_level.chunks.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+    
+    void ChunkCache::ReleaseChunk(Chunk& chunk)
+    {
+        if (!IsTextureValid(chunk.texture))
+            return;
+        
+        m_ResidentSize -= GetTextureSize(chunk.texture);
+        m_Revision++;
+        chunk.texture = {};
+        UnlinkChunk(chunk);
+    }
+    
+    void ChunkCache::LinkChunk(Chunk& chunk)
+    {
+        chunk.previous = nullptr;
+        chunk.next = m_NewestChunk;
+        
+        if (m_NewestChunk)
+            m_NewestChunk->previous = &chunk;
+        else
+            m_OldestChunk = &chunk;
+        
+        m_NewestChunk = &chunk;
+    }
+    
+    void ChunkCache::DemoteChunk(Chunk& chunk)
+    {
+        UnlinkChunk(chunk);
+        
+        chunk.previous = m_OldestChunk;
+        chunk.next = nullptr;
+        chunk.last_used_frame = 0;
+        
+        if (m_OldestChunk)
+            m_OldestChunk->next = &chunk;
+        else
+            m_NewestChunk = &chunk;
+        
+        m_OldestChunk = &chunk;
+    }
+    
+    void ChunkCache::UnlinkChunk(Chunk& chunk)
+    {
+        if (chunk.previous)
+            chunk.previous->next = chunk.next;
+        else
+            m_NewestChunk = chunk.next;
+        
+        if (chunk.next)
+            chunk.next->previous = chunk.previous;
+        else
+            m_OldestChunk = chunk.previous;
+        
+        chunk.previous = nullptr;
+        chunk.next = nullptr;
+    }
+    
+    int32 GetChunkCount(int32 cell_count, int32 chunk_size)
+    {
+        SDL_assert(chunk_size > 0);
+        return (cell_count + chunk_size - 1) / chunk_size;
+    }
+}
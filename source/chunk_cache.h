@@ -0,0 +1,96 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "texture.h"
+#include "tile_batch.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    // Level 0 chunks never span more than one tilemap storage chunk
+    constexpr int32 CHUNK_MAXIMUM_WIDTH = TILEMAP_CHUNK_WIDTH;
+    constexpr int32 CHUNK_MAXIMUM_HEIGHT = TILEMAP_CHUNK_HEIGHT;
+    
+    // Large tiles get fewer cells per chunk rather than fewer texels per cell
+    constexpr int32 CHUNK_MAXIMUM_TEXTURE_SIZE = 2048;
+    
+    constexpr size_t CHUNK_CACHE_MAXIMUM_SIZE = 256 * 1024 * 1024;
+    constexpr uint64 CHUNK_CACHE_PRUNE_INTERVAL = 256;
+    
+    // A chunk at level N covers 2^N times as many cells per side as a level 0 chunk
+    class ChunkCache
+    {
+    public:
+        static ChunkCache Create(SDL_Renderer* renderer);
+        
+        void BeginFrame(const Tilemap& tilemap);
+        const Texture2D* GetChunkTexture(const Tilemap& tilemap, int32 level, int32 chunk_x, int32 chunk_y);
+        
+        void InvalidateCell(int32 cell_x, int32 cell_y);
+        void InvalidateRows(int32 begin_y, int32 end_y);
+        void InvalidateAll();
+        
+        int32 GetLevelCount() const { return (int32)m_Levels.size(); }
+        int32 GetChunkWidth(int32 level) const { return m_ChunkWidth << level; }
+        int32 GetChunkHeight(int32 level) const { return m_ChunkHeight << level; }
+        int32 GetLevelForScale(float32 scale) const;
+        uint64 GetRevision() const { return m_Revision; }
+        
+    private:
+        // Chunks holding a texture are linked from most to least recently used
+        struct Chunk
+        {
+            Texture2D texture;
+            CellRange dirty_range = {};
+            Chunk* previous = nullptr;
+            Chunk* next = nullptr;
+            uint64 last_used_frame = 0;
+            uint32 key = 0;
+            int32 level = 0;
+            bool empty = false;
+        };
+        
+        struct Level
+        {
+            std::unordered_map<uint32, Chunk> chunks;
+        };
+        
+        CellRange GetChunkCellRange(int32 level, int32 chunk_x, int32 chunk_y) const;
+        CellRange GetChunkCellRange(int32 level, uint32 chunk_key) const;
+        Chunk* AcquireChunk(const Tilemap& tilemap, int32 level, int32 chunk_x, int32 chunk_y);
+        bool BakeChunk(const Tilemap& tilemap, int32 level, int32 chunk_x, int32 chunk_y, Chunk& chunk);
+        void BatchChunkTiles(const Tilemap& tilemap, const CellRange& chunk_range, const CellRange& bake_range, SDL_FPoint cell_size);
+        bool AcquireChildChunks(const Tilemap& tilemap, int32 level, int32 chunk_x, int32 chunk_y, CellRange& bake_range, Chunk* (&children)[4]);
+        void EvictChunks(size_t required_size);
+        void PruneChunks();
+        void ReleaseChunk(Chunk& chunk);
+        void LinkChunk(Chunk& chunk);
+        void DemoteChunk(Chunk& chunk);
+        void UnlinkChunk(Chunk& chunk);
+        
+    private:
+        SDL_Renderer* m_Renderer = nullptr;
+        int32 m_MaximumTextureSize = 0;
+        std::vector<Level> m_Levels;
+        TileBatch m_BakeBatch;
+        Chunk* m_NewestChunk = nullptr;
+        Chunk* m_OldestChunk = nullptr;
+        PagedTexture m_Atlas = {};
+        int32 m_TileWidth = 0;
+        int32 m_TileHeight = 0;
+        int32 m_ChunkWidth = CHUNK_MAXIMUM_WIDTH;
+        int32 m_ChunkHeight = CHUNK_MAXIMUM_HEIGHT;
+        int32 m_Width = 0;
+        int32 m_Height = 0;
+        size_t m_ResidentSize = 0;
+        uint64 m_Frame = 0;
+        uint64 m_Revision = 0;
+    };
+    
+    int32 GetChunkCount(int32 cell_count, int32 chunk_size);
+}
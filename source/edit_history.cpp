@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "edit_history.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    // Gaps are counted from the end of the previous run
+    struct EditRunWriter
+    {
+        EditCommand* command = nullptr;
+        EditRun run = {};
+        uint64 end = 0;
+    };
+    
+    static void WriteVarint(std::vector<uint8>& data, uint64 value)
+    {
+        while (value >= 0x80)
+        {
+            data.push_back((uint8)(value | 0x80));
+            value >>= 7;
+        }
+        
+        data.push_back((uint8)value);
+    }
+    
+    static uint64 ReadVarint(const uint8*& data)
+    {
+        uint64 value = 0;
+        for (int32 shift = 0;; shift += 7)
+        {
+            uint8 byte = *data++;
+            value |= (uint64)(byte & 0x7F) << shift;
+            
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+    
+    static void FlushEditRun(EditRunWriter& writer)
+    {
+        EditRun& run = writer.run;
+        if (run.length == 0)
+            return;
+        
+        WriteVarint(writer.command->data, run.position - writer.end);
+        WriteVarint(writer.command->data, run.length - 1);
+        WriteVarint(writer.command->data, run.delta);
+        
+        writer.command->change_count += run.length;
+        writer.end = run.position + run.length;
+        run = {};
+    }
+    
+    static void AddEditChange(EditRunWriter& writer, uint64 position, uint32 delta)
+    {
+        EditRun& run = writer.run;
+        SDL_assert(run.length == 0 || position >= run.position + run.length);
+        
+        if (run.length > 0 && position == run.position + run.length && delta == run.delta)
+        {
+            run.length++;
+            return;
+        }
+        
+        FlushEditRun(writer);
+        
+        run.position = position;
+        run.length = 1;
+        run.delta = delta;
+    }
+    
+    static size_t GetEditCommandSize(const EditCommand& command)
+    {
+        return sizeof(EditCommand) + command.data.capacity();
+    }
+    
+    EditHistory EditHistory::Create(size_t memory_limit)
+    {
+        EditHistory instance;
+        instance.m_MemoryLimit = memory_limit;
+        
+        return instance;
+    }
+    
+    void EditHistory::BeginCommand(const Tilemap& tilemap)
+    {
+        SDL_assert(!m_Recording);
+        
+        m_Command = {};
+        m_Command.previous_width = tilemap.width;
+        m_Command.previous_height = tilemap.height;
+        m_Recording = true;
+    }
+    
+    void EditHistory::RecordCell(int32 cell_x, int32 cell_y, uint32 delta)
+    {
+        SDL_assert(m_Recording);
+        
+        CellChange& change = m_Changes.emplace_back();
+        change.position = GetCellChangePosition(cell_x, cell_y);
+        change.delta = delta;
+    }
+    
+    // Chunks still shared with the snapshot were never written to
+    void EditHistory::RecordChunks(const Tilemap& previous, const Tilemap& tilemap)
+    {
+        SDL_assert(m_Recording);
+        SDL_assert(m_Changes.empty() && m_Command.data.empty());
+        
+        std::vector<uint32> chunk_keys;
+        for (const auto& [key, chunk] : previous.chunks)
+        {
+            auto it = tilemap.chunks.find(key);
+            if (it == tilemap.chunks.end() || it->second != chunk)
+                chunk_keys.push_back(key);
+        }
+        
+        for (const auto& [key, chunk] : tilemap.chunks)
+        {
+            if (!previous.chunks.contains(key))
+                chunk_keys.push_back(key);
+        }
+        
+        std::sort(chunk_keys.begin(), chunk_keys.end());
+        
+        EditRunWriter writer;
+        writer.command = &m_Command;
+        
+        for (uint32 key : chunk_keys)
+        {
+            auto previous_it = previous.chunks.find(key);
+            auto it = tilemap.chunks.find(key);
+            
+            const Tilemap::Chunk* previous_chunk = previous_it != previous.chunks.end() ? previous_it->second.get() : nullptr;
+            const Tilemap::Chunk* chunk = it != tilemap.chunks.end() ? it->second.get() : nullptr;
+            
+            for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+            {
+                for (int32 column = 0; column < TILEMAP_CHUNK_WIDTH; column++)
+                {
+                    uint32 previous_bits = previous_chunk ? GetTilemapChunkCell(*previous_chunk, column, row).bits : 0;
+                    uint32 bits = chunk ? GetTilemapChunkCell(*chunk, column, row).bits : 0;
+                    
+                    if (previous_bits == bits)
+                        continue;
+                    
+                    uint64 position = ((uint64)key << EDIT_CELL_INDEX_BITS) | (uint64)(column + row * TILEMAP_CHUNK_WIDTH);
+                    AddEditChange(writer, position, previous_bits ^ bits);
+                }
+            }
+        }
+        
+        FlushEditRun(writer);
+    }
+    
+    // Strokes pass over the same cell many times, its deltas XOR into one
+    void EditHistory::EndCommand(const Tilemap& tilemap)
+    {
+        SDL_assert(m_Recording);
+        m_Recording = false;
+        
+        std::sort(m_Changes.begin(), m_Changes.end(), [](const CellChange& change1, const CellChange& change2)
+        {
+            return change1.position < change2.position;
+        });
+        
+        EditRunWriter writer;
+        writer.command = &m_Command;
+        
+        for (size_t i = 0; i < m_Changes.size();)
+        {
+            uint64 position = m_Changes[i].position;
+            uint32 delta = 0;
+            
+            for (; i < m_Changes.size() && m_Changes[i].position == position; i++)
+                delta ^= m_Changes[i].delta;
+            
+            if (delta != 0)
+                AddEditChange(writer, position, delta);
+        }
+        
+        FlushEditRun(writer);
+        m_Changes.clear();
+        
+        m_Command.width = tilemap.width;
+        m_Command.height = tilemap.height;
+        
+        bool resized = m_Command.width != m_Command.previous_width || m_Command.height != m_Command.previous_height;
+        if (m_Command.change_count == 0 && !resized)
+        {
+            m_Command = {};
+            return;
+        }
+        
+        while (m_Commands.size() > m_Cursor)
+        {
+            m_MemoryUsage -= GetEditCommandSize(m_Commands.back());
+            m_Commands.pop_back();
+        }
+        
+        m_Command.data.shrink_to_fit();
+        m_MemoryUsage += GetEditCommandSize(m_Command);
+        
+        m_Commands.push_back(std::move(m_Command));
+        m_Command = {};
+        m_Cursor++;
+        
+        EvictCommands();
+    }
+    
+    const EditCommand* EditHistory::Undo()
+    {
+        SDL_assert(!m_Recording);
+        
+        if (!CanUndo())
+            return nullptr;
+        
+        m_Cursor--;
+        return &m_Commands[m_Cursor];
+    }
+    
+    const EditCommand* EditHistory::Redo()
+    {
+        SDL_assert(!m_Recording);
+        
+        if (!CanRedo())
+            return nullptr;
+        
+        return &m_Commands[m_Cursor++];
+    }
+    
+    void EditHistory::Clear()
+    {
+        m_Commands.clear();
+        m_Changes.clear();
+        m_Command = {};
+        m_Cursor = 0;
+        m_MemoryUsage = 0;
+        m_Recording = false;
+    }
+    
+    void EditHistory::SetMemoryLimit(size_t memory_limit)
+    {
+        m_MemoryLimit = memory_limit;
+        EvictCommands();
+    }
+    
+    // Once every command has been undone, dropping the oldest would leave the rest unusable
+    void EditHistory::EvictCommands()
+    {
+        while (m_MemoryUsage > m_MemoryLimit && !m_Commands.empty())
+        {
+            if (m_Cursor == 0)
+            {
+                m_Commands.clear();
+                m_MemoryUsage = 0;
+                break;
+            }
+            
+            m_MemoryUsage -= GetEditCommandSize(m_Commands.front());
+            m_Commands.pop_front();
+            m_Cursor--;
+        }
+    }
+    
+    EditRunReader BeginEditRuns(const EditCommand& command)
+    {
+        EditRunReader reader;
+        reader.data = command.data.data();
+        reader.data_end = reader.data + command.data.size();
+        
+        return reader;
+    }
+    
+    bool ReadEditRun(EditRunReader& reader, EditRun& run)
+    {
+        if (reader.data >= reader.data_end)
+            return false;
+        
+        run.position = reader.position + ReadVarint(reader.data);
+        run.length = ReadVarint(reader.data) + 1;
+        run.delta = (uint32)ReadVarint(reader.data);
+        
+        reader.position = run.position + run.length;
+        return true;
+    }
+}
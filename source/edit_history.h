@@ -0,0 +1,109 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "core.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    constexpr size_t EDIT_HISTORY_DEFAULT_LIMIT = 64 * 1024 * 1024;
+    constexpr int32 EDIT_CELL_INDEX_BITS = 10;
+    
+    static_assert(TILEMAP_CHUNK_WIDTH * TILEMAP_CHUNK_HEIGHT == 1 << EDIT_CELL_INDEX_BITS);
+    
+    // Positions hold the chunk key above the cell index, so they survive resizes
+    struct CellChange
+    {
+        uint64 position = 0;
+        uint32 delta = 0;
+    };
+    
+    struct EditRun
+    {
+        uint64 position = 0;
+        uint64 length = 0;
+        uint32 delta = 0;
+    };
+    
+    // Cells cleared by a resize are flipped while the map has its larger size
+    struct EditCommand
+    {
+        std::vector<uint8> data;
+        size_t change_count = 0;
+        int32 previous_width = 0;
+        int32 previous_height = 0;
+        int32 width = 0;
+        int32 height = 0;
+    };
+    
+    class EditHistory
+    {
+    public:
+        static EditHistory Create(size_t memory_limit);
+        
+        void BeginCommand(const Tilemap& tilemap);
+        void RecordCell(int32 cell_x, int32 cell_y, uint32 delta);
+        void RecordChunks(const Tilemap& previous, const Tilemap& tilemap);
+        void EndCommand(const Tilemap& tilemap);
+        
+        const EditCommand* Undo();
+        const EditCommand* Redo();
+        void Clear();
+        
+        void SetMemoryLimit(size_t memory_limit);
+        
+        bool IsRecording() const { return m_Recording; }
+        bool CanUndo() const { return m_Cursor > 0; }
+        bool CanRedo() const { return m_Cursor < m_Commands.size(); }
+        size_t GetMemoryLimit() const { return m_MemoryLimit; }
+        size_t GetMemoryUsage() const { return m_MemoryUsage; }
+        
+    private:
+        void EvictCommands();
+        
+    private:
+        std::deque<EditCommand> m_Commands;
+        std::vector<CellChange> m_Changes;
+        EditCommand m_Command;
+        size_t m_Cursor = 0;
+        size_t m_MemoryLimit = 0;
+        size_t m_MemoryUsage = 0;
+        bool m_Recording = false;
+    };
+    
+    struct EditRunReader
+    {
+        const uint8* data = nullptr;
+        const uint8* data_end = nullptr;
+        uint64 position = 0;
+    };
+    
+    EditRunReader BeginEditRuns(const EditCommand& command);
+    bool ReadEditRun(EditRunReader& reader, EditRun& run);
+    
+    inline uint64 GetCellChangePosition(int32 cell_x, int32 cell_y)
+    {
+        uint32 chunk_key = GetTilemapChunkKey(cell_x / TILEMAP_CHUNK_WIDTH, cell_y / TILEMAP_CHUNK_HEIGHT);
+        uint32 cell_index = (uint32)((cell_x % TILEMAP_CHUNK_WIDTH) + (cell_y % TILEMAP_CHUNK_HEIGHT) * TILEMAP_CHUNK_WIDTH);
+        
+        return ((uint64)chunk_key << EDIT_CELL_INDEX_BITS) | cell_index;
+    }
+    
+    inline int32 GetCellChangeX(uint64 position)
+    {
+        uint32 chunk_key = (uint32)(position >> EDIT_CELL_INDEX_BITS);
+        uint32 cell_index = (uint32)(position & ((1 << EDIT_CELL_INDEX_BITS) - 1));
+        
+        return (int32)(chunk_key & 0xFFFF) * TILEMAP_CHUNK_WIDTH + (int32)cell_index % TILEMAP_CHUNK_WIDTH;
+    }
+    
+    inline int32 GetCellChangeY(uint64 position)
+    {
+        uint32 chunk_key = (uint32)(position >> EDIT_CELL_INDEX_BITS);
+        uint32 cell_index = (uint32)(position & ((1 << EDIT_CELL_INDEX_BITS) - 1));
+        
+        return (int32)(chunk_key >> 16) * TILEMAP_CHUNK_HEIGHT + (int32)cell_index / TILEMAP_CHUNK_WIDTH;
+    }
+}
@@ -0,0 +1,264 @@
+#include <bit>
+#include <type_traits>
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "flag_layers.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    struct FillOperation
+    {
+    #ifdef SDL_SSE2_INTRINSICS
+        static __m128i Apply(__m128i, __m128i) { return _mm_set1_epi32(-1); }
+    #endif
+        static uint32 Apply(uint32, uint32) { return 0xFFFFFFFF; }
+    };
+    
+    struct ClearOperation
+    {
+    #ifdef SDL_SSE2_INTRINSICS
+        static __m128i Apply(__m128i, __m128i) { return _mm_setzero_si128(); }
+    #endif
+        static uint32 Apply(uint32, uint32) { return 0; }
+    };
+    
+    struct InvertOperation
+    {
+    #ifdef SDL_SSE2_INTRINSICS
+        static __m128i Apply(__m128i plane, __m128i) { return _mm_xor_si128(plane, _mm_set1_epi32(-1)); }
+    #endif
+        static uint32 Apply(uint32 plane, uint32) { return ~plane; }
+    };
+    
+    struct AndOperation
+    {
+    #ifdef SDL_SSE2_INTRINSICS
+        static __m128i Apply(__m128i plane, __m128i source) { return _mm_and_si128(plane, source); }
+    #endif
+        static uint32 Apply(uint32 plane, uint32 source) { return plane & source; }
+    };
+    
+    struct OrOperation
+    {
+    #ifdef SDL_SSE2_INTRINSICS
+        static __m128i Apply(__m128i plane, __m128i source) { return _mm_or_si128(plane, source); }
+    #endif
+        static uint32 Apply(uint32 plane, uint32 source) { return plane | source; }
+    };
+    
+    struct XorOperation
+    {
+    #ifdef SDL_SSE2_INTRINSICS
+        static __m128i Apply(__m128i plane, __m128i source) { return _mm_xor_si128(plane, source); }
+    #endif
+        static uint32 Apply(uint32 plane, uint32 source) { return plane ^ source; }
+    };
+    
+    template<typename TOperation>
+    static void ApplyPlaneOperation(uint32* plane, const uint32* source, const uint32* masks)
+    {
+    #ifdef SDL_SSE2_INTRINSICS
+        for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row += 4)
+        {
+            __m128i plane_rows = _mm_loadu_si128((const __m128i*)(plane + row));
+            __m128i source_rows = _mm_loadu_si128((const __m128i*)(source + row));
+            __m128i mask_rows = _mm_loadu_si128((const __m128i*)(masks + row));
+            
+            __m128i result_rows = TOperation::Apply(plane_rows, source_rows);
+            result_rows = _mm_or_si128(_mm_andnot_si128(mask_rows, plane_rows), _mm_and_si128(mask_rows, result_rows));
+            
+            _mm_storeu_si128((__m128i*)(plane + row), result_rows);
+        }
+    #else
+        for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+        {
+            uint32 result = TOperation::Apply(plane[row], source[row]);
+            plane[row] = (plane[row] & ~masks[row]) | (result & masks[row]);
+        }
+    #endif
+    }
+    
+    static void GetChunkRowMasks(const CellRange& range, int32 chunk_x, int32 chunk_y, uint32* masks)
+    {
+        int32 chunk_begin_x = chunk_x * TILEMAP_CHUNK_WIDTH;
+        int32 chunk_begin_y = chunk_y * TILEMAP_CHUNK_HEIGHT;
+        
+        int32 begin_column = SDL_clamp(range.begin_x - chunk_begin_x, 0, TILEMAP_CHUNK_WIDTH);
+        int32 end_column = SDL_clamp(range.end_x - chunk_begin_x, 0, TILEMAP_CHUNK_WIDTH);
+        int32 begin_row = SDL_clamp(range.begin_y - chunk_begin_y, 0, TILEMAP_CHUNK_HEIGHT);
+        int32 end_row = SDL_clamp(range.end_y - chunk_begin_y, 0, TILEMAP_CHUNK_HEIGHT);
+        
+        uint32 column_mask = GetTilemapChunkColumnMask(begin_column, end_column);
+        for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+            masks[row] = (row >= begin_row && row < end_row) ? column_mask : 0;
+    }
+    
+    // Absent chunks are allocated only when acquire is set
+    template<typename TTilemap, typename TFunction>
+    static void ForEachRangeChunk(TTilemap& tilemap, const CellRange& range, bool acquire, TFunction function)
+    {
+        constexpr bool writable = !std::is_const_v<TTilemap>;
+        
+        CellRange map_range;
+        map_range.end_x = tilemap.width;
+        map_range.end_y = tilemap.height;
+        
+        CellRange clipped_range = IntersectCellRange(range, map_range);
+        if (IsCellRangeEmpty(clipped_range))
+            return;
+        
+        int32 begin_chunk_x = clipped_range.begin_x / TILEMAP_CHUNK_WIDTH;
+        int32 begin_chunk_y = clipped_range.begin_y / TILEMAP_CHUNK_HEIGHT;
+        int32 end_chunk_x = (clipped_range.end_x + TILEMAP_CHUNK_WIDTH - 1) / TILEMAP_CHUNK_WIDTH;
+        int32 end_chunk_y = (clipped_range.end_y + TILEMAP_CHUNK_HEIGHT - 1) / TILEMAP_CHUNK_HEIGHT;
+        
+        uint32 masks[TILEMAP_CHUNK_HEIGHT];
+        
+        auto visit_chunk = [&](int32 chunk_x, int32 chunk_y, auto& chunk)
+        {
+            GetChunkRowMasks(clipped_range, chunk_x, chunk_y, masks);
+            function(chunk, masks);
+            
+            if constexpr (writable)
+                RecountTilemapChunk(chunk);
+        };
+        
+        // Sparse maps are cheaper to walk by their allocated chunks
+        int64 range_chunk_count = (int64)(end_chunk_x - begin_chunk_x) * (int64)(end_chunk_y - begin_chunk_y);
+        if (!acquire && range_chunk_count > (int64)tilemap.chunks.size())
+        {
+            for (auto it = tilemap.chunks.begin(); it != tilemap.chunks.end();)
+            {
+                int32 chunk_x = (int32)(it->first & 0xFFFF);
+                int32 chunk_y = (int32)(it->first >> 16);
+                
+                if (chunk_x >= begin_chunk_x && chunk_x < end_chunk_x && chunk_y >= begin_chunk_y && chunk_y < end_chunk_y)
+                {
+                    if constexpr (writable)
+                        visit_chunk(chunk_x, chunk_y, UnshareTilemapChunk(it->second));
+                    else
+                        visit_chunk(chunk_x, chunk_y, *it->second);
+                }
+                
+                if constexpr (writable)
+                {
+                    if (it->second->used_count == 0)
+                    {
+                        it = tilemap.chunks.erase(it);
+                        continue;
+                    }
+                }
+                
+                ++it;
+            }
+            
+            return;
+        }
+        
+        for (int32 chunk_y = begin_chunk_y; chunk_y < end_chunk_y; chunk_y++)
+        {
+            for (int32 chunk_x = begin_chunk_x; chunk_x < end_chunk_x; chunk_x++)
+            {
+                auto* chunk = FindTilemapChunk(tilemap, chunk_x, chunk_y);
+                
+                if constexpr (writable)
+                {
+                    if (!chunk && acquire)
+                        chunk = &AcquireTilemapChunk(tilemap, chunk_x, chunk_y);
+                }
+                
+                if (!chunk)
+                    continue;
+                
+                visit_chunk(chunk_x, chunk_y, *chunk);
+                
+                if constexpr (writable)
+                {
+                    if (chunk->used_count == 0)
+                        tilemap.chunks.erase(GetTilemapChunkKey(chunk_x, chunk_y));
+                }
+            }
+        }
+    }
+    
+    template<typename TOperation>
+    static void ApplyFlagLayerOperation(Tilemap& tilemap, uint32 tile_flag, const CellRange& range, bool acquire)
+    {
+        int32 plane = GetTileFlagPlane(tile_flag);
+        
+        ForEachRangeChunk(tilemap, range, acquire, [&](Tilemap::Chunk& chunk, const uint32* masks)
+        {
+            ApplyPlaneOperation<TOperation>(chunk.flag_planes[plane], chunk.flag_planes[plane], masks);
+        });
+    }
+    
+    void FillFlagLayer(Tilemap& tilemap, uint32 tile_flag, const CellRange& range)
+    {
+        ApplyFlagLayerOperation<FillOperation>(tilemap, tile_flag, range, true);
+    }
+    
+    void ClearFlagLayer(Tilemap& tilemap, uint32 tile_flag, const CellRange& range)
+    {
+        ApplyFlagLayerOperation<ClearOperation>(tilemap, tile_flag, range, false);
+    }
+    
+    void InvertFlagLayer(Tilemap& tilemap, uint32 tile_flag, const CellRange& range)
+    {
+        ApplyFlagLayerOperation<InvertOperation>(tilemap, tile_flag, range, true);
+    }
+    
+    // An absent chunk has both planes empty, so none of the operations allocates
+    void CombineFlagLayers(Tilemap& tilemap, uint32 tile_flag, uint32 source_tile_flag, FlagLayerOperation operation, const CellRange& range)
+    {
+        int32 plane = GetTileFlagPlane(tile_flag);
+        int32 source_plane = GetTileFlagPlane(source_tile_flag);
+        
+        ForEachRangeChunk(tilemap, range, false, [&](Tilemap::Chunk& chunk, const uint32* masks)
+        {
+            uint32* dest_rows = chunk.flag_planes[plane];
+            const uint32* source_rows = chunk.flag_planes[source_plane];
+            
+            switch (operation)
+            {
+                case FlagLayerOperation::And:  ApplyPlaneOperation<AndOperation>(dest_rows, source_rows, masks); break;
+                case FlagLayerOperation::Or:   ApplyPlaneOperation<OrOperation>(dest_rows, source_rows, masks); break;
+                case FlagLayerOperation::Xor:  ApplyPlaneOperation<XorOperation>(dest_rows, source_rows, masks); break;
+            }
+        });
+    }
+    
+    void FillFlagLayerWhereTile(Tilemap& tilemap, uint32 tile_flag, int32 tile_x, int32 tile_y, const CellRange& range)
+    {
+        int32 plane = GetTileFlagPlane(tile_flag);
+        
+        // Cells in chunks never hold flag bits, so the tile can be compared as is
+        Tilemap::Cell tile_cell;
+        SetCellTile(tile_cell, tile_x, tile_y);
+        
+        ForEachRangeChunk(tilemap, range, false, [&](Tilemap::Chunk& chunk, const uint32* masks)
+        {
+            uint32 match_rows[TILEMAP_CHUNK_HEIGHT];
+            for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+                match_rows[row] = MatchTilemapChunkRow(chunk, row, tile_cell.bits);
+            
+            ApplyPlaneOperation<OrOperation>(chunk.flag_planes[plane], match_rows, masks);
+        });
+    }
+    
+    int64 CountFlagLayer(const Tilemap& tilemap, uint32 tile_flag, const CellRange& range)
+    {
+        int32 plane = GetTileFlagPlane(tile_flag);
+        
+        int64 count = 0;
+        ForEachRangeChunk(tilemap, range, false, [&](const Tilemap::Chunk& chunk, const uint32* masks)
+        {
+            for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+                count += std::popcount(chunk.flag_planes[plane][row] & masks[row]);
+        });
+        
+        return count;
+    }
+}
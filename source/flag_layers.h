@@ -0,0 +1,23 @@
+#pragma once
+
+#include "core.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    enum class FlagLayerOperation
+    {
+        And,
+        Or,
+        Xor,
+    };
+    
+    // Ranges are clipped to the map
+    void FillFlagLayer(Tilemap& tilemap, uint32 tile_flag, const CellRange& range);
+    void ClearFlagLayer(Tilemap& tilemap, uint32 tile_flag, const CellRange& range);
+    void InvertFlagLayer(Tilemap& tilemap, uint32 tile_flag, const CellRange& range);
+    void CombineFlagLayers(Tilemap& tilemap, uint32 tile_flag, uint32 source_tile_flag, FlagLayerOperation operation, const CellRange& range);
+    void FillFlagLayerWhereTile(Tilemap& tilemap, uint32 tile_flag, int32 tile_x, int32 tile_y, const CellRange& range);
+    
+    int64 CountFlagLayer(const Tilemap& tilemap, uint32 tile_flag, const CellRange& range);
+}
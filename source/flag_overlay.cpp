@@ -0,0 +1,385 @@
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "error.h"
+#include "flag_overlay.h"
+#include "texture.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    constexpr size_t FLAG_OVERLAY_MASK_SIZE = (size_t)FLAG_OVERLAY_PAGE_WIDTH * (size_t)FLAG_OVERLAY_PAGE_HEIGHT * 4;
+    
+    FlagOverlay FlagOverlay::Create(SDL_Renderer* renderer)
+    {
+        SDL_assert(renderer != nullptr);
+        
+        FlagOverlay instance;
+        instance.m_Renderer = renderer;
+        
+        return instance;
+    }
+    
+    void FlagOverlay::BeginFrame()
+    {
+        m_Frame++;
+        
+        if (m_Frame % FLAG_OVERLAY_PRUNE_INTERVAL == 0)
+            PrunePages();
+    }
+    
+    void FlagOverlay::Update(const Tilemap& tilemap, int32 level, const CellRange& range, uint32 tile_flags)
+    {
+        SDL_assert(level >= 0 && level <= FLAG_OVERLAY_MAXIMUM_LEVEL);
+        
+        if ((size_t)level >= m_Levels.size())
+            m_Levels.resize((size_t)level + 1);
+        
+        Level& page_level = m_Levels[(size_t)level];
+        int32 page_width = GetPageWidth(level);
+        int32 page_height = GetPageHeight(level);
+        
+        int32 begin_page_x = range.begin_x / page_width;
+        int32 begin_page_y = range.begin_y / page_height;
+        int32 end_page_x = (range.end_x + page_width - 1) / page_width;
+        int32 end_page_y = (range.end_y + page_height - 1) / page_height;
+        
+        for (int32 page_y = begin_page_y; page_y < end_page_y; page_y++)
+        {
+            for (int32 page_x = begin_page_x; page_x < end_page_x; page_x++)
+            {
+                uint32 page_key = GetTilemapChunkKey(page_x, page_y);
+                auto [it, inserted] = page_level.pages.try_emplace(page_key);
+                Page& page = it->second;
+                
+                if (inserted)
+                {
+                    page.key = page_key;
+                    page.level = level;
+                    InvalidatePageRows(page, 0, FLAG_OVERLAY_PAGE_HEIGHT);
+                }
+                else
+                {
+                    UnlinkPage(page);
+                }
+                
+                page.last_used_frame = m_Frame;
+                LinkPage(page);
+                
+                UpdatePage(tilemap, level, page_x, page_y, tile_flags, page);
+            }
+        }
+    }
+    
+    void FlagOverlay::InvalidateCell(int32 cell_x, int32 cell_y)
+    {
+        for (size_t level = 0; level < m_Levels.size(); level++)
+        {
+            int32 page_x = cell_x / GetPageWidth((int32)level);
+            int32 page_y = cell_y / GetPageHeight((int32)level);
+            
+            auto it = m_Levels[level].pages.find(GetTilemapChunkKey(page_x, page_y));
+            if (it == m_Levels[level].pages.end())
+                continue;
+            
+            int32 row = (cell_y % GetPageHeight((int32)level)) >> level;
+            InvalidatePageRows(it->second, row, row + 1);
+        }
+    }
+    
+    void FlagOverlay::InvalidateRows(int32 begin_y, int32 end_y)
+    {
+        for (size_t level = 0; level < m_Levels.size(); level++)
+        {
+            int32 page_height = GetPageHeight((int32)level);
+            int32 cells_per_row = 1 << level;
+            
+            for (auto& [page_key, page] : m_Levels[level].pages)
+            {
+                int32 page_begin_y = (int32)(page_key >> 16) * page_height;
+                int32 begin_row = (begin_y - page_begin_y) >> level;
+                int32 end_row = (end_y - page_begin_y + cells_per_row - 1) >> level;
+                InvalidatePageRows(page, begin_row, end_row);
+            }
+        }
+    }
+    
+    void FlagOverlay::InvalidateAll()
+    {
+        for (Level& page_level : m_Levels)
+        {
+            for (auto& [page_key, page] : page_level.pages)
+                InvalidatePageRows(page, 0, FLAG_OVERLAY_PAGE_HEIGHT);
+        }
+    }
+    
+    const Texture2D* FlagOverlay::GetMaskTexture(int32 level, int32 page_x, int32 page_y, uint32 tile_flag) const
+    {
+        if ((size_t)level >= m_Levels.size())
+            return nullptr;
+        
+        const Level& page_level = m_Levels[(size_t)level];
+        auto it = page_level.pages.find(GetTilemapChunkKey(page_x, page_y));
+        if (it == page_level.pages.end())
+            return nullptr;
+        
+        const Texture2D& mask = it->second.masks[GetTileFlagPlane(tile_flag)];
+        if (!IsTextureValid(mask))
+            return nullptr;
+        
+        return &mask;
+    }
+    
+    int32 FlagOverlay::GetLevelForScale(float32 cell_scale) const
+    {
+        // Mask pixels are kept no smaller than a screen pixel
+        int32 level = 0;
+        while (level < FLAG_OVERLAY_MAXIMUM_LEVEL && cell_scale * (float32)(1 << level) < 1.0f)
+            level++;
+        
+        return level;
+    }
+    
+    uint32 FlagOverlay::GetPageUsedPlanes(const Tilemap& tilemap, int32 level, int32 page_x, int32 page_y) const
+    {
+        int32 chunk_columns = GetPageWidth(level) / TILEMAP_CHUNK_WIDTH;
+        int32 chunk_rows = GetPageHeight(level) / TILEMAP_CHUNK_HEIGHT;
+        int32 begin_chunk_x = page_x * chunk_columns;
+        int32 begin_chunk_y = page_y * chunk_rows;
+        
+        uint32 used_planes = 0;
+        
+        for (int32 chunk_y = begin_chunk_y; chunk_y < begin_chunk_y + chunk_rows; chunk_y++)
+        {
+            for (int32 chunk_x = begin_chunk_x; chunk_x < begin_chunk_x + chunk_columns; chunk_x++)
+            {
+                const Tilemap::Chunk* chunk = FindTilemapChunk(tilemap, chunk_x, chunk_y);
+                if (!chunk)
+                    continue;
+                
+                for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                {
+                    uint32 plane_bits = 0;
+                    for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+                        plane_bits |= chunk->flag_planes[plane][row];
+                    
+                    if (plane_bits != 0)
+                        used_planes |= 1u << plane;
+                }
+            }
+        }
+        
+        return used_planes;
+    }
+    
+    void FlagOverlay::UpdatePage(const Tilemap& tilemap, int32 level, int32 page_x, int32 page_y, uint32 tile_flags, Page& page)
+    {
+        bool dirty = page.dirty_begin_y < page.dirty_end_y;
+        if (dirty)
+            page.used_planes = GetPageUsedPlanes(tilemap, level, page_x, page_y);
+        
+        bool uploaded = true;
+        
+        for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+        {
+            // Tile flag N is stored in plane N
+            uint32 plane_bit = 1u << plane;
+            Texture2D& mask = page.masks[plane];
+            
+            if ((page.used_planes & plane_bit) == 0)
+            {
+                ReleaseMask(mask);
+                continue;
+            }
+            
+            if (IsTextureValid(mask))
+            {
+                if (dirty && !UploadPageRows(tilemap, level, page_x, page_y, plane, page.dirty_begin_y, page.dirty_end_y, mask))
+                    uploaded = false;
+                
+                continue;
+            }
+            
+            if ((tile_flags & plane_bit) == 0)
+                continue;
+            
+            EvictPages(FLAG_OVERLAY_MASK_SIZE);
+            
+            auto result = CreateStreamingTexture(FLAG_OVERLAY_PAGE_WIDTH, FLAG_OVERLAY_PAGE_HEIGHT, m_Renderer);
+            if (!result)
+            {
+                uploaded = false;
+                continue;
+            }
+            
+            mask = std::move(result.GetValue());
+            m_ResidentSize += FLAG_OVERLAY_MASK_SIZE;
+            
+            if (!UploadPageRows(tilemap, level, page_x, page_y, plane, 0, FLAG_OVERLAY_PAGE_HEIGHT, mask))
+                uploaded = false;
+        }
+        
+        // Rows stay dirty until every mask has them, so a failed upload is retried
+        if (uploaded)
+        {
+            page.dirty_begin_y = 0;
+            page.dirty_end_y = 0;
+        }
+    }
+    
+    bool FlagOverlay::UploadPageRows(const Tilemap& tilemap, int32 level, int32 page_x, int32 page_y, int32 plane, int32 begin_row, int32 end_row, const Texture2D& mask)
+    {
+        int32 row_count = end_row - begin_row;
+        m_Pixels.resize((size_t)(FLAG_OVERLAY_PAGE_WIDTH * row_count));
+        
+        int32 cells_per_pixel = 1 << level;
+        int32 chunk_columns = GetPageWidth(level) / TILEMAP_CHUNK_WIDTH;
+        int32 begin_x = page_x * GetPageWidth(level);
+        int32 begin_y = page_y * GetPageHeight(level);
+        
+        // Cells outside the map or in absent chunks stay transparent
+        for (int32 row = begin_row; row < end_row; row++)
+        {
+            uint32* row_pixels = m_Pixels.data() + (size_t)((row - begin_row) * FLAG_OVERLAY_PAGE_WIDTH);
+            SDL_memset(row_pixels, 0, FLAG_OVERLAY_PAGE_WIDTH * sizeof(uint32));
+            
+            int32 cell_begin_y = begin_y + row * cells_per_pixel;
+            int32 cell_end_y = SDL_min(cell_begin_y + cells_per_pixel, tilemap.height);
+            
+            for (int32 column = 0; column < chunk_columns; column++)
+            {
+                int32 chunk_begin_x = begin_x + column * TILEMAP_CHUNK_WIDTH;
+                if (chunk_begin_x >= tilemap.width)
+                    break;
+                
+                // Fold the cell rows behind this pixel row into one row of bits
+                uint32 plane_row = 0;
+                for (int32 y = cell_begin_y; y < cell_end_y;)
+                {
+                    int32 chunk_y = y / TILEMAP_CHUNK_HEIGHT;
+                    int32 chunk_end_y = SDL_min((chunk_y + 1) * TILEMAP_CHUNK_HEIGHT, cell_end_y);
+                    
+                    const Tilemap::Chunk* chunk = FindTilemapChunk(tilemap, chunk_begin_x / TILEMAP_CHUNK_WIDTH, chunk_y);
+                    if (chunk)
+                    {
+                        for (; y < chunk_end_y; y++)
+                            plane_row |= chunk->flag_planes[plane][y % TILEMAP_CHUNK_HEIGHT];
+                    }
+                    
+                    y = chunk_end_y;
+                }
+                
+                int32 cell_count = SDL_min(tilemap.width - chunk_begin_x, TILEMAP_CHUNK_WIDTH);
+                if (cell_count < TILEMAP_CHUNK_WIDTH)
+                    plane_row &= (1u << cell_count) - 1;
+                
+                if (cells_per_pixel >= TILEMAP_CHUNK_WIDTH)
+                {
+                    if (plane_row != 0)
+                        row_pixels[(column * TILEMAP_CHUNK_WIDTH) >> level] = 0xFFFFFFFF;
+                    
+                    continue;
+                }
+                
+                uint32 pixel_mask = (1u << cells_per_pixel) - 1;
+                int32 pixel_count = TILEMAP_CHUNK_WIDTH >> level;
+                uint32* chunk_pixels = row_pixels + column * pixel_count;
+                
+                for (int32 i = 0; i < pixel_count; i++)
+                    chunk_pixels[i] = 0 - (uint32)(((plane_row >> (i << level)) & pixel_mask) != 0);
+            }
+        }
+        
+        SDL_Rect dirty_rect;
+        dirty_rect.x = 0;
+        dirty_rect.y = begin_row;
+        dirty_rect.w = FLAG_OVERLAY_PAGE_WIDTH;
+        dirty_rect.h = row_count;
+        
+        return SDL_UpdateTexture(mask.handle, &dirty_rect, m_Pixels.data(), FLAG_OVERLAY_PAGE_WIDTH * 4);
+    }
+    
+    void FlagOverlay::InvalidatePageRows(Page& page, int32 begin_y, int32 end_y)
+    {
+        begin_y = SDL_clamp(begin_y, 0, FLAG_OVERLAY_PAGE_HEIGHT);
+        end_y = SDL_clamp(end_y, begin_y, FLAG_OVERLAY_PAGE_HEIGHT);
+        if (begin_y >= end_y)
+            return;
+        
+        if (page.dirty_begin_y >= page.dirty_end_y)
+        {
+            page.dirty_begin_y = begin_y;
+            page.dirty_end_y = end_y;
+        }
+        else
+        {
+            page.dirty_begin_y = SDL_min(page.dirty_begin_y, begin_y);
+            page.dirty_end_y = SDL_max(page.dirty_end_y, end_y);
+        }
+    }
+    
+    void FlagOverlay::EvictPages(size_t required_size)
+    {
+        while (m_ResidentSize + required_size > FLAG_OVERLAY_MAXIMUM_SIZE)
+        {
+            Page* oldest_page = m_OldestPage;
+            if (!oldest_page || oldest_page->last_used_frame == m_Frame)
+                return;
+            
+            ErasePage(*oldest_page);
+        }
+    }
+    
+    void FlagOverlay::PrunePages()
+    {
+        while (m_OldestPage && m_OldestPage->last_used_frame + FLAG_OVERLAY_PRUNE_INTERVAL < m_Frame)
+            ErasePage(*m_OldestPage);
+    }
+    
+    void FlagOverlay::ReleaseMask(Texture2D& mask)
+    {
+        if (!IsTextureValid(mask))
+            return;
+        
+        m_ResidentSize -= FLAG_OVERLAY_MASK_SIZE;
+        mask = {};
+    }
+    
+    void FlagOverlay::ErasePage(Page& page)
+    {
+        for (Texture2D& mask : page.masks)
+            ReleaseMask(mask);
+        
+        UnlinkPage(page);
+        m_Levels[(size_t)page.level].pages.erase(page.key);
+    }
+    
+    void FlagOverlay::LinkPage(Page& page)
+    {
+        page.previous = nullptr;
+        page.next = m_NewestPage;
+        
+        if (m_NewestPage)
+            m_NewestPage->previous = &page;
+        else
+            m_OldestPage = &page;
+        
+        m_NewestPage = &page;
+    }
+    
+    void FlagOverlay::UnlinkPage(Page& page)
+    {
+        if (page.previous)
+            page.previous->next = page.next;
+        else
+            m_NewestPage = page.next;
+        
+        if (page.next)
+            page.next->previous = page.previous;
+        else
+            m_OldestPage = page.previous;
+        
+        page.previous = nullptr;
+        page.next = nullptr;
+    }
+}
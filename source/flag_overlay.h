@@ -0,0 +1,83 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "texture.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    constexpr int32 FLAG_OVERLAY_PAGE_WIDTH = 256;
+    constexpr int32 FLAG_OVERLAY_PAGE_HEIGHT = 256;
+    constexpr int32 FLAG_OVERLAY_MAXIMUM_LEVEL = 8;
+    
+    constexpr size_t FLAG_OVERLAY_MAXIMUM_SIZE = 64 * 1024 * 1024;
+    constexpr uint64 FLAG_OVERLAY_PRUNE_INTERVAL = 256;
+    
+    // One mask texture per tile flag. A page at level N has a pixel per 2^N by 2^N
+    // cells, set if any of them has the flag, so thin walls stay visible when zoomed out.
+    class FlagOverlay
+    {
+    public:
+        static FlagOverlay Create(SDL_Renderer* renderer);
+        
+        void BeginFrame();
+        void Update(const Tilemap& tilemap, int32 level, const CellRange& range, uint32 tile_flags);
+        
+        void InvalidateCell(int32 cell_x, int32 cell_y);
+        void InvalidateRows(int32 begin_y, int32 end_y);
+        void InvalidateAll();
+        
+        const Texture2D* GetMaskTexture(int32 level, int32 page_x, int32 page_y, uint32 tile_flag) const;
+        
+        int32 GetPageWidth(int32 level) const { return FLAG_OVERLAY_PAGE_WIDTH << level; }
+        int32 GetPageHeight(int32 level) const { return FLAG_OVERLAY_PAGE_HEIGHT << level; }
+        int32 GetLevelForScale(float32 cell_scale) const;
+        
+    private:
+        // Only planes that hold flags have a mask, and only once one is shown.
+        // Pages are linked from most to least recently used.
+        struct Page
+        {
+            Texture2D masks[TILEMAP_FLAG_PLANE_COUNT] = {};
+            Page* previous = nullptr;
+            Page* next = nullptr;
+            uint64 last_used_frame = 0;
+            uint32 key = 0;
+            int32 level = 0;
+            uint32 used_planes = 0;
+            int32 dirty_begin_y = 0;
+            int32 dirty_end_y = 0;
+        };
+        
+        struct Level
+        {
+            std::unordered_map<uint32, Page> pages;
+        };
+        
+        uint32 GetPageUsedPlanes(const Tilemap& tilemap, int32 level, int32 page_x, int32 page_y) const;
+        void UpdatePage(const Tilemap& tilemap, int32 level, int32 page_x, int32 page_y, uint32 tile_flags, Page& page);
+        bool UploadPageRows(const Tilemap& tilemap, int32 level, int32 page_x, int32 page_y, int32 plane, int32 begin_row, int32 end_row, const Texture2D& mask);
+        void InvalidatePageRows(Page& page, int32 begin_y, int32 end_y);
+        
+        void EvictPages(size_t required_size);
+        void PrunePages();
+        void ReleaseMask(Texture2D& mask);
+        void ErasePage(Page& page);
+        void LinkPage(Page& page);
+        void UnlinkPage(Page& page);
+        
+    private:
+        SDL_Renderer* m_Renderer = nullptr;
+        std::vector<Level> m_Levels;
+        std::vector<uint32> m_Pixels;
+        Page* m_NewestPage = nullptr;
+        Page* m_OldestPage = nullptr;
+        size_t m_ResidentSize = 0;
+        uint64 m_Frame = 0;
+    };
+}
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <bit>
+#include <utility>
+#include <vector>
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "flood_fill.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    // The same cells of the row at y - direction are already filled
+    struct FloodFillSpan
+    {
+        int32 begin_x = 0;
+        int32 end_x = 0;
+        int32 y = 0;
+        int32 direction = 0;
+    };
+    
+    // Valid until the fill moves to another chunk row
+    struct FloodFillChunk
+    {
+        const Tilemap::Chunk* chunk = nullptr;
+        Tilemap::Chunk* writable_chunk = nullptr;
+        uint32 generation = 0;
+    };
+    
+    struct TileFillLayer
+    {
+        uint32 source_bits = 0;
+        uint32 target_bits = 0;
+        
+        uint32 Match(const Tilemap::Chunk& chunk, int32 row) const
+        {
+            return MatchTilemapChunkRow(chunk, row, source_bits);
+        }
+        
+        uint32 MatchEmpty() const
+        {
+            return source_bits == 0 ? 0xFFFFFFFF : 0;
+        }
+        
+        void Fill(Tilemap::Chunk& chunk, int32 row, uint32 mask) const
+        {
+            Tilemap::Cell* cells = chunk.cells + row * TILEMAP_CHUNK_WIDTH;
+            for (int32 column = 0; column < TILEMAP_CHUNK_WIDTH; column++)
+                cells[column].bits = ((mask >> column) & 1) ? target_bits : cells[column].bits;
+            
+            uint32& tile_row = chunk.tile_plane[row];
+            tile_row = (target_bits & TILEMAP_CELL_TILE_BIT) ? tile_row | mask : tile_row & ~mask;
+        }
+    };
+    
+    struct FlagFillLayer
+    {
+        int32 plane = 0;
+        bool flagged = false;
+        
+        uint32 Match(const Tilemap::Chunk& chunk, int32 row) const
+        {
+            uint32 plane_row = chunk.flag_planes[plane][row];
+            return flagged ? ~plane_row : plane_row;
+        }
+        
+        uint32 MatchEmpty() const
+        {
+            return flagged ? 0xFFFFFFFF : 0;
+        }
+        
+        void Fill(Tilemap::Chunk& chunk, int32 row, uint32 mask) const
+        {
+            uint32& plane_row = chunk.flag_planes[plane][row];
+            plane_row = flagged ? plane_row | mask : plane_row & ~mask;
+        }
+    };
+    
+    // Filled cells stop matching, which keeps them from being visited twice
+    template<typename TLayer>
+    static CellRange FloodFillLayer(Tilemap& tilemap, const TLayer& layer, int32 cell_x, int32 cell_y)
+    {
+        CellRange filled_range = {};
+        if (!IsInTilemapBounds(tilemap, cell_x, cell_y))
+            return filled_range;
+        
+        const Tilemap& const_tilemap = std::as_const(tilemap);
+        
+        int32 last_chunk_x = (tilemap.width - 1) / TILEMAP_CHUNK_WIDTH;
+        uint32 last_chunk_mask = GetTilemapChunkColumnMask(0, tilemap.width - last_chunk_x * TILEMAP_CHUNK_WIDTH);
+        
+        std::vector<FloodFillChunk> row_chunks(last_chunk_x + 1);
+        int32 row_chunk_y = -1;
+        uint32 generation = 0;
+        
+        auto get_chunk = [&](int32 chunk_x, int32 chunk_y) -> FloodFillChunk&
+        {
+            if (chunk_y != row_chunk_y)
+            {
+                row_chunk_y = chunk_y;
+                generation++;
+            }
+            
+            FloodFillChunk& entry = row_chunks[chunk_x];
+            if (entry.generation != generation)
+            {
+                entry.chunk = FindTilemapChunk(const_tilemap, chunk_x, chunk_y);
+                entry.writable_chunk = nullptr;
+                entry.generation = generation;
+            }
+            
+            return entry;
+        };
+        
+        // Columns past the edge of the map never match
+        auto match_row = [&](int32 chunk_x, int32 y)
+        {
+            const Tilemap::Chunk* chunk = get_chunk(chunk_x, y / TILEMAP_CHUNK_HEIGHT).chunk;
+            uint32 match = chunk ? layer.Match(*chunk, y % TILEMAP_CHUNK_HEIGHT) : layer.MatchEmpty();
+            
+            return chunk_x == last_chunk_x ? match & last_chunk_mask : match;
+        };
+        
+        auto find_match = [&](int32 y, int32 begin_x, int32 end_x)
+        {
+            for (int32 x = begin_x; x < end_x;)
+            {
+                int32 chunk_x = x / TILEMAP_CHUNK_WIDTH;
+                uint32 match = match_row(chunk_x, y) & ~GetTilemapChunkColumnMask(0, x % TILEMAP_CHUNK_WIDTH);
+                
+                if (match != 0)
+                    return SDL_min(chunk_x * TILEMAP_CHUNK_WIDTH + std::countr_zero(match), end_x);
+                
+                x = (chunk_x + 1) * TILEMAP_CHUNK_WIDTH;
+            }
+            
+            return end_x;
+        };
+        
+        auto find_run_begin = [&](int32 y, int32 x)
+        {
+            int32 chunk_x = x / TILEMAP_CHUNK_WIDTH;
+            uint32 miss = ~match_row(chunk_x, y) & GetTilemapChunkColumnMask(0, x % TILEMAP_CHUNK_WIDTH);
+            
+            while (miss == 0)
+            {
+                if (chunk_x == 0)
+                    return 0;
+                
+                chunk_x--;
+                miss = ~match_row(chunk_x, y);
+            }
+            
+            return chunk_x * TILEMAP_CHUNK_WIDTH + 32 - std::countl_zero(miss);
+        };
+        
+        auto find_run_end = [&](int32 y, int32 x)
+        {
+            while (x < tilemap.width)
+            {
+                int32 chunk_x = x / TILEMAP_CHUNK_WIDTH;
+                uint32 miss = ~match_row(chunk_x, y) & ~GetTilemapChunkColumnMask(0, x % TILEMAP_CHUNK_WIDTH);
+                
+                if (miss != 0)
+                    return SDL_min(chunk_x * TILEMAP_CHUNK_WIDTH + std::countr_zero(miss), tilemap.width);
+                
+                x = (chunk_x + 1) * TILEMAP_CHUNK_WIDTH;
+            }
+            
+            return tilemap.width;
+        };
+        
+        std::vector<uint32> filled_chunk_keys;
+        
+        auto fill_run = [&](int32 y, int32 begin_x, int32 end_x)
+        {
+            int32 chunk_y = y / TILEMAP_CHUNK_HEIGHT;
+            for (int32 chunk_x = begin_x / TILEMAP_CHUNK_WIDTH; chunk_x * TILEMAP_CHUNK_WIDTH < end_x; chunk_x++)
+            {
+                int32 chunk_begin_x = chunk_x * TILEMAP_CHUNK_WIDTH;
+                uint32 mask = GetTilemapChunkColumnMask(SDL_max(begin_x - chunk_begin_x, 0), SDL_min(end_x - chunk_begin_x, TILEMAP_CHUNK_WIDTH));
+                
+                // Acquiring may copy a chunk shared with a snapshot
+                FloodFillChunk& entry = get_chunk(chunk_x, chunk_y);
+                if (!entry.writable_chunk)
+                {
+                    entry.writable_chunk = &AcquireTilemapChunk(tilemap, chunk_x, chunk_y);
+                    entry.chunk = entry.writable_chunk;
+                    filled_chunk_keys.push_back(GetTilemapChunkKey(chunk_x, chunk_y));
+                }
+                
+                layer.Fill(*entry.writable_chunk, y % TILEMAP_CHUNK_HEIGHT, mask);
+            }
+        };
+        
+        std::vector<FloodFillSpan> spans;
+        spans.reserve(FLOOD_FILL_RESERVED_SPANS);
+        
+        auto push_span = [&](int32 begin_x, int32 end_x, int32 y, int32 direction)
+        {
+            if (begin_x < end_x && y >= 0 && y < tilemap.height)
+                spans.push_back({ begin_x, end_x, y, direction });
+        };
+        
+        spans.push_back({ cell_x, cell_x + 1, cell_y, 0 });
+        
+        while (!spans.empty())
+        {
+            FloodFillSpan span = spans.back();
+            spans.pop_back();
+            
+            for (int32 x = find_match(span.y, span.begin_x, span.end_x); x < span.end_x;)
+            {
+                int32 run_begin_x = find_run_begin(span.y, x);
+                int32 run_end_x = find_run_end(span.y, x);
+                
+                fill_run(span.y, run_begin_x, run_end_x);
+                
+                CellRange run_range;
+                run_range.begin_x = run_begin_x;
+                run_range.begin_y = span.y;
+                run_range.end_x = run_end_x;
+                run_range.end_y = span.y + 1;
+                filled_range = UniteCellRange(filled_range, run_range);
+                
+                // Toward the row the span came from, only the parts past the span are new
+                if (span.direction == 0)
+                {
+                    push_span(run_begin_x, run_end_x, span.y - 1, -1);
+                    push_span(run_begin_x, run_end_x, span.y + 1, 1);
+                }
+                else
+                {
+                    push_span(run_begin_x, run_end_x, span.y + span.direction, span.direction);
+                    push_span(run_begin_x, span.begin_x, span.y - span.direction, -span.direction);
+                    push_span(span.end_x, run_end_x, span.y - span.direction, -span.direction);
+                }
+                
+                x = find_match(span.y, run_end_x, span.end_x);
+            }
+        }
+        
+        std::sort(filled_chunk_keys.begin(), filled_chunk_keys.end());
+        filled_chunk_keys.erase(std::unique(filled_chunk_keys.begin(), filled_chunk_keys.end()), filled_chunk_keys.end());
+        
+        for (uint32 key : filled_chunk_keys)
+        {
+            auto it = tilemap.chunks.find(key);
+            RecountTilemapChunk(*it->second);
+            
+            if (it->second->used_count == 0)
+                tilemap.chunks.erase(it);
+        }
+        
+        return filled_range;
+    }
+    
+    // Filling with the tile already there would never stop matching
+    CellRange FloodFillTiles(Tilemap& tilemap, int32 cell_x, int32 cell_y, const Tilemap::Cell& tile_cell)
+    {
+        if (!IsInTilemapBounds(tilemap, cell_x, cell_y))
+            return {};
+        
+        TileFillLayer layer;
+        layer.source_bits = GetTilemapCell(tilemap, cell_x, cell_y).bits & ~TILEMAP_CELL_FLAGS_MASK;
+        layer.target_bits = tile_cell.bits & ~TILEMAP_CELL_FLAGS_MASK;
+        
+        if (layer.source_bits == layer.target_bits)
+            return {};
+        
+        return FloodFillLayer(tilemap, layer, cell_x, cell_y);
+    }
+    
+    CellRange FloodFillFlagLayer(Tilemap& tilemap, uint32 tile_flag, int32 cell_x, int32 cell_y, bool flagged)
+    {
+        if (!IsInTilemapBounds(tilemap, cell_x, cell_y))
+            return {};
+        
+        bool source_flagged = (GetCellFlags(GetTilemapCell(tilemap, cell_x, cell_y)) & tile_flag) != 0;
+        if (source_flagged == flagged)
+            return {};
+        
+        FlagFillLayer layer;
+        layer.plane = GetTileFlagPlane(tile_flag);
+        layer.flagged = flagged;
+        
+        return FloodFillLayer(tilemap, layer, cell_x, cell_y);
+    }
+}
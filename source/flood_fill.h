@@ -0,0 +1,13 @@
+#pragma once
+
+#include "core.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    constexpr size_t FLOOD_FILL_RESERVED_SPANS = 256;
+    
+    // Returns the range of filled cells, which is empty when nothing changed
+    CellRange FloodFillTiles(Tilemap& tilemap, int32 cell_x, int32 cell_y, const Tilemap::Cell& tile_cell);
+    CellRange FloodFillFlagLayer(Tilemap& tilemap, uint32 tile_flag, int32 cell_x, int32 cell_y, bool flagged);
+}
@@ -0,0 +1,135 @@
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "error.h"
+#include "job.h"
+
+namespace SBMap
+{
+    struct JobThreadData
+    {
+        std::shared_ptr<JobState> state;
+        JobFunction function;
+    };
+    
+    struct JobThread
+    {
+        SDL_Thread* thread = nullptr;
+        std::shared_ptr<JobState> state;
+    };
+    
+    // Only touched from the main thread
+    static std::vector<JobThread> s_JobThreads;
+    static SDL_AtomicInt s_BackgroundJobCount = {};
+    
+    static int SDLCALL RunJobThread(void* userdata)
+    {
+        JobThreadData* data = (JobThreadData*)userdata;
+        
+        if (!IsJobCancelled(*data->state))
+            data->function(*data->state);
+        
+        SDL_SetAtomicInt(&data->state->finished, 1);
+        delete data;
+        
+        SDL_AddAtomicInt(&s_BackgroundJobCount, -1);
+        
+        // Wakes up an event loop that went idle, so the finished job is handled
+        SDL_Event event = {};
+        event.type = SDL_EVENT_USER;
+        SDL_PushEvent(&event);
+        
+        return 0;
+    }
+    
+    Result<Job> Job::Start(const char* name, JobFunction function)
+    {
+        SDL_assert(name != nullptr);
+        SDL_assert(function != nullptr);
+        
+        Job job;
+        job.m_State = std::make_shared<JobState>();
+        
+        JobThreadData* data = new JobThreadData{ job.m_State, std::move(function) };
+        
+        SDL_AddAtomicInt(&s_BackgroundJobCount, 1);
+        
+        SDL_Thread* thread = SDL_CreateThread(RunJobThread, name, data);
+        if (!thread)
+        {
+            delete data;
+            SDL_AddAtomicInt(&s_BackgroundJobCount, -1);
+            return Error{ "Could not start background job.", SDL_GetError() };
+        }
+        
+        // Finished threads are joined as new ones start
+        std::erase_if(s_JobThreads, [](const JobThread& job_thread)
+        {
+            if (SDL_GetAtomicInt(&job_thread.state->finished) == 0)
+                return false;
+            
+            SDL_WaitThread(job_thread.thread, nullptr);
+            return true;
+        });
+        
+        s_JobThreads.push_back({ thread, job.m_State });
+        return job;
+    }
+    
+    Job::~Job()
+    {
+        Cancel();
+    }
+    
+    Job& Job::operator=(Job&& other)
+    {
+        if (this != &other)
+        {
+            Cancel();
+            m_State = std::move(other.m_State);
+        }
+        
+        return *this;
+    }
+    
+    void Job::Cancel()
+    {
+        if (m_State)
+            SDL_SetAtomicInt(&m_State->cancelled, 1);
+    }
+    
+    bool Job::IsRunning() const
+    {
+        return m_State && SDL_GetAtomicInt(&m_State->finished) == 0;
+    }
+    
+    bool Job::IsFinished() const
+    {
+        return m_State && SDL_GetAtomicInt(&m_State->finished) != 0;
+    }
+    
+    float32 Job::GetProgress() const
+    {
+        if (!m_State)
+            return 0.0f;
+        
+        return (float32)SDL_GetAtomicInt(&m_State->progress) / (float32)JOB_PROGRESS_SCALE;
+    }
+    
+    void WaitForJobs()
+    {
+        for (const JobThread& job_thread : s_JobThreads)
+            SDL_WaitThread(job_thread.thread, nullptr);
+        
+        s_JobThreads.clear();
+    }
+    
+    int32 GetBackgroundJobCount()
+    {
+        return SDL_GetAtomicInt(&s_BackgroundJobCount);
+    }
+}
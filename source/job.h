@@ -0,0 +1,66 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "error.h"
+
+namespace SBMap
+{
+    constexpr int32 JOB_PROGRESS_SCALE = 1000;
+    
+    // Progress is stored in thousandths so it can be read without a lock
+    struct JobState
+    {
+        SDL_AtomicInt cancelled = {};
+        SDL_AtomicInt finished = {};
+        SDL_AtomicInt progress = {};
+    };
+    
+    using JobFunction = std::function<void(JobState& state)>;
+    
+    // Dropping or replacing a job cancels it
+    class Job
+    {
+    public:
+        static Result<Job> Start(const char* name, JobFunction function);
+        
+        Job() = default;
+        Job(const Job&) = delete;
+        Job(Job&& other) = default;
+        ~Job();
+        
+        Job& operator=(const Job&) = delete;
+        Job& operator=(Job&& other);
+        
+        void Cancel();
+        
+        bool IsValid() const { return m_State != nullptr; }
+        bool IsRunning() const;
+        bool IsFinished() const;
+        float32 GetProgress() const;
+        
+    private:
+        std::shared_ptr<JobState> m_State;
+    };
+    
+    // Called from the main thread before SDL shuts down
+    void WaitForJobs();
+    
+    // Can be called from any thread
+    int32 GetBackgroundJobCount();
+    
+    inline bool IsJobCancelled(JobState& state)
+    {
+        return SDL_GetAtomicInt(&state.cancelled) != 0;
+    }
+    
+    inline void SetJobProgress(JobState& state, float32 progress)
+    {
+        progress = SDL_clamp(progress, 0.0f, 1.0f);
+        SDL_SetAtomicInt(&state.progress, (int32)(progress * (float32)JOB_PROGRESS_SCALE));
+    }
+}
@@ -1,35 +1,82 @@
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <imgui.h>
+#include <imgui_internal.h>
 
 #include "app.h"
+#include "chunk_cache.h"
 #include "core.h"
 #include "error_popup.h"
 #include "error.h"
+#include "flag_layers.h"
+#include "flood_fill.h"
+#include "flag_overlay.h"
+#include "job.h"
 #include "map_viewport.h"
+#include "tile_batch.h"
 #include "tile_palette.h"
 #include "tilemap.h"
 
 namespace SBMap
 {
-    static void OpenFileDialogCallback(void* userdata, const char* const* filelist, int filter)
+    struct TilemapFileRequest
     {
-        (void)filter;
+        MapViewport* map_viewport = nullptr;
+        std::string filepath;
+        TilemapFileVersion version = TilemapFileVersion::V2;
+        bool save = false;
+    };
+    
+    static void SDLCALL RunTilemapFileRequest(void* userdata)
+    {
+        TilemapFileRequest* request = (TilemapFileRequest*)userdata;
+        
+        if (request->save)
+            request->map_viewport->SaveTilemapFile(request->filepath.c_str(), request->version);
+        else
+            request->map_viewport->OpenTilemapFile(request->filepath.c_str());
         
+        delete request;
+    }
+    
+    // Dialog callbacks may run on another thread
+    static void PostTilemapFileRequest(void* userdata, const char* const* filelist, TilemapFileVersion version, bool save)
+    {
         if (!filelist || !(*filelist))
             return;
         
-        MapViewport* map_viewport = (MapViewport*)userdata;
-        map_viewport->OpenTilemapFile(*filelist);
+        TilemapFileRequest* request = new TilemapFileRequest{ (MapViewport*)userdata, *filelist, version, save };
+        if (!SDL_RunOnMainThread(RunTilemapFileRequest, request, false))
+            delete request;
     }
     
-    static void SaveFileDialogCallback(void* userdata, const char* const* filelist, int filter)
+    static void OpenFileDialogCallback(void* userdata, const char* const* filelist, int filter)
     {
         (void)filter;
+        PostTilemapFileRequest(userdata, filelist, TilemapFileVersion::V2, false);
+    }
+    
+    // Platforms that do not report the chosen filter always get version 2
+    static void SaveFileDialogCallback(void* userdata, const char* const* filelist, int filter)
+    {
+        TilemapFileVersion version = TilemapFileVersion::V2;
+        if (filter == 1)
+            version = TilemapFileVersion::V1Compact;
+        else if (filter == 2)
+            version = TilemapFileVersion::V1;
         
-        if (!filelist || !(*filelist))
-            return;
+        PostTilemapFileRequest(userdata, filelist, version, true);
+    }
+    
+    static Error GetJobError(const std::string& message, const std::string& details)
+    {
+        Error error;
+        error.message = message.c_str();
+        error.details = details.empty() ? nullptr : details.c_str();
         
-        MapViewport* map_viewport = (MapViewport*)userdata;
-        map_viewport->SaveTilemapFile(*filelist);
+        return error;
     }
     
     static uint32 GetMapLayerTileFlag(MapLayer layer)
@@ -67,27 +114,89 @@ namespace SBMap
             selected = layer;
     }
     
+    bool MapViewport::IsSameTileBatchKey(const TileBatchKey& key1, const TileBatchKey& key2)
+    {
+        return
+            key1.range.begin_x == key2.range.begin_x &&
+            key1.range.begin_y == key2.range.begin_y &&
+            key1.range.end_x == key2.range.end_x &&
+            key1.range.end_y == key2.range.end_y &&
+            key1.origin_x == key2.origin_x &&
+            key1.origin_y == key2.origin_y &&
+            key1.scale == key2.scale &&
+            key1.revision == key2.revision;
+    }
+    
     MapViewport MapViewport::Create(AppContext& context)
     {
         MapViewport instance;
         instance.m_Context = &context;
         instance.m_Tilemap.tileset = context.GetTilePalette().GetTileset();
+        instance.m_ChunkCache = ChunkCache::Create(context.GetRenderer());
+        instance.m_FlagOverlay = FlagOverlay::Create(context.GetRenderer());
         instance.m_Scale = 1.0f;
         instance.m_ShowGrid = true;
         instance.m_ShowMarker = true;
+        instance.m_EditHistory = EditHistory::Create(EDIT_HISTORY_DEFAULT_LIMIT);
         instance.ResetTilemapSize();
+        instance.m_EditHistory.Clear();
+        instance.m_SavedEditCount = instance.m_EditCount;
+        instance.m_AutosavedEditCount = instance.m_EditCount;
+        
+        // An autosave still around at startup holds edits an earlier session never saved
+        char* pref_path = SDL_GetPrefPath("Zake", "SBMap");
+        if (pref_path)
+        {
+            instance.m_AutosaveFilepath = std::string(pref_path) + MAP_AUTOSAVE_FILENAME;
+            SDL_free(pref_path);
+            
+            SDL_PathInfo path_info;
+            instance.m_OfferRecovery = SDL_GetPathInfo(instance.m_AutosaveFilepath.c_str(), &path_info);
+        }
+        
+        instance.m_AutosaveTime = SDL_GetTicks();
         
         return instance;
     }
     
     void MapViewport::ShowUI()
     {
+        UpdateTilemapJobs();
+        UpdateAutosave();
+        
+        if (!ImGui::IsMouseDown(ImGuiMouseButton_Left) && !ImGui::IsMouseDown(ImGuiMouseButton_Right))
+            EndEditCommand();
+        
         ImGui::Begin("Map Viewport");
         
         ShowMapSectionUI();
         ShowPropertiesSectionUI();
         
         ImGui::End();
+        
+        m_StrokeSamples.clear();
+    }
+    
+    void MapViewport::Shutdown()
+    {
+        SDL_assert(!m_SaveJob.IsValid());
+        
+        m_LoadJob = {};
+        m_AutosaveJob = {};
+        
+        if (!m_AutosaveFilepath.empty() && !m_OfferRecovery && m_EditCount == m_SavedEditCount)
+            SDL_RemovePath(m_AutosaveFilepath.c_str());
+    }
+    
+    // Dropping a save job cancels it, so quitting waits for a save in progress
+    void MapViewport::RequestQuit()
+    {
+        m_QuitRequested = true;
+    }
+    
+    bool MapViewport::IsReadyToQuit() const
+    {
+        return m_QuitRequested && !m_SaveJob.IsValid();
     }
     
     void MapViewport::OpenTilemap()
@@ -103,24 +212,72 @@ namespace SBMap
     
     void MapViewport::OpenTilemapFile(const char* filepath)
     {
-        auto result = LoadTilemapFromDisk(m_Tilemap.tileset, filepath);
-        if (result)
+        LoadTilemapFile(filepath, false);
+    }
+    
+    // A recovered map does not belong to any file until it is saved
+    void MapViewport::LoadTilemapFile(const char* filepath, bool recovery)
+    {
+        const Tileset& tileset = m_Context->GetTilePalette().GetTileset();
+        if (!IsTilesetValid(tileset))
         {
-            Tilemap& tilemap = result.GetValue();
-            m_Tilemap = std::move(tilemap);
-            m_InputWidth = m_Tilemap.width;
-            m_InputHeight = m_Tilemap.height;
+            OpenErrorPopup("Failed to Open Tilemap", Error{ "Tileset is invalid." });
+            return;
         }
-        else
+        
+        std::shared_ptr<TilemapLoad> tilemap_load = std::make_shared<TilemapLoad>();
+        tilemap_load->tileset_width = tileset.width;
+        tilemap_load->tileset_height = tileset.height;
+        tilemap_load->filepath = filepath;
+        tilemap_load->recovery = recovery;
+        
+        std::string path = filepath;
+        
+        auto result = Job::Start("SBMapTilemapLoad", [tilemap_load, path](JobState& state)
+        {
+            auto load_result = LoadTilemapFromDisk(path.c_str(), tilemap_load->tileset_width, tilemap_load->tileset_height, &state, &tilemap_load->version);
+            if (IsJobCancelled(state))
+                return;
+            
+            if (!load_result)
+            {
+                const Error& error = load_result.GetError();
+                tilemap_load->error_message = error.message;
+                tilemap_load->error_details = error.details ? error.details : "";
+                return;
+            }
+            
+            tilemap_load->tilemap = std::move(load_result.GetValue());
+            tilemap_load->loaded = true;
+        });
+        
+        if (!result)
         {
             OpenErrorPopup("Failed to Open Tilemap", result.GetError());
+            return;
         }
+        
+        m_LoadJob = std::move(result.GetValue());
+        m_TilemapLoad = tilemap_load;
     }
     
     void MapViewport::SaveTilemap()
+    {
+        if (m_TilemapFilepath.empty())
+        {
+            SaveTilemapAs();
+            return;
+        }
+        
+        SaveTilemapFile(m_TilemapFilepath.c_str(), m_TilemapVersion);
+    }
+    
+    void MapViewport::SaveTilemapAs()
     {
         static SDL_DialogFileFilter filters[] = {
-            { "SBM files", "sbm" },
+            { "SBM v2 files (chunked)", "sbm" },
+            { "SBM v1 files (compact cells)", "sbm" },
+            { "SBM v1 files (legacy 12 byte cells)", "sbm" },
             { "All files", "*" },
         };
         
@@ -128,199 +285,740 @@ namespace SBMap
             this, m_Context->GetWindow(), filters, SDL_arraysize(filters), nullptr);
     }
     
-    void MapViewport::SaveTilemapFile(const char* filepath)
+    // Saving again to the same file in the same format appends to its journal
+    // until the journal grows past its limit
+    void MapViewport::SaveTilemapFile(const char* filepath, TilemapFileVersion version)
     {
-        auto result = SaveTilemapToDisk(m_Tilemap, filepath);
+        if (!IsTilemapValid(m_Tilemap))
+        {
+            OpenErrorPopup("Failed to Save Tilemap", Error{ "Tilemap is incomplete and cannot be saved." });
+            return;
+        }
+        
+        if (m_SaveJob.IsRunning())
+        {
+            OpenErrorPopup("Failed to Save Tilemap", Error{ "Another save is still in progress." });
+            return;
+        }
+        
+        if (m_TilemapFilepath == filepath && version == m_TilemapVersion && m_JournalLimit > 0 && !m_JournalRewrite)
+        {
+            if (AppendTilemapJournal(filepath))
+                return;
+        }
+        
+        std::shared_ptr<const Tilemap> snapshot = std::make_shared<const Tilemap>(CopyTilemapCells(m_Tilemap));
+        std::shared_ptr<TilemapSave> tilemap_save = std::make_shared<TilemapSave>();
+        tilemap_save->filepath = filepath;
+        tilemap_save->version = version;
+        tilemap_save->edit_count = m_EditCount;
+        
+        std::string path = filepath;
+        
+        auto result = Job::Start("SBMapTilemapSave", [snapshot, tilemap_save, path, version](JobState& state)
+        {
+            auto save_result = SaveTilemapToDisk(*snapshot, path.c_str(), version, &state);
+            if (!save_result)
+            {
+                const Error& error = save_result.GetError();
+                tilemap_save->error_message = error.message;
+                tilemap_save->error_details = error.details ? error.details : "";
+                return;
+            }
+            
+            SDL_PathInfo path_info;
+            if (SDL_GetPathInfo(path.c_str(), &path_info))
+                tilemap_save->file_size = (int64)path_info.size;
+            
+            tilemap_save->saved = true;
+        });
+        
         if (!result)
+        {
             OpenErrorPopup("Failed to Save Tilemap", result.GetError());
+            return;
+        }
+        
+        m_SaveJob = std::move(result.GetValue());
+        m_TilemapSave = tilemap_save;
+        
+        m_JournalChunks.clear();
+        m_JournalLimit = 0;
+        m_JournalRewrite = false;
     }
     
-    void MapViewport::RenderTilemap()
+    // Returns false when the map has to be written whole instead
+    bool MapViewport::AppendTilemapJournal(const char* filepath)
     {
-        Tileset& tileset = m_Tilemap.tileset;
+        std::vector<uint32> chunk_keys(m_JournalChunks.begin(), m_JournalChunks.end());
         
-        ImVec2 window_begin = ImGui::GetCursorScreenPos();
-        ImDrawList* draw_list = ImGui::GetWindowDrawList();
+        auto result = SBMap::AppendTilemapJournal(m_Tilemap, filepath, chunk_keys.data(), chunk_keys.size());
+        if (!result)
+            return false;
         
-        float32 tile_width_scaled = (float32)tileset.tile_width * m_Scale;
-        float32 tile_height_scaled = (float32)tileset.tile_height * m_Scale;
+        m_JournalChunks.clear();
+        m_SavedEditCount = m_EditCount;
         
-        for (int32 y = 0; y < m_Tilemap.height; y++)
+        return result.GetValue() <= m_JournalLimit;
+    }
+    
+    void MapViewport::UpdateTilemapJobs()
+    {
+        if (m_LoadJob.IsFinished())
         {
-            for (int32 x = 0; x < m_Tilemap.width; x++)
+            std::shared_ptr<TilemapLoad> tilemap_load = std::move(m_TilemapLoad);
+            m_LoadJob = {};
+            
+            const Tileset& tileset = m_Context->GetTilePalette().GetTileset();
+            
+            if (!tilemap_load->loaded)
             {
-                Tilemap::Cell& cell = GetTilemapCell(m_Tilemap, x, y);
-                if (cell.tile_x < 0 || cell.tile_y < 0)
-                    continue;
-                
-                ImVec2 source_min;
-                source_min.x = (float32)(cell.tile_x * tileset.tile_width) / (float32)tileset.atlas.width;
-                source_min.y = (float32)(cell.tile_y * tileset.tile_height) / (float32)tileset.atlas.height;
-                
-                ImVec2 source_max;
-                source_max.x = source_min.x + (float32)tileset.tile_width / (float32)tileset.atlas.width;
-                source_max.y = source_min.y + (float32)tileset.tile_height / (float32)tileset.atlas.height;
+                Error error = GetJobError(tilemap_load->error_message, tilemap_load->error_details);
+                OpenErrorPopup("Failed to Open Tilemap", error);
+            }
+            else if (tileset.width != tilemap_load->tileset_width || tileset.height != tilemap_load->tileset_height)
+            {
+                OpenErrorPopup("Failed to Open Tilemap", Error{ "Tileset was changed while the tilemap was loading." });
+            }
+            else
+            {
+                m_Tilemap = std::move(tilemap_load->tilemap);
+                m_Tilemap.tileset = tileset;
+                m_InputWidth = m_Tilemap.width;
+                m_InputHeight = m_Tilemap.height;
+                m_CameraX = 0.0;
+                m_CameraY = 0.0;
+                m_ChunkCache.InvalidateAll();
+                m_FlagOverlay.InvalidateAll();
                 
-                ImVec2 dest_min;
-                dest_min.x = window_begin.x + (float32)x * tile_width_scaled;
-                dest_min.y = window_begin.y + (float32)y * tile_height_scaled;
+                // A save still running holds the previous map
+                if (m_TilemapSave)
+                    m_TilemapSave->filepath.clear();
                 
-                ImVec2 dest_max;
-                dest_max.x = dest_min.x + tile_width_scaled;
-                dest_max.y = dest_min.y + tile_height_scaled;
+                m_TilemapFilepath = tilemap_load->recovery ? std::string() : tilemap_load->filepath;
+                // Plain saves keep the format the file was opened in, only Save As changes it
+                m_TilemapVersion = tilemap_load->version;
+                m_JournalChunks.clear();
+                m_JournalLimit = 0;
+                m_EditHistory.Clear();
+                m_FlagCountsValid = false;
                 
-                ImTextureRef atlas_image_ref = GetTextureImGuiID(tileset.atlas);
-                draw_list->AddImage(atlas_image_ref, dest_min, dest_max, source_min, source_max);
+                m_EditCount++;
+                m_AutosavedEditCount = m_EditCount;
+                if (!tilemap_load->recovery)
+                    m_SavedEditCount = m_EditCount;
+                else
+                    m_OfferRecovery = false;
+            }
+        }
+        
+        if (m_SaveJob.IsFinished())
+        {
+            std::shared_ptr<TilemapSave> tilemap_save = std::move(m_TilemapSave);
+            m_SaveJob = {};
+            
+            if (!tilemap_save->saved)
+            {
+                Error error = GetJobError(tilemap_save->error_message, tilemap_save->error_details);
+                OpenErrorPopup("Failed to Save Tilemap", error);
+                m_QuitRequested = false;
+            }
+            else if (!tilemap_save->filepath.empty())
+            {
+                // Replaying costs about as much as loading once the journal is half the file
+                m_TilemapFilepath = tilemap_save->filepath;
+                m_TilemapVersion = tilemap_save->version;
+                m_JournalLimit = SDL_max(tilemap_save->file_size / 2, MAP_JOURNAL_MINIMUM_LIMIT);
+                m_SavedEditCount = SDL_max(m_SavedEditCount, tilemap_save->edit_count);
             }
         }
     }
     
-    void MapViewport::RenderTilemapOverlay()
+    // Nothing is written while an autosave from an earlier session waits to be recovered
+    void MapViewport::UpdateAutosave()
     {
-        if (m_SelectedLayer == MapLayer::Tiles)
+        if (m_AutosaveJob.IsFinished())
+        {
+            std::shared_ptr<TilemapSave> tilemap_autosave = std::move(m_TilemapAutosave);
+            m_AutosaveJob = {};
+            
+            if (tilemap_autosave->saved)
+            {
+                m_AutosavedEditCount = tilemap_autosave->edit_count;
+                m_AutosaveError.clear();
+            }
+            else
+            {
+                m_AutosaveError = tilemap_autosave->error_message;
+            }
+        }
+        
+        if (m_AutosaveFilepath.empty() || m_AutosaveInterval <= 0 || m_OfferRecovery || m_AutosaveJob.IsRunning())
+            return;
+        
+        uint64 time = SDL_GetTicks();
+        if (time - m_AutosaveTime < (uint64)m_AutosaveInterval * 1000)
+            return;
+        
+        m_AutosaveTime = time;
+        
+        if (m_EditCount == m_AutosavedEditCount || !IsTilemapValid(m_Tilemap))
+            return;
+        
+        if (m_EditCount == m_SavedEditCount)
+        {
+            SDL_RemovePath(m_AutosaveFilepath.c_str());
+            m_AutosavedEditCount = m_EditCount;
+            return;
+        }
+        
+        std::shared_ptr<const Tilemap> snapshot = std::make_shared<const Tilemap>(CopyTilemapCells(m_Tilemap));
+        std::shared_ptr<TilemapSave> tilemap_autosave = std::make_shared<TilemapSave>();
+        tilemap_autosave->filepath = m_AutosaveFilepath;
+        tilemap_autosave->edit_count = m_EditCount;
+        
+        auto result = Job::Start("SBMapTilemapAutosave", [snapshot, tilemap_autosave](JobState& state)
+        {
+            auto save_result = SaveTilemapToDisk(*snapshot, tilemap_autosave->filepath.c_str(), TilemapFileVersion::V2, &state);
+            if (!save_result)
+            {
+                tilemap_autosave->error_message = save_result.GetError().message;
+                return;
+            }
+            
+            tilemap_autosave->saved = true;
+        });
+        
+        if (!result)
+        {
+            m_AutosaveError = result.GetError().message;
             return;
+        }
+        
+        m_AutosaveJob = std::move(result.GetValue());
+        m_TilemapAutosave = tilemap_autosave;
+    }
+    
+    CellRange MapViewport::GetVisibleCellRange() const
+    {
+        const Tileset& tileset = m_Tilemap.tileset;
+        
+        float64 visible_min_x = m_CameraX;
+        float64 visible_min_y = m_CameraY;
+        float64 visible_max_x = m_CameraX + (float64)m_ViewSize.x / (float64)m_Scale;
+        float64 visible_max_y = m_CameraY + (float64)m_ViewSize.y / (float64)m_Scale;
+        
+        int32 begin_x = (int32)SDL_floor(visible_min_x / (float64)tileset.tile_width);
+        int32 begin_y = (int32)SDL_floor(visible_min_y / (float64)tileset.tile_height);
+        int32 end_x = (int32)SDL_ceil(visible_max_x / (float64)tileset.tile_width);
+        int32 end_y = (int32)SDL_ceil(visible_max_y / (float64)tileset.tile_height);
+        
+        CellRange range;
+        range.begin_x = SDL_clamp(begin_x, 0, m_Tilemap.width);
+        range.begin_y = SDL_clamp(begin_y, 0, m_Tilemap.height);
+        range.end_x = SDL_clamp(end_x, range.begin_x, m_Tilemap.width);
+        range.end_y = SDL_clamp(end_y, range.begin_y, m_Tilemap.height);
         
+        return range;
+    }
+    
+    // Maps too large to fit the view at the usual minimum zoom out further
+    float32 MapViewport::GetMinimumScale() const
+    {
+        const Tileset& tileset = m_Tilemap.tileset;
+        float64 map_width = (float64)m_Tilemap.width * (float64)tileset.tile_width;
+        float64 map_height = (float64)m_Tilemap.height * (float64)tileset.tile_height;
+        
+        if (map_width <= 0.0 || map_height <= 0.0 || m_ViewSize.x <= 0.0f || m_ViewSize.y <= 0.0f)
+            return MAP_MINIMUM_SCALE;
+        
+        float64 fit_scale = SDL_min((float64)m_ViewSize.x / map_width, (float64)m_ViewSize.y / map_height);
+        return (float32)SDL_min(fit_scale, (float64)MAP_MINIMUM_SCALE);
+    }
+    
+    // Worked out relative to the camera in double precision to stay exact on large maps
+    ImVec2 MapViewport::GetCellScreenPosition(int32 cell_x, int32 cell_y) const
+    {
+        const Tileset& tileset = m_Tilemap.tileset;
+        
+        float64 offset_x = ((float64)cell_x * (float64)tileset.tile_width - m_CameraX) * (float64)m_Scale;
+        float64 offset_y = ((float64)cell_y * (float64)tileset.tile_height - m_CameraY) * (float64)m_Scale;
+        
+        ImVec2 position;
+        position.x = m_ViewOrigin.x + (float32)offset_x;
+        position.y = m_ViewOrigin.y + (float32)offset_y;
+        
+        return position;
+    }
+    
+    void MapViewport::GetScreenCell(const ImVec2& position, int32& cell_x, int32& cell_y) const
+    {
+        const Tileset& tileset = m_Tilemap.tileset;
+        
+        ImVec2 view_position = position - m_ViewOrigin;
+        float64 map_x = m_CameraX + (float64)view_position.x / (float64)m_Scale;
+        float64 map_y = m_CameraY + (float64)view_position.y / (float64)m_Scale;
+        
+        cell_x = (int32)SDL_floor(map_x / (float64)tileset.tile_width);
+        cell_y = (int32)SDL_floor(map_y / (float64)tileset.tile_height);
+    }
+    
+    void MapViewport::UpdateCamera(bool hovered)
+    {
+        const Tileset& tileset = m_Tilemap.tileset;
+        
+        if (hovered)
+        {
+            ImGuiIO& io = ImGui::GetIO();
+            float32 wheel_x = io.MouseWheelH;
+            float32 wheel_y = io.MouseWheel;
+            
+            if (io.KeyShift && wheel_x == 0.0f)
+            {
+                wheel_x = wheel_y;
+                wheel_y = 0.0f;
+            }
+            
+            float64 scroll_step = (float64)(ImGui::GetTextLineHeightWithSpacing() * 5.0f) / (float64)m_Scale;
+            m_CameraX -= (float64)wheel_x * scroll_step;
+            m_CameraY -= (float64)wheel_y * scroll_step;
+        }
+        
+        float64 map_width = (float64)m_Tilemap.width * (float64)tileset.tile_width;
+        float64 map_height = (float64)m_Tilemap.height * (float64)tileset.tile_height;
+        
+        float64 maximum_camera_x = SDL_max(map_width - (float64)m_ViewSize.x / (float64)m_Scale, 0.0);
+        float64 maximum_camera_y = SDL_max(map_height - (float64)m_ViewSize.y / (float64)m_Scale, 0.0);
+        
+        m_CameraX = SDL_clamp(m_CameraX, 0.0, maximum_camera_x);
+        m_CameraY = SDL_clamp(m_CameraY, 0.0, maximum_camera_y);
+    }
+    
+    void MapViewport::InvalidateRenderCache()
+    {
+        m_ChunkCache.InvalidateAll();
+        m_FlagOverlay.InvalidateAll();
+    }
+    
+    void MapViewport::RenderTilemap(const CellRange& range)
+    {
         Tileset& tileset = m_Tilemap.tileset;
         
-        ImVec2 window_begin = ImGui::GetCursorScreenPos();
+        ImVec2 range_begin = GetCellScreenPosition(range.begin_x, range.begin_y);
         ImDrawList* draw_list = ImGui::GetWindowDrawList();
         
         float32 tile_width_scaled = (float32)tileset.tile_width * m_Scale;
         float32 tile_height_scaled = (float32)tileset.tile_height * m_Scale;
         
-        ImColor overlay_color = { 0, 0, 0, 80 };
+        m_ChunkCache.BeginFrame(m_Tilemap);
+        
+        int32 level = m_ChunkCache.GetLevelForScale(m_Scale);
+        int32 chunk_width = m_ChunkCache.GetChunkWidth(level);
+        int32 chunk_height = m_ChunkCache.GetChunkHeight(level);
+        
+        int32 begin_chunk_x = range.begin_x / chunk_width;
+        int32 begin_chunk_y = range.begin_y / chunk_height;
+        int32 end_chunk_x = GetChunkCount(range.end_x, chunk_width);
+        int32 end_chunk_y = GetChunkCount(range.end_y, chunk_height);
+        
+        // The batch only needs rebuilding if chunk textures changed or the view moved
+        for (int32 chunk_y = begin_chunk_y; chunk_y < end_chunk_y; chunk_y++)
+        {
+            for (int32 chunk_x = begin_chunk_x; chunk_x < end_chunk_x; chunk_x++)
+                m_ChunkCache.GetChunkTexture(m_Tilemap, level, chunk_x, chunk_y);
+        }
+        
+        TileBatchKey batch_key;
+        batch_key.range = range;
+        batch_key.origin_x = range_begin.x;
+        batch_key.origin_y = range_begin.y;
+        batch_key.scale = m_Scale;
+        batch_key.revision = m_ChunkCache.GetRevision();
         
-        for (int32 y = 0; y < m_Tilemap.height; y++)
+        if (!IsSameTileBatchKey(batch_key, m_TilemapBatchKey))
         {
-            for (int32 x = 0; x < m_Tilemap.width; x++)
+            m_TilemapBatch.Clear();
+            m_TilemapBatchKey = batch_key;
+            
+            SDL_FRect source_rect = { 0.0f, 0.0f, 1.0f, 1.0f };
+            
+            for (int32 chunk_y = begin_chunk_y; chunk_y < end_chunk_y; chunk_y++)
             {
-                uint32_t tile_flag = GetMapLayerTileFlag(m_SelectedLayer);
-                Tilemap::Cell& cell = GetTilemapCell(m_Tilemap, x, y);
-                if (!(cell.flags & tile_flag))
+                for (int32 chunk_x = begin_chunk_x; chunk_x < end_chunk_x; chunk_x++)
+                {
+                    const Texture2D* chunk_texture = m_ChunkCache.GetChunkTexture(m_Tilemap, level, chunk_x, chunk_y);
+                    if (!chunk_texture)
+                        continue;
+                    
+                    int32 begin_x = chunk_x * chunk_width;
+                    int32 begin_y = chunk_y * chunk_height;
+                    int32 end_x = SDL_min(begin_x + chunk_width, m_Tilemap.width);
+                    int32 end_y = SDL_min(begin_y + chunk_height, m_Tilemap.height);
+                    
+                    ImVec2 chunk_begin = GetCellScreenPosition(begin_x, begin_y);
+                    
+                    SDL_FRect dest_rect;
+                    dest_rect.x = chunk_begin.x;
+                    dest_rect.y = chunk_begin.y;
+                    dest_rect.w = (float32)(end_x - begin_x) * tile_width_scaled;
+                    dest_rect.h = (float32)(end_y - begin_y) * tile_height_scaled;
+                    
+                    m_TilemapBatch.AddQuad(chunk_texture->handle, dest_rect, source_rect);
+                }
+            }
+        }
+        
+        m_TilemapBatch.AddToDrawList(draw_list);
+    }
+    
+    void MapViewport::RenderTilemapOverlay(const CellRange& range)
+    {
+        m_FlagOverlay.BeginFrame();
+        
+        if (m_SelectedLayer == MapLayer::Tiles && !m_ShowAllFlags)
+            return;
+        
+        uint32 tile_flags = GetMapLayerTileFlag(m_SelectedLayer);
+        if (m_ShowAllFlags)
+            tile_flags = Tilemap::TileFlagsWall | Tilemap::TileFlagsLeftGoal | Tilemap::TileFlagsRightGoal;
+        
+        const Tileset& tileset = m_Tilemap.tileset;
+        float32 cell_scale = (float32)SDL_min(tileset.tile_width, tileset.tile_height) * m_Scale;
+        int32 level = m_FlagOverlay.GetLevelForScale(cell_scale);
+        
+        m_FlagOverlay.Update(m_Tilemap, level, range, tile_flags);
+        
+        if (m_ShowAllFlags)
+        {
+            RenderFlagMask(range, level, MapLayer::Walls, ImColor(0, 0, 0, 110));
+            RenderFlagMask(range, level, MapLayer::LeftGoals, ImColor(220, 60, 60, 110));
+            RenderFlagMask(range, level, MapLayer::RightGoals, ImColor(60, 110, 220, 110));
+        }
+        else
+        {
+            RenderFlagMask(range, level, m_SelectedLayer, ImColor(0, 0, 0, 80));
+        }
+    }
+    
+    void MapViewport::RenderFlagMask(const CellRange& range, int32 level, MapLayer layer, uint32 color)
+    {
+        ImDrawList* draw_list = ImGui::GetWindowDrawList();
+        uint32 tile_flag = GetMapLayerTileFlag(layer);
+        
+        int32 page_width = m_FlagOverlay.GetPageWidth(level);
+        int32 page_height = m_FlagOverlay.GetPageHeight(level);
+        
+        int32 begin_page_x = range.begin_x / page_width;
+        int32 begin_page_y = range.begin_y / page_height;
+        int32 end_page_x = GetChunkCount(range.end_x, page_width);
+        int32 end_page_y = GetChunkCount(range.end_y, page_height);
+        
+        for (int32 page_y = begin_page_y; page_y < end_page_y; page_y++)
+        {
+            for (int32 page_x = begin_page_x; page_x < end_page_x; page_x++)
+            {
+                const Texture2D* mask = m_FlagOverlay.GetMaskTexture(level, page_x, page_y, tile_flag);
+                if (!mask)
                     continue;
                 
-                ImVec2 dest_min;
-                dest_min.x = window_begin.x + (float32)x * tile_width_scaled;
-                dest_min.y = window_begin.y + (float32)y * tile_height_scaled;
+                // Pages may reach past the map, the mask is transparent there
+                int32 begin_x = page_x * page_width;
+                int32 begin_y = page_y * page_height;
                 
-                ImVec2 dest_max;
-                dest_max.x = dest_min.x + tile_width_scaled;
-                dest_max.y = dest_min.y + tile_height_scaled;
+                ImVec2 dest_min = GetCellScreenPosition(begin_x, begin_y);
+                ImVec2 dest_max = GetCellScreenPosition(begin_x + page_width, begin_y + page_height);
                 
-                draw_list->AddRectFilled(dest_min, dest_max, overlay_color);
+                ImTextureRef mask_image_ref = GetTextureImGuiID(*mask);
+                draw_list->AddImage(mask_image_ref, dest_min, dest_max, ImVec2(0.0f, 0.0f), ImVec2(1.0f, 1.0f), color);
             }
         }
     }
     
-    void MapViewport::RenderTileGrid()
+    void MapViewport::RenderTileGrid(const CellRange& range)
     {
         if (!m_ShowGrid)
             return;
         
         Tileset& tileset = m_Tilemap.tileset;
         
-        ImVec2 window_begin = ImGui::GetCursorScreenPos();
+        ImVec2 range_begin = GetCellScreenPosition(range.begin_x, range.begin_y);
         ImDrawList* draw_list = ImGui::GetWindowDrawList();
         
         float32 tile_width_scaled = (float32)tileset.tile_width * m_Scale;
         float32 tile_height_scaled = (float32)tileset.tile_height * m_Scale;
         
-        float32 line_width = (float32)m_Tilemap.width * tile_width_scaled;
-        float32 column_height = (float32)m_Tilemap.height * tile_height_scaled;
-        
-        ImColor color = { 255, 255, 255, 255 };
+        TileBatchKey batch_key;
+        batch_key.range = range;
+        batch_key.origin_x = range_begin.x;
+        batch_key.origin_y = range_begin.y;
+        batch_key.scale = m_Scale;
         
-        for (int32 x = 0; x <= m_Tilemap.width; x++)
+        if (!IsSameTileBatchKey(batch_key, m_GridBatchKey))
         {
-            ImVec2 point1;
-            point1.x = window_begin.x + (float32)x * tile_width_scaled;
-            point1.y = window_begin.y;
+            m_GridBatch.Clear();
+            m_GridBatchKey = batch_key;
             
-            ImVec2 point2;
-            point2.x = window_begin.x + (float32)x * tile_width_scaled;
-            point2.y = window_begin.y + column_height;
+            float32 line_begin = range_begin.x;
+            float32 line_end = range_begin.x + (float32)(range.end_x - range.begin_x) * tile_width_scaled;
+            float32 column_begin = range_begin.y;
+            float32 column_end = range_begin.y + (float32)(range.end_y - range.begin_y) * tile_height_scaled;
             
-            draw_list->AddLine(point1, point2, color);
+            // AddLine centers a one pixel line half a pixel past each point, so a quad
+            // starting at the point covers the same pixels
+            SDL_FRect source_rect = { 0.0f, 0.0f, 0.0f, 0.0f };
+            SDL_FColor color = { 1.0f, 1.0f, 1.0f, 1.0f };
+            
+            for (int32 x = range.begin_x; x <= range.end_x; x++)
+            {
+                SDL_FRect dest_rect;
+                dest_rect.x = range_begin.x + (float32)(x - range.begin_x) * tile_width_scaled;
+                dest_rect.y = column_begin;
+                dest_rect.w = 1.0f;
+                dest_rect.h = column_end - column_begin + 1.0f;
+                
+                m_GridBatch.AddQuad(nullptr, dest_rect, source_rect, color);
+            }
+            
+            for (int32 y = range.begin_y; y <= range.end_y; y++)
+            {
+                SDL_FRect dest_rect;
+                dest_rect.x = line_begin;
+                dest_rect.y = range_begin.y + (float32)(y - range.begin_y) * tile_height_scaled;
+                dest_rect.w = line_end - line_begin + 1.0f;
+                dest_rect.h = 1.0f;
+                
+                m_GridBatch.AddQuad(nullptr, dest_rect, source_rect, color);
+            }
         }
         
-        for (int32 y = 0; y <= m_Tilemap.height; y++)
+        m_GridBatch.AddToDrawList(draw_list);
+    }
+    
+    void MapViewport::RenderTileMarker(bool hovered)
+    {
+        if (!hovered || !m_ShowMarker)
+            return;
+        
+        int32 hovered_cell_x;
+        int32 hovered_cell_y;
+        GetScreenCell(ImGui::GetMousePos(), hovered_cell_x, hovered_cell_y);
+        
+        if (!IsInTilemapBounds(m_Tilemap, hovered_cell_x, hovered_cell_y))
+            return;
+        
+        ImDrawList* draw_list = ImGui::GetWindowDrawList();
+        
+        float32 tile_width_scaled = (float32)m_Tilemap.tileset.tile_width * m_Scale;
+        float32 tile_height_scaled = (float32)m_Tilemap.tileset.tile_height * m_Scale;
+        
+        ImVec2 marker_min = GetCellScreenPosition(hovered_cell_x, hovered_cell_y);
+        
+        ImVec2 marker_max;
+        marker_max.x = marker_min.x + tile_width_scaled;
+        marker_max.y = marker_min.y + tile_height_scaled;
+        
+        ImColor marker_color = { 255, 255, 255, 255 };
+        
+        draw_list->AddRect(marker_min, marker_max, marker_color, 0.0f, 0, 3.0f);
+    }
+    
+    void MapViewport::AddStrokeSample(float32 x, float32 y)
+    {
+        m_StrokeSamples.push_back(ImVec2(x, y));
+    }
+    
+    // Joins every mouse motion sample since the last frame with lines, so fast drags leave no gaps
+    void MapViewport::PaintStroke(bool hovered)
+    {
+        bool left_down = ImGui::IsMouseDown(ImGuiMouseButton_Left);
+        bool right_down = ImGui::IsMouseDown(ImGuiMouseButton_Right);
+        
+        if (!left_down && !right_down)
+            return;
+        
+        m_StrokeSamples.push_back(ImGui::GetMousePos());
+        
+        if (!m_EditHistory.IsRecording())
+        {
+            if (!hovered)
+                return;
+            
+            m_EditHistory.BeginCommand(m_Tilemap);
+            m_StrokeCells.clear();
+            GetScreenCell(m_StrokeSamples.front(), m_StrokeCellX, m_StrokeCellY);
+        }
+        
+        for (const ImVec2& sample : m_StrokeSamples)
         {
-            ImVec2 point1;
-            point1.x = window_begin.x;
-            point1.y = window_begin.y + (float32)y * tile_height_scaled;
+            int32 cell_x;
+            int32 cell_y;
+            GetScreenCell(sample, cell_x, cell_y);
             
-            ImVec2 point2;
-            point2.x = window_begin.x + line_width;
-            point2.y = window_begin.y + (float32)y * tile_height_scaled;
+            PaintStrokeLine(m_StrokeCellX, m_StrokeCellY, cell_x, cell_y, !left_down);
             
-            draw_list->AddLine(point1, point2, color);
+            m_StrokeCellX = cell_x;
+            m_StrokeCellY = cell_y;
         }
     }
     
-    void MapViewport::RenderTileMarker()
+    void MapViewport::PaintStrokeLine(int32 begin_x, int32 begin_y, int32 end_x, int32 end_y, bool erase)
     {
-        Tileset& tileset = m_Tilemap.tileset;
-        const TilePalette& tile_palette = m_Context->GetTilePalette();
+        int32 delta_x = SDL_abs(end_x - begin_x);
+        int32 delta_y = -SDL_abs(end_y - begin_y);
+        int32 step_x = begin_x < end_x ? 1 : -1;
+        int32 step_y = begin_y < end_y ? 1 : -1;
+        int32 error = delta_x + delta_y;
         
-        ImVec2 window_begin = ImGui::GetCursorScreenPos();
-        ImDrawList* draw_list = ImGui::GetWindowDrawList();
+        int32 cell_x = begin_x;
+        int32 cell_y = begin_y;
         
-        if (ImGui::IsWindowHovered())
+        while (true)
         {
-            float32 tile_width_scaled = (float32)tileset.tile_width * m_Scale;
-            float32 tile_height_scaled = (float32)tileset.tile_height * m_Scale;
-            
-            ImVec2 mouse_position = ImGui::GetMousePos() - window_begin;
-            int32 hovered_cell_x = (int32)(mouse_position.x / tile_width_scaled);
-            int32 hovered_cell_y = (int32)(mouse_position.y / tile_height_scaled);
+            PaintStrokeCell(cell_x, cell_y, erase);
             
-            if (!IsInTilemapBounds(m_Tilemap, hovered_cell_x, hovered_cell_y))
-                return;
+            if (cell_x == end_x && cell_y == end_y)
+                break;
             
-            Tilemap::Cell& cell = GetTilemapCell(m_Tilemap, hovered_cell_x, hovered_cell_y);
+            int32 error2 = error * 2;
+            if (error2 >= delta_y)
+            {
+                error += delta_y;
+                cell_x += step_x;
+            }
             
-            if (ImGui::IsMouseDown(ImGuiMouseButton_Left))
+            if (error2 <= delta_x)
             {
-                if (m_SelectedLayer == MapLayer::Tiles)
-                {
-                    cell.tile_x = tile_palette.GetSelectedTileX();
-                    cell.tile_y = tile_palette.GetSelectedTileY();
-                }
-                else
-                {
-                    uint32_t tile_flag = GetMapLayerTileFlag(m_SelectedLayer);
-                    cell.flags |= tile_flag;
-                }
+                error += delta_x;
+                cell_y += step_y;
             }
-            else if (ImGui::IsMouseDown(ImGuiMouseButton_Right))
+        }
+    }
+    
+    void MapViewport::PaintStrokeCell(int32 cell_x, int32 cell_y, bool erase)
+    {
+        if (!IsInTilemapBounds(m_Tilemap, cell_x, cell_y))
+            return;
+        
+        if (!m_StrokeCells.insert(GetCellChangePosition(cell_x, cell_y)).second)
+            return;
+        
+        const TilePalette& tile_palette = m_Context->GetTilePalette();
+        Tilemap::Cell cell = GetTilemapCell(m_Tilemap, cell_x, cell_y);
+        
+        if (m_SelectedLayer == MapLayer::Tiles)
+        {
+            if (erase)
+                ClearCellTile(cell);
+            else
+                SetCellTile(cell, tile_palette.GetSelectedTileX(), tile_palette.GetSelectedTileY());
+        }
+        else
+        {
+            uint32 tile_flag = GetMapLayerTileFlag(m_SelectedLayer);
+            SetCellFlags(cell, erase ? GetCellFlags(cell) & ~tile_flag : GetCellFlags(cell) | tile_flag);
+        }
+        
+        SetTilemapCell(cell_x, cell_y, cell);
+    }
+    
+    void MapViewport::FillRegion(bool hovered)
+    {
+        bool left_clicked = ImGui::IsMouseClicked(ImGuiMouseButton_Left);
+        bool right_clicked = ImGui::IsMouseClicked(ImGuiMouseButton_Right);
+        
+        if (!hovered || (!left_clicked && !right_clicked))
+            return;
+        
+        int32 cell_x;
+        int32 cell_y;
+        GetScreenCell(ImGui::GetMousePos(), cell_x, cell_y);
+        
+        if (!IsInTilemapBounds(m_Tilemap, cell_x, cell_y))
+            return;
+        
+        EndEditCommand();
+        
+        Tilemap previous = CopyTilemapCells(m_Tilemap);
+        m_EditHistory.BeginCommand(m_Tilemap);
+        
+        CellRange filled_range;
+        if (m_SelectedLayer == MapLayer::Tiles)
+        {
+            const TilePalette& tile_palette = m_Context->GetTilePalette();
+            
+            Tilemap::Cell tile_cell;
+            if (left_clicked)
+                SetCellTile(tile_cell, tile_palette.GetSelectedTileX(), tile_palette.GetSelectedTileY());
+            
+            filled_range = FloodFillTiles(m_Tilemap, cell_x, cell_y, tile_cell);
+        }
+        else
+        {
+            filled_range = FloodFillFlagLayer(m_Tilemap, GetMapLayerTileFlag(m_SelectedLayer), cell_x, cell_y, left_clicked);
+        }
+        
+        m_EditHistory.RecordChunks(previous, m_Tilemap);
+        m_EditHistory.EndCommand(m_Tilemap);
+        
+        if (IsCellRangeEmpty(filled_range))
+            return;
+        
+        m_FlagCountsValid = false;
+        
+        if (m_SelectedLayer == MapLayer::Tiles)
+            m_ChunkCache.InvalidateRows(filled_range.begin_y, filled_range.end_y);
+        else
+            m_FlagOverlay.InvalidateRows(filled_range.begin_y, filled_range.end_y);
+        
+        int32 begin_chunk_x = filled_range.begin_x / TILEMAP_CHUNK_WIDTH;
+        int32 begin_chunk_y = filled_range.begin_y / TILEMAP_CHUNK_HEIGHT;
+        int32 end_chunk_x = (filled_range.end_x + TILEMAP_CHUNK_WIDTH - 1) / TILEMAP_CHUNK_WIDTH;
+        int32 end_chunk_y = (filled_range.end_y + TILEMAP_CHUNK_HEIGHT - 1) / TILEMAP_CHUNK_HEIGHT;
+        
+        // A fill over a large part of the map is written whole like a layer operation
+        int64 fill_chunk_count = (int64)(end_chunk_x - begin_chunk_x) * (int64)(end_chunk_y - begin_chunk_y);
+        if (fill_chunk_count > MAP_JOURNAL_FILL_CHUNK_LIMIT)
+        {
+            m_JournalRewrite = true;
+        }
+        else
+        {
+            for (int32 chunk_y = begin_chunk_y; chunk_y < end_chunk_y; chunk_y++)
             {
-                if (m_SelectedLayer == MapLayer::Tiles)
-                {
-                    cell.tile_x = -1;
-                    cell.tile_y = -1;
-                }
-                else
-                {
-                    uint32_t tile_flag = GetMapLayerTileFlag(m_SelectedLayer);
-                    cell.flags &= ~tile_flag;
-                }
+                for (int32 chunk_x = begin_chunk_x; chunk_x < end_chunk_x; chunk_x++)
+                    m_JournalChunks.insert(GetTilemapChunkKey(chunk_x, chunk_y));
             }
+        }
+        
+        m_EditCount++;
+    }
+    
+    void MapViewport::SetTilemapCell(int32 cell_x, int32 cell_y, const Tilemap::Cell& value)
+    {
+        Tilemap::Cell cell = GetTilemapCell(m_Tilemap, cell_x, cell_y);
+        if ((cell.bits & ~TILEMAP_CELL_FLAGS_MASK) != (value.bits & ~TILEMAP_CELL_FLAGS_MASK))
+            m_ChunkCache.InvalidateCell(cell_x, cell_y);
+        if (GetCellFlags(cell) != GetCellFlags(value))
+        {
+            m_FlagOverlay.InvalidateCell(cell_x, cell_y);
             
-            if (m_ShowMarker)
+            for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
             {
-                ImVec2 marker_min;
-                marker_min.x = window_begin.x + (float32)hovered_cell_x * tile_width_scaled;
-                marker_min.y = window_begin.y + (float32)hovered_cell_y * tile_height_scaled;
-                
-                ImVec2 marker_max;
-                marker_max.x = marker_min.x + tile_width_scaled;
-                marker_max.y = marker_min.y + tile_height_scaled;
-                
-                ImColor marker_color = { 255, 255, 255, 255 };
-                
-                draw_list->AddRect(marker_min, marker_max, marker_color, 0.0f, 0, 3.0f);
+                uint32 tile_flag = 1u << plane;
+                if ((GetCellFlags(cell) ^ GetCellFlags(value)) & tile_flag)
+                    m_FlagCounts[plane] += (GetCellFlags(value) & tile_flag) ? 1 : -1;
             }
         }
+        if (cell.bits != value.bits)
+        {
+            m_JournalChunks.insert(GetTilemapChunkKey(cell_x / TILEMAP_CHUNK_WIDTH, cell_y / TILEMAP_CHUNK_HEIGHT));
+            m_EditCount++;
+            
+            if (m_EditHistory.IsRecording())
+                m_EditHistory.RecordCell(cell_x, cell_y, cell.bits ^ value.bits);
+        }
+        
+        SBMap::SetTilemapCell(m_Tilemap, cell_x, cell_y, value);
     }
     
     void MapViewport::SetTilemapSize()
@@ -328,11 +1026,49 @@ namespace SBMap
         m_InputWidth = SDL_clamp(m_InputWidth, TILEMAP_MINIMUM_WIDTH, TILEMAP_MAXIMUM_WIDTH);
         m_InputHeight = SDL_clamp(m_InputHeight, TILEMAP_MINIMUM_HEIGHT, TILEMAP_MAXIMUM_HEIGHT);
         
-        m_Tilemap.width = m_InputWidth;
-        m_Tilemap.height = m_InputHeight;
+        EndEditCommand();
+        
+        Tilemap previous = CopyTilemapCells(m_Tilemap);
+        m_EditHistory.BeginCommand(m_Tilemap);
         
-        size_t cell_count = (size_t)(m_Tilemap.width * m_Tilemap.height);
-        m_Tilemap.cells.resize(cell_count);
+        ApplyTilemapSize(m_InputWidth, m_InputHeight);
+        
+        m_EditHistory.RecordChunks(previous, m_Tilemap);
+        m_EditHistory.EndCommand(m_Tilemap);
+    }
+    
+    void MapViewport::ApplyTilemapSize(int32 width, int32 height)
+    {
+        int32 previous_width = m_Tilemap.width;
+        int32 previous_height = m_Tilemap.height;
+        
+        // The journal has to record cells cut by the new edge in case the map grows again
+        for (const auto& [key, chunk] : m_Tilemap.chunks)
+        {
+            int32 end_x = ((int32)(key & 0xFFFF) + 1) * TILEMAP_CHUNK_WIDTH;
+            int32 end_y = ((int32)(key >> 16) + 1) * TILEMAP_CHUNK_HEIGHT;
+            
+            if (end_x > width || end_y > height)
+                m_JournalChunks.insert(key);
+        }
+        
+        ResizeTilemap(m_Tilemap, width, height);
+        m_FlagCountsValid = false;
+        m_EditCount++;
+        
+        // Cells keep their position, only those past the old or new edge change
+        if (m_Tilemap.width != previous_width)
+        {
+            m_ChunkCache.InvalidateAll();
+            m_FlagOverlay.InvalidateAll();
+        }
+        else
+        {
+            int32 begin_y = SDL_min(previous_height, m_Tilemap.height);
+            int32 end_y = SDL_max(previous_height, m_Tilemap.height);
+            m_ChunkCache.InvalidateRows(begin_y, end_y);
+            m_FlagOverlay.InvalidateRows(begin_y, end_y);
+        }
     }
     
     void MapViewport::ResetTilemapSize()
@@ -342,6 +1078,88 @@ namespace SBMap
         SetTilemapSize();
     }
     
+    void MapViewport::Undo()
+    {
+        EndEditCommand();
+        
+        if (!IsTilemapValid(m_Tilemap))
+            return;
+        
+        const EditCommand* command = m_EditHistory.Undo();
+        if (!command)
+            return;
+        
+        // Cells cleared by shrinking the map are put back once it has grown again
+        if (command->width != command->previous_width || command->height != command->previous_height)
+            ApplyTilemapSize(command->previous_width, command->previous_height);
+        
+        ApplyEditCommand(*command);
+        
+        m_InputWidth = m_Tilemap.width;
+        m_InputHeight = m_Tilemap.height;
+    }
+    
+    void MapViewport::Redo()
+    {
+        EndEditCommand();
+        
+        if (!IsTilemapValid(m_Tilemap))
+            return;
+        
+        const EditCommand* command = m_EditHistory.Redo();
+        if (!command)
+            return;
+        
+        ApplyEditCommand(*command);
+        
+        if (command->width != command->previous_width || command->height != command->previous_height)
+            ApplyTilemapSize(command->width, command->height);
+        
+        m_InputWidth = m_Tilemap.width;
+        m_InputHeight = m_Tilemap.height;
+    }
+    
+    void MapViewport::EndEditCommand()
+    {
+        if (m_EditHistory.IsRecording())
+            m_EditHistory.EndCommand(m_Tilemap);
+    }
+    
+    // Flips each changed cell, so the same command serves undo and redo
+    void MapViewport::ApplyEditCommand(const EditCommand& command)
+    {
+        bool invalidate_all = command.change_count > MAP_EDIT_INVALIDATE_LIMIT;
+        
+        EditRunReader reader = BeginEditRuns(command);
+        EditRun run;
+        
+        while (ReadEditRun(reader, run))
+        {
+            for (uint64 position = run.position; position < run.position + run.length; position++)
+            {
+                int32 cell_x = GetCellChangeX(position);
+                int32 cell_y = GetCellChangeY(position);
+                
+                Tilemap::Cell cell = GetTilemapCell(m_Tilemap, cell_x, cell_y);
+                cell.bits ^= run.delta;
+                
+                if (invalidate_all)
+                    SBMap::SetTilemapCell(m_Tilemap, cell_x, cell_y, cell);
+                else
+                    SetTilemapCell(cell_x, cell_y, cell);
+            }
+        }
+        
+        if (invalidate_all)
+        {
+            m_ChunkCache.InvalidateAll();
+            m_FlagOverlay.InvalidateAll();
+            m_JournalRewrite = true;
+            m_FlagCountsValid = false;
+            m_EditCount++;
+        }
+    }
+    
     void MapViewport::ShowMapSectionUI()
     {
         ImGui::SeparatorText("Map");
@@ -352,29 +1170,80 @@ namespace SBMap
         {
             Tileset& tileset = m_Tilemap.tileset;
             
-            ImVec2 content_size;
-            content_size.x = (float32)(m_Tilemap.width * tileset.tile_width) * m_Scale + 1;
-            content_size.y = (float32)(m_Tilemap.height * tileset.tile_height) * m_Scale + 1;
-            
+            // ImGui float scroll offsets lose precision on large maps
             ImGuiWindowFlags window_flags =
-                ImGuiWindowFlags_HorizontalScrollbar;
+                ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse;
             
             ImGuiChildFlags child_flags =
                 ImGuiChildFlags_Borders | ImGuiChildFlags_ResizeX | ImGuiChildFlags_ResizeY;
             
             ImGui::BeginChild("MapViewport-Map", ImVec2(480, 270), child_flags, window_flags);
             
-            RenderTilemap();
-            RenderTilemapOverlay();
-            RenderTileGrid();
-            RenderTileMarker();
+            float32 scrollbar_size = ImGui::GetStyle().ScrollbarSize;
+            ImVec2 region_size = ImGui::GetContentRegionAvail();
+            
+            m_ViewOrigin = ImGui::GetCursorScreenPos();
+            m_ViewSize.x = SDL_max(region_size.x - scrollbar_size, 1.0f);
+            m_ViewSize.y = SDL_max(region_size.y - scrollbar_size, 1.0f);
+            
+            ImGuiButtonFlags button_flags =
+                ImGuiButtonFlags_MouseButtonLeft | ImGuiButtonFlags_MouseButtonRight;
+            
+            ImGui::InvisibleButton("MapViewport-Canvas", m_ViewSize, button_flags);
+            bool hovered = ImGui::IsItemHovered();
+            
+            UpdateCamera(hovered);
+            
+            CellRange visible_range = GetVisibleCellRange();
+            int64 visible_cell_count = (int64)(visible_range.end_x - visible_range.begin_x) * (int64)(visible_range.end_y - visible_range.begin_y);
+            m_VisibleCellCount = (int32)SDL_min(visible_cell_count, (int64)SDL_MAX_SINT32);
+            
+            ImGui::PushClipRect(m_ViewOrigin, m_ViewOrigin + m_ViewSize, true);
+            
+            RenderTilemap(visible_range);
+            RenderTilemapOverlay(visible_range);
+            RenderTileGrid(visible_range);
+            if (m_SelectedTool == MapTool::Fill)
+                FillRegion(hovered);
+            else
+                PaintStroke(hovered);
+            RenderTileMarker(hovered);
+            
+            ImGui::PopClipRect();
+            
+            float64 map_width = (float64)m_Tilemap.width * (float64)tileset.tile_width * (float64)m_Scale;
+            float64 map_height = (float64)m_Tilemap.height * (float64)tileset.tile_height * (float64)m_Scale;
+            
+            ImRect scrollbar_x_rect;
+            scrollbar_x_rect.Min = ImVec2(m_ViewOrigin.x, m_ViewOrigin.y + m_ViewSize.y);
+            scrollbar_x_rect.Max = ImVec2(m_ViewOrigin.x + m_ViewSize.x, m_ViewOrigin.y + m_ViewSize.y + scrollbar_size);
+            
+            ImS64 scroll_x = (ImS64)(m_CameraX * (float64)m_Scale);
+            ImS64 previous_scroll_x = scroll_x;
+            ImGui::ScrollbarEx(scrollbar_x_rect, ImGui::GetID("MapViewport-ScrollX"), ImGuiAxis_X,
+                &scroll_x, (ImS64)m_ViewSize.x, (ImS64)map_width);
             
-            ImGui::Dummy(content_size);
+            if (scroll_x != previous_scroll_x)
+                m_CameraX = (float64)scroll_x / (float64)m_Scale;
+            
+            ImRect scrollbar_y_rect;
+            scrollbar_y_rect.Min = ImVec2(m_ViewOrigin.x + m_ViewSize.x, m_ViewOrigin.y);
+            scrollbar_y_rect.Max = ImVec2(m_ViewOrigin.x + m_ViewSize.x + scrollbar_size, m_ViewOrigin.y + m_ViewSize.y);
+            
+            ImS64 scroll_y = (ImS64)(m_CameraY * (float64)m_Scale);
+            ImS64 previous_scroll_y = scroll_y;
+            ImGui::ScrollbarEx(scrollbar_y_rect, ImGui::GetID("MapViewport-ScrollY"), ImGuiAxis_Y,
+                &scroll_y, (ImS64)m_ViewSize.y, (ImS64)map_height);
+            
+            if (scroll_y != previous_scroll_y)
+                m_CameraY = (float64)scroll_y / (float64)m_Scale;
             
             ImGui::EndChild();
         }
         else
         {
+            m_VisibleCellCount = 0;
+            
             const Texture2D& checkerboard = m_Context->GetCheckerboard();
             
             ImVec2 image_size;
@@ -392,6 +1261,9 @@ namespace SBMap
         
         ImGui::BeginChild("MapViewport-Properties");
         
+        ShowRecoveryUI();
+        ShowJobStatusUI();
+        
         if (ImGui::BeginCombo("Layer", GetMapLayerPreview(m_SelectedLayer)))
         {
             SelectableMapLayer(MapLayer::Tiles, m_SelectedLayer);
@@ -402,9 +1274,19 @@ namespace SBMap
             ImGui::EndCombo();
         }
         
+        if (ImGui::RadioButton("Brush", m_SelectedTool == MapTool::Brush))
+            m_SelectedTool = MapTool::Brush;
+        
+        ImGui::SameLine();
+        
+        if (ImGui::RadioButton("Fill", m_SelectedTool == MapTool::Fill))
+            m_SelectedTool = MapTool::Fill;
+        
         ImGui::Spacing();
         
-        ImGui::SliderFloat("Scale", &m_Scale, 0.25f, 4.0f);
+        float32 minimum_scale = GetMinimumScale();
+        m_Scale = SDL_clamp(m_Scale, minimum_scale, MAP_MAXIMUM_SCALE);
+        ImGui::SliderFloat("Scale", &m_Scale, minimum_scale, MAP_MAXIMUM_SCALE, "%.4f", ImGuiSliderFlags_Logarithmic | ImGuiSliderFlags_AlwaysClamp);
         ImGui::InputInt("Width", &m_InputWidth);
         ImGui::InputInt("Height", &m_InputHeight);
         
@@ -421,7 +1303,176 @@ namespace SBMap
         ImGui::Checkbox("Show Grid", &m_ShowGrid);
         ImGui::SameLine();
         ImGui::Checkbox("Show Marker", &m_ShowMarker);
+        ImGui::SameLine();
+        ImGui::Checkbox("Show All Flags", &m_ShowAllFlags);
+        
+        ImGui::Spacing();
+        
+        const char* autosave_format = m_AutosaveInterval > 0 ? "%d s" : "Off";
+        ImGui::SliderInt("Autosave", &m_AutosaveInterval, 0, MAP_AUTOSAVE_MAXIMUM_INTERVAL, autosave_format, ImGuiSliderFlags_AlwaysClamp);
+        
+        int32 history_limit = (int32)(m_EditHistory.GetMemoryLimit() / (1024 * 1024));
+        if (ImGui::SliderInt("Undo Memory", &history_limit, 1, MAP_EDIT_HISTORY_MAXIMUM_LIMIT, "%d MB", ImGuiSliderFlags_AlwaysClamp))
+            m_EditHistory.SetMemoryLimit((size_t)history_limit * 1024 * 1024);
+        
+        ImGui::Text("Undo Memory Used: %.2f MB", (float64)m_EditHistory.GetMemoryUsage() / (1024.0 * 1024.0));
+        
+        if (m_SelectedLayer != MapLayer::Tiles && IsTilemapValid(m_Tilemap))
+        {
+            ImGui::Spacing();
+            ShowLayerOperationsUI();
+        }
         
         ImGui::EndChild();
     }
+    
+    void MapViewport::ShowLayerOperationsUI()
+    {
+        const TilePalette& tile_palette = m_Context->GetTilePalette();
+        uint32 tile_flag = GetMapLayerTileFlag(m_SelectedLayer);
+        
+        CellRange map_range;
+        map_range.end_x = m_Tilemap.width;
+        map_range.end_y = m_Tilemap.height;
+        
+        // Single cell edits keep the counts up to date, anything larger recounts
+        if (!m_FlagCountsValid)
+        {
+            for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                m_FlagCounts[plane] = CountFlagLayer(m_Tilemap, 1u << plane, map_range);
+            
+            m_FlagCountsValid = true;
+        }
+        
+        ImGui::Text("Flagged Cells: %lld", (long long)m_FlagCounts[GetTileFlagPlane(tile_flag)]);
+        
+        // Operations touch the whole map, so the next save rewrites it
+        auto apply_operation = [this](auto operation)
+        {
+            EndEditCommand();
+            
+            Tilemap previous = CopyTilemapCells(m_Tilemap);
+            m_EditHistory.BeginCommand(m_Tilemap);
+            
+            operation();
+            
+            m_EditHistory.RecordChunks(previous, m_Tilemap);
+            m_EditHistory.EndCommand(m_Tilemap);
+            
+            m_FlagOverlay.InvalidateAll();
+            m_JournalRewrite = true;
+            m_FlagCountsValid = false;
+            m_EditCount++;
+        };
+        
+        int64 map_chunk_count = (int64)GetChunkCount(m_Tilemap.width, TILEMAP_CHUNK_WIDTH) * (int64)GetChunkCount(m_Tilemap.height, TILEMAP_CHUNK_HEIGHT);
+        bool fill_allowed = map_chunk_count - (int64)m_Tilemap.chunks.size() <= MAP_LAYER_FILL_CHUNK_LIMIT;
+        
+        ImGui::BeginDisabled(!fill_allowed);
+        
+        if (ImGui::Button("Fill##Layer"))
+        {
+            apply_operation([&]() { FillFlagLayer(m_Tilemap, tile_flag, map_range); });
+        }
+        
+        ImGui::EndDisabled();
+        ImGui::SameLine();
+        
+        if (ImGui::Button("Clear##Layer"))
+        {
+            apply_operation([&]() { ClearFlagLayer(m_Tilemap, tile_flag, map_range); });
+        }
+        
+        ImGui::SameLine();
+        ImGui::BeginDisabled(!fill_allowed);
+        
+        if (ImGui::Button("Invert##Layer"))
+        {
+            apply_operation([&]() { InvertFlagLayer(m_Tilemap, tile_flag, map_range); });
+        }
+        
+        ImGui::EndDisabled();
+        ImGui::SameLine();
+        
+        if (ImGui::Button("Fill Selected Tile##Layer"))
+        {
+            apply_operation([&]() { FillFlagLayerWhereTile(m_Tilemap, tile_flag, tile_palette.GetSelectedTileX(), tile_palette.GetSelectedTileY(), map_range); });
+        }
+        
+        if (!fill_allowed)
+            ImGui::TextDisabled("The map is too large to fill or invert a whole layer.");
+        
+        if (ImGui::BeginCombo("Operand", GetMapLayerPreview(m_OperandLayer)))
+        {
+            SelectableMapLayer(MapLayer::Walls, m_OperandLayer);
+            SelectableMapLayer(MapLayer::LeftGoals, m_OperandLayer);
+            SelectableMapLayer(MapLayer::RightGoals, m_OperandLayer);
+            
+            ImGui::EndCombo();
+        }
+        
+        uint32 operand_tile_flag = GetMapLayerTileFlag(m_OperandLayer);
+        
+        if (ImGui::Button("AND##Layer"))
+        {
+            apply_operation([&]() { CombineFlagLayers(m_Tilemap, tile_flag, operand_tile_flag, FlagLayerOperation::And, map_range); });
+        }
+        
+        ImGui::SameLine();
+        
+        if (ImGui::Button("OR##Layer"))
+        {
+            apply_operation([&]() { CombineFlagLayers(m_Tilemap, tile_flag, operand_tile_flag, FlagLayerOperation::Or, map_range); });
+        }
+        
+        ImGui::SameLine();
+        
+        if (ImGui::Button("XOR##Layer"))
+        {
+            apply_operation([&]() { CombineFlagLayers(m_Tilemap, tile_flag, operand_tile_flag, FlagLayerOperation::Xor, map_range); });
+        }
+    }
+    
+    void MapViewport::ShowJobStatusUI()
+    {
+        if (m_LoadJob.IsRunning())
+            ImGui::ProgressBar(m_LoadJob.GetProgress(), ImVec2(-FLT_MIN, 0.0f), "Loading...");
+        
+        if (m_SaveJob.IsRunning())
+            ImGui::ProgressBar(m_SaveJob.GetProgress(), ImVec2(-FLT_MIN, 0.0f), m_QuitRequested ? "Saving before quitting..." : "Saving...");
+        
+        if (m_AutosaveJob.IsRunning())
+            ImGui::ProgressBar(m_AutosaveJob.GetProgress(), ImVec2(-FLT_MIN, 0.0f), "Autosaving...");
+        
+        if (!m_AutosaveError.empty())
+            ImGui::TextWrapped("Autosave failed: %s", m_AutosaveError.c_str());
+    }
+    
+    // Recovering needs the tileset the map was made with
+    void MapViewport::ShowRecoveryUI()
+    {
+        if (!m_OfferRecovery)
+            return;
+        
+        ImGui::TextWrapped("A previous session left autosaved edits that were never saved to a file. Autosave is paused until it is recovered or discarded.");
+        
+        bool tileset_valid = IsTilesetValid(m_Context->GetTilePalette().GetTileset());
+        if (!tileset_valid)
+            ImGui::TextDisabled("Open the atlas the tilemap was made with to recover it.");
+        
+        ImGui::BeginDisabled(!tileset_valid || m_LoadJob.IsRunning());
+        if (ImGui::Button("Recover##Autosave"))
+            LoadTilemapFile(m_AutosaveFilepath.c_str(), true);
+        ImGui::EndDisabled();
+        
+        ImGui::SameLine();
+        
+        if (ImGui::Button("Discard##Autosave"))
+        {
+            SDL_RemovePath(m_AutosaveFilepath.c_str());
+            m_OfferRecovery = false;
+        }
+        
+        ImGui::Separator();
+    }
 }
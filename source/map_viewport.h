@@ -1,10 +1,40 @@
 #pragma once
 
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <imgui.h>
+
+#include "chunk_cache.h"
 #include "core.h"
+#include "edit_history.h"
+#include "error.h"
+#include "flag_overlay.h"
+#include "job.h"
+#include "tile_batch.h"
 #include "tilemap.h"
 
 namespace SBMap
 {
+    constexpr float32 MAP_MINIMUM_SCALE = 1.0f / 64.0f;
+    constexpr float32 MAP_MAXIMUM_SCALE = 4.0f;
+    constexpr int64 MAP_JOURNAL_MINIMUM_LIMIT = 64 * 1024;
+    constexpr int64 MAP_JOURNAL_FILL_CHUNK_LIMIT = 1024;
+    
+    // Autosave intervals are in seconds, zero turns autosave off
+    constexpr int32 MAP_AUTOSAVE_DEFAULT_INTERVAL = 60;
+    constexpr int32 MAP_AUTOSAVE_MAXIMUM_INTERVAL = 3600;
+    constexpr const char* MAP_AUTOSAVE_FILENAME = "autosave.sbm";
+    
+    // Undo memory is set in megabytes
+    constexpr int32 MAP_EDIT_HISTORY_MAXIMUM_LIMIT = 1024;
+    constexpr size_t MAP_EDIT_INVALIDATE_LIMIT = 4096;
+    
+    // Filling or inverting a layer allocates every missing chunk, about 4.5 KB each
+    constexpr int64 MAP_LAYER_FILL_CHUNK_LIMIT = 65536;
+    
     enum class MapLayer
     {
         Tiles,
@@ -13,6 +43,12 @@ namespace SBMap
         RightGoals,
     };
     
+    enum class MapTool
+    {
+        Brush,
+        Fill,
+    };
+    
     class AppContext;
     
     class MapViewport
@@ -21,32 +57,151 @@ namespace SBMap
         static MapViewport Create(AppContext& context);
         
         void ShowUI();
+        void Shutdown();
+        
+        void RequestQuit();
+        bool IsReadyToQuit() const;
         
         void OpenTilemap();
         void OpenTilemapFile(const char* filepath);
         void SaveTilemap();
-        void SaveTilemapFile(const char* filepath);
+        void SaveTilemapAs();
+        void SaveTilemapFile(const char* filepath, TilemapFileVersion version = TilemapFileVersion::V2);
+        
+        void Undo();
+        void Redo();
+        
+        void AddStrokeSample(float32 x, float32 y);
+        
+        void InvalidateRenderCache();
+        
+        bool CanUndo() const { return m_EditHistory.CanUndo(); }
+        bool CanRedo() const { return m_EditHistory.CanRedo(); }
+        
+        int32 GetVisibleCellCount() const { return m_VisibleCellCount; }
         
     private:
-        void RenderTilemap();
-        void RenderTilemapOverlay();
-        void RenderTileGrid();
-        void RenderTileMarker();
+        // Errors are copied out of the job, since SDL keeps its error message per thread
+        struct TilemapLoad
+        {
+            Tilemap tilemap;
+            std::string filepath;
+            int32 tileset_width = 0;
+            int32 tileset_height = 0;
+            TilemapFileVersion version = TilemapFileVersion::V2;
+            std::string error_message;
+            std::string error_details;
+            bool recovery = false;
+            bool loaded = false;
+        };
+        
+        struct TilemapSave
+        {
+            std::string filepath;
+            TilemapFileVersion version = TilemapFileVersion::V2;
+            int64 file_size = 0;
+            uint64 edit_count = 0;
+            std::string error_message;
+            std::string error_details;
+            bool saved = false;
+        };
+        
+        struct TileBatchKey
+        {
+            CellRange range = {};
+            float32 origin_x = 0.0f;
+            float32 origin_y = 0.0f;
+            float32 scale = 0.0f;
+            uint64 revision = 0;
+        };
+        
+        static bool IsSameTileBatchKey(const TileBatchKey& key1, const TileBatchKey& key2);
         
+        void LoadTilemapFile(const char* filepath, bool recovery);
+        void UpdateTilemapJobs();
+        bool AppendTilemapJournal(const char* filepath);
+        void UpdateAutosave();
+        
+        CellRange GetVisibleCellRange() const;
+        float32 GetMinimumScale() const;
+        ImVec2 GetCellScreenPosition(int32 cell_x, int32 cell_y) const;
+        void GetScreenCell(const ImVec2& position, int32& cell_x, int32& cell_y) const;
+        void UpdateCamera(bool hovered);
+        
+        void RenderTilemap(const CellRange& range);
+        void RenderTilemapOverlay(const CellRange& range);
+        void RenderFlagMask(const CellRange& range, int32 level, MapLayer layer, uint32 color);
+        void RenderTileGrid(const CellRange& range);
+        void RenderTileMarker(bool hovered);
+        
+        void PaintStroke(bool hovered);
+        void PaintStrokeLine(int32 begin_x, int32 begin_y, int32 end_x, int32 end_y, bool erase);
+        void PaintStrokeCell(int32 cell_x, int32 cell_y, bool erase);
+        void FillRegion(bool hovered);
+        
+        void SetTilemapCell(int32 cell_x, int32 cell_y, const Tilemap::Cell& value);
         void SetTilemapSize();
+        void ApplyTilemapSize(int32 width, int32 height);
         void ResetTilemapSize();
         
+        void EndEditCommand();
+        void ApplyEditCommand(const EditCommand& command);
+        
         void ShowMapSectionUI();
         void ShowPropertiesSectionUI();
+        void ShowLayerOperationsUI();
+        void ShowJobStatusUI();
+        void ShowRecoveryUI();
         
     private:
         AppContext* m_Context = nullptr;
         Tilemap m_Tilemap = {};
+        Job m_LoadJob;
+        std::shared_ptr<TilemapLoad> m_TilemapLoad;
+        Job m_SaveJob;
+        std::shared_ptr<TilemapSave> m_TilemapSave;
+        std::string m_TilemapFilepath;
+        TilemapFileVersion m_TilemapVersion = TilemapFileVersion::V2;
+        std::unordered_set<uint32> m_JournalChunks;
+        int64 m_JournalLimit = 0;
+        bool m_JournalRewrite = false;
+        Job m_AutosaveJob;
+        std::shared_ptr<TilemapSave> m_TilemapAutosave;
+        std::string m_AutosaveFilepath;
+        std::string m_AutosaveError;
+        uint64 m_AutosaveTime = 0;
+        int32 m_AutosaveInterval = MAP_AUTOSAVE_DEFAULT_INTERVAL;
+        uint64 m_EditCount = 0;
+        uint64 m_SavedEditCount = 0;
+        uint64 m_AutosavedEditCount = 0;
+        bool m_OfferRecovery = false;
+        bool m_QuitRequested = false;
+        int64 m_FlagCounts[TILEMAP_FLAG_PLANE_COUNT] = {};
+        bool m_FlagCountsValid = false;
+        EditHistory m_EditHistory;
+        std::vector<ImVec2> m_StrokeSamples;
+        std::unordered_set<uint64> m_StrokeCells;
+        int32 m_StrokeCellX = 0;
+        int32 m_StrokeCellY = 0;
+        ChunkCache m_ChunkCache = {};
+        FlagOverlay m_FlagOverlay = {};
+        TileBatch m_TilemapBatch = {};
+        TileBatchKey m_TilemapBatchKey = {};
+        TileBatch m_GridBatch = {};
+        TileBatchKey m_GridBatchKey = {};
+        MapTool m_SelectedTool = MapTool::Brush;
         MapLayer m_SelectedLayer = MapLayer::Tiles;
+        MapLayer m_OperandLayer = MapLayer::Walls;
+        float64 m_CameraX = 0.0;
+        float64 m_CameraY = 0.0;
+        ImVec2 m_ViewOrigin = {};
+        ImVec2 m_ViewSize = {};
         float32 m_Scale = 0.0f;
         bool m_ShowGrid = false;
         bool m_ShowMarker = false;
+        bool m_ShowAllFlags = false;
         int32 m_InputWidth = 0;
         int32 m_InputHeight = 0;
+        int32 m_VisibleCellCount = 0;
     };
 }
@@ -0,0 +1,171 @@
+#include <SDL3/SDL.h>
+
+#if defined(SDL_PLATFORM_UNIX) || defined(SDL_PLATFORM_APPLE)
+    #include <fcntl.h>
+    #include <stdio.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+    #define SBMAP_MAPPED_FILE_POSIX
+#elif defined(SDL_PLATFORM_WINDOWS)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+
+    #define SBMAP_MAPPED_FILE_WINDOWS
+#endif
+
+#include "core.h"
+#include "error.h"
+#include "mapped_file.h"
+
+namespace SBMap
+{
+    static void ReleaseMappedFile(MappedFile& file)
+    {
+        if (!file.data)
+            return;
+    
+    #ifdef SBMAP_MAPPED_FILE_POSIX
+        if (file.mapped)
+        {
+            munmap((void*)file.data, file.size);
+            return;
+        }
+    #endif
+        
+        SDL_free((void*)file.data);
+    }
+    
+    MappedFile::MappedFile(MappedFile&& other)
+    {
+        data = other.data;
+        size = other.size;
+        mapped = other.mapped;
+        
+        other.data = nullptr;
+        other.size = 0;
+        other.mapped = false;
+    }
+    
+    MappedFile::~MappedFile()
+    {
+        ReleaseMappedFile(*this);
+    }
+    
+    MappedFile& MappedFile::operator=(MappedFile&& other)
+    {
+        if (this != &other)
+        {
+            ReleaseMappedFile(*this);
+            
+            data = other.data;
+            size = other.size;
+            mapped = other.mapped;
+            
+            other.data = nullptr;
+            other.size = 0;
+            other.mapped = false;
+        }
+        
+        return *this;
+    }
+    
+    #ifdef SBMAP_MAPPED_FILE_POSIX
+    // Empty files cannot be mapped and are returned without data
+    static Result<MappedFile> MapPOSIXFile(const char* filepath)
+    {
+        int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return Error{ "Could not open file." };
+        
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0)
+        {
+            close(fd);
+            return Error{ "Could not read file size." };
+        }
+        
+        MappedFile file;
+        file.size = (size_t)file_stat.st_size;
+        
+        if (file.size == 0)
+        {
+            close(fd);
+            return file;
+        }
+        
+        void* address = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        
+        if (address == MAP_FAILED)
+            return Error{ "Could not map file." };
+        
+        // Files are read front to back once, so read ahead aggressively
+        posix_madvise(address, file.size, POSIX_MADV_SEQUENTIAL);
+        
+        file.data = (const char*)address;
+        file.mapped = true;
+        
+        return file;
+    }
+    #endif
+    
+    Result<MappedFile> MapFile(const char* filepath)
+    {
+        SDL_assert(filepath != nullptr);
+    
+    #ifdef SBMAP_MAPPED_FILE_POSIX
+        return MapPOSIXFile(filepath);
+    #else
+        MappedFile file;
+        file.data = (const char*)SDL_LoadFile(filepath, &file.size);
+        if (!file.data)
+            return Error{ "Could not load file.", SDL_GetError() };
+        
+        return file;
+    #endif
+    }
+    
+    bool SyncFileStream(SDL_IOStream* stream)
+    {
+        SDL_assert(stream != nullptr);
+        
+        if (!SDL_FlushIO(stream))
+            return false;
+        
+        SDL_PropertiesID properties = SDL_GetIOProperties(stream);
+    
+    #if defined(SBMAP_MAPPED_FILE_POSIX)
+        int fd = -1;
+        
+        FILE* file = (FILE*)SDL_GetPointerProperty(properties, SDL_PROP_IOSTREAM_STDIO_FILE_POINTER, nullptr);
+        if (file)
+            fd = fileno(file);
+        
+        // Newer SDL versions back file streams with a descriptor instead
+    #ifdef SDL_PROP_IOSTREAM_FILE_DESCRIPTOR_NUMBER
+        if (fd < 0)
+            fd = (int)SDL_GetNumberProperty(properties, SDL_PROP_IOSTREAM_FILE_DESCRIPTOR_NUMBER, -1);
+    #endif
+        
+        if (fd < 0)
+            return SDL_SetError("Stream is not backed by a file.");
+        if (fsync(fd) != 0)
+            return SDL_SetError("Could not flush file to disk.");
+        
+        return true;
+    #elif defined(SBMAP_MAPPED_FILE_WINDOWS)
+        HANDLE handle = (HANDLE)SDL_GetPointerProperty(properties, SDL_PROP_IOSTREAM_WINDOWS_HANDLE_POINTER, nullptr);
+        if (!handle)
+            return SDL_SetError("Stream is not backed by a file.");
+        if (!FlushFileBuffers(handle))
+            return SDL_SetError("Could not flush file to disk.");
+        
+        return true;
+    #else
+        (void)properties;
+        return true;
+    #endif
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "error.h"
+
+namespace SBMap
+{
+    // Falls back to loading the file into a buffer where mapping is not supported
+    struct MappedFile
+    {
+        const char* data = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+        
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other);
+        ~MappedFile();
+        
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile& operator=(MappedFile&& other);
+    };
+    
+    Result<MappedFile> MapFile(const char* filepath);
+    
+    // Flushes the stream and has the system write the file out to disk, so a
+    // rename that follows cannot land before the data does
+    bool SyncFileStream(SDL_IOStream* stream);
+}
@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <string>
+
+#include <imgui.h>
+#include <SDL3/SDL.h>
+
+#include "app.h"
+#include "core.h"
+#include "error_popup.h"
+#include "error.h"
+#include "performance_window.h"
+
+namespace SBMap
+{
+    static const char* s_FramePhaseNames[FRAME_PHASE_COUNT] = {
+        "ProcessEvents",
+        "TilePalette::ShowUI",
+        "MapViewport::ShowUI",
+        "ImGui::Render",
+        "RenderDrawData",
+        "SDL_RenderPresent",
+    };
+    
+    struct ReportFileRequest
+    {
+        PerformanceWindow* performance_window = nullptr;
+        std::string filepath;
+    };
+    
+    static void SDLCALL RunReportFileRequest(void* userdata)
+    {
+        ReportFileRequest* request = (ReportFileRequest*)userdata;
+        request->performance_window->SaveReportFile(request->filepath.c_str());
+        
+        delete request;
+    }
+    
+    // Dialog callbacks may run on another thread
+    static void SaveFileDialogCallback(void* userdata, const char* const* filelist, int filter)
+    {
+        (void)filter;
+        
+        if (!filelist || !(*filelist))
+            return;
+        
+        ReportFileRequest* request = new ReportFileRequest{ (PerformanceWindow*)userdata, *filelist };
+        if (!SDL_RunOnMainThread(RunReportFileRequest, request, false))
+            delete request;
+    }
+    
+    static float32 GetElapsedMilliseconds(uint64 begin, uint64 end)
+    {
+        return (float32)((double)(end - begin) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+    }
+    
+    PerformanceWindow PerformanceWindow::Create(AppContext& context)
+    {
+        PerformanceWindow instance;
+        instance.m_Context = &context;
+        instance.m_History.resize(PERFORMANCE_HISTORY_SIZE);
+        instance.m_Scratch.reserve(PERFORMANCE_HISTORY_SIZE);
+        
+        return instance;
+    }
+    
+    void PerformanceWindow::ShowUI()
+    {
+        if (!m_Open)
+            return;
+        
+        if (ImGui::Begin("Performance", &m_Open))
+        {
+            ShowTimingsSectionUI();
+            ShowDrawSectionUI();
+        }
+        
+        ImGui::End();
+    }
+    
+    void PerformanceWindow::BeginFrame()
+    {
+        m_Current = {};
+        m_FrameBegin = SDL_GetPerformanceCounter();
+    }
+    
+    void PerformanceWindow::EndFrame(const ImDrawData* draw_data, int32 visible_cell_count)
+    {
+        m_Current.frame_time = GetElapsedMilliseconds(m_FrameBegin, SDL_GetPerformanceCounter());
+        m_Current.visible_cell_count = visible_cell_count;
+        
+        if (draw_data)
+        {
+            m_Current.vertex_count = draw_data->TotalVtxCount;
+            m_Current.index_count = draw_data->TotalIdxCount;
+            
+            for (const ImDrawList* draw_list : draw_data->CmdLists)
+                m_Current.command_count += draw_list->CmdBuffer.Size;
+        }
+        
+        if (m_Paused)
+            return;
+        
+        m_History[(size_t)m_HistoryOffset] = m_Current;
+        m_HistoryOffset = (m_HistoryOffset + 1) % PERFORMANCE_HISTORY_SIZE;
+        m_HistoryCount = SDL_min(m_HistoryCount + 1, PERFORMANCE_HISTORY_SIZE);
+    }
+    
+    void PerformanceWindow::BeginPhase(FramePhase phase)
+    {
+        m_PhaseBegin[(int32)phase] = SDL_GetPerformanceCounter();
+    }
+    
+    void PerformanceWindow::EndPhase(FramePhase phase)
+    {
+        uint64 phase_end = SDL_GetPerformanceCounter();
+        m_Current.phase_times[(int32)phase] += GetElapsedMilliseconds(m_PhaseBegin[(int32)phase], phase_end);
+    }
+    
+    void PerformanceWindow::SaveReport()
+    {
+        static SDL_DialogFileFilter filters[] = {
+            { "CSV files", "csv" },
+            { "All files", "*" },
+        };
+        
+        SDL_ShowSaveFileDialog(SaveFileDialogCallback,
+            this, m_Context->GetWindow(), filters, SDL_arraysize(filters), nullptr);
+    }
+    
+    void PerformanceWindow::SaveReportFile(const char* filepath)
+    {
+        SDL_assert(filepath != nullptr);
+        
+        std::string buffer = "frame";
+        for (const char* phase_name : s_FramePhaseNames)
+        {
+            buffer += ",";
+            buffer += phase_name;
+            buffer += " (ms)";
+        }
+        
+        buffer += ",Frame (ms),Vertices,Indices,Commands,Visible Cells\n";
+        
+        char line[64];
+        for (int32 i = 0; i < m_HistoryCount; i++)
+        {
+            const FrameSample& sample = GetSample(i);
+            
+            SDL_snprintf(line, sizeof(line), "%d", i);
+            buffer += line;
+            
+            for (float32 phase_time : sample.phase_times)
+            {
+                SDL_snprintf(line, sizeof(line), ",%.4f", (double)phase_time);
+                buffer += line;
+            }
+            
+            SDL_snprintf(line, sizeof(line), ",%.4f,%d,%d,%d,%d\n", (double)sample.frame_time,
+                sample.vertex_count, sample.index_count, sample.command_count, sample.visible_cell_count);
+            buffer += line;
+        }
+        
+        if (!SDL_SaveFile(filepath, buffer.data(), buffer.size()))
+            OpenErrorPopup("Failed to Save Report", Error{ "Could not write to file.", SDL_GetError() });
+    }
+    
+    const PerformanceWindow::FrameSample& PerformanceWindow::GetSample(int32 index) const
+    {
+        SDL_assert(index >= 0 && index < m_HistoryCount);
+        int32 begin = (m_HistoryOffset - m_HistoryCount + PERFORMANCE_HISTORY_SIZE) % PERFORMANCE_HISTORY_SIZE;
+        return m_History[(size_t)((begin + index) % PERFORMANCE_HISTORY_SIZE)];
+    }
+    
+    // A negative phase selects the whole frame time
+    PerformanceWindow::Statistics PerformanceWindow::GetPhaseStatistics(int32 phase)
+    {
+        Statistics statistics;
+        if (m_HistoryCount == 0)
+            return statistics;
+        
+        m_Scratch.clear();
+        for (int32 i = 0; i < m_HistoryCount; i++)
+        {
+            const FrameSample& sample = GetSample(i);
+            m_Scratch.push_back(phase < 0 ? sample.frame_time : sample.phase_times[phase]);
+        }
+        
+        std::sort(m_Scratch.begin(), m_Scratch.end());
+        
+        float32 sum = 0.0f;
+        for (float32 value : m_Scratch)
+            sum += value;
+        
+        size_t p99_index = (m_Scratch.size() * 99) / 100;
+        
+        statistics.minimum = m_Scratch.front();
+        statistics.average = sum / (float32)m_Scratch.size();
+        statistics.p99 = m_Scratch[SDL_min(p99_index, m_Scratch.size() - 1)];
+        
+        return statistics;
+    }
+    
+    void PerformanceWindow::ShowTimingsSectionUI()
+    {
+        ImGui::SeparatorText("Timings");
+        
+        float32 frame_times[PERFORMANCE_HISTORY_SIZE];
+        for (int32 i = 0; i < m_HistoryCount; i++)
+            frame_times[i] = GetSample(i).frame_time;
+        
+        Statistics frame_statistics = GetPhaseStatistics(-1);
+        
+        char overlay[64];
+        SDL_snprintf(overlay, sizeof(overlay), "avg %.2f ms, p99 %.2f ms",
+            (double)frame_statistics.average, (double)frame_statistics.p99);
+        
+        float32 plot_maximum = SDL_max(frame_statistics.p99 * 1.5f, 1.0f);
+        ImGui::PlotLines("##FrameTimes", frame_times, m_HistoryCount, 0, overlay,
+            0.0f, plot_maximum, ImVec2(ImGui::GetContentRegionAvail().x, 80.0f));
+        
+        ImGuiTableFlags table_flags =
+            ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp;
+        
+        if (ImGui::BeginTable("Performance-Timings", 5, table_flags))
+        {
+            ImGui::TableSetupColumn("Phase");
+            ImGui::TableSetupColumn("Last (ms)");
+            ImGui::TableSetupColumn("Min (ms)");
+            ImGui::TableSetupColumn("Avg (ms)");
+            ImGui::TableSetupColumn("P99 (ms)");
+            ImGui::TableHeadersRow();
+            
+            const FrameSample* last_sample = m_HistoryCount > 0 ? &GetSample(m_HistoryCount - 1) : nullptr;
+            
+            for (int32 phase = -1; phase < FRAME_PHASE_COUNT; phase++)
+            {
+                Statistics statistics = GetPhaseStatistics(phase);
+                
+                float32 last_time = 0.0f;
+                if (last_sample)
+                    last_time = phase < 0 ? last_sample->frame_time : last_sample->phase_times[phase];
+                
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(phase < 0 ? "Frame" : s_FramePhaseNames[phase]);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", (double)last_time);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", (double)statistics.minimum);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", (double)statistics.average);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f", (double)statistics.p99);
+            }
+            
+            ImGui::EndTable();
+        }
+        
+        ImGui::Checkbox("Pause", &m_Paused);
+        ImGui::SameLine();
+        
+        if (ImGui::Button("Clear"))
+            m_HistoryCount = 0;
+        
+        ImGui::SameLine();
+        
+        if (ImGui::Button("Save CSV..."))
+            SaveReport();
+    }
+    
+    void PerformanceWindow::ShowDrawSectionUI()
+    {
+        ImGui::SeparatorText("Draw");
+        
+        if (m_HistoryCount == 0)
+            return;
+        
+        const FrameSample& sample = GetSample(m_HistoryCount - 1);
+        ImGui::Text("Visible Cells: %d", sample.visible_cell_count);
+        ImGui::Text("Vertices: %d", sample.vertex_count);
+        ImGui::Text("Indices: %d", sample.index_count);
+        ImGui::Text("Draw Commands: %d", sample.command_count);
+    }
+}
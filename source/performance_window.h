@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+
+#include <imgui.h>
+
+#include "core.h"
+#include "error.h"
+
+namespace SBMap
+{
+    enum class FramePhase
+    {
+        ProcessEvents,
+        TilePalette,
+        MapViewport,
+        ImGuiRender,
+        RenderDrawData,
+        RenderPresent,
+        Count,
+    };
+    
+    constexpr int32 FRAME_PHASE_COUNT = (int32)FramePhase::Count;
+    constexpr int32 PERFORMANCE_HISTORY_SIZE = 300;
+    
+    class AppContext;
+    
+    class PerformanceWindow
+    {
+    public:
+        static PerformanceWindow Create(AppContext& context);
+        
+        void ShowUI();
+        
+        void BeginFrame();
+        void EndFrame(const ImDrawData* draw_data, int32 visible_cell_count);
+        void BeginPhase(FramePhase phase);
+        void EndPhase(FramePhase phase);
+        
+        void SaveReport();
+        void SaveReportFile(const char* filepath);
+        
+        bool IsOpen() const { return m_Open; }
+        void SetOpen(bool open) { m_Open = open; }
+        
+    private:
+        struct FrameSample
+        {
+            float32 phase_times[FRAME_PHASE_COUNT] = {};
+            float32 frame_time = 0.0f;
+            int32 vertex_count = 0;
+            int32 index_count = 0;
+            int32 command_count = 0;
+            int32 visible_cell_count = 0;
+        };
+        
+        struct Statistics
+        {
+            float32 minimum = 0.0f;
+            float32 average = 0.0f;
+            float32 p99 = 0.0f;
+        };
+        
+        const FrameSample& GetSample(int32 index) const;
+        Statistics GetPhaseStatistics(int32 phase);
+        
+        void ShowTimingsSectionUI();
+        void ShowDrawSectionUI();
+        
+    private:
+        AppContext* m_Context = nullptr;
+        std::vector<FrameSample> m_History;
+        std::vector<float32> m_Scratch;
+        FrameSample m_Current = {};
+        uint64 m_FrameBegin = 0;
+        uint64 m_PhaseBegin[FRAME_PHASE_COUNT] = {};
+        int32 m_HistoryOffset = 0;
+        int32 m_HistoryCount = 0;
+        bool m_Open = false;
+        bool m_Paused = false;
+    };
+}
@@ -0,0 +1,102 @@
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "run_length.h"
+
+namespace SBMap
+{
+    constexpr uint8 RUN_LENGTH_REPEAT_BIT = 0x80;
+    
+    static size_t GetRepeatCount(const uint32* values, size_t count, size_t begin)
+    {
+        size_t repeat_count = 1;
+        while (begin + repeat_count < count && repeat_count < RUN_LENGTH_MAXIMUM_RUN && values[begin + repeat_count] == values[begin])
+            repeat_count++;
+        
+        return repeat_count;
+    }
+    
+    size_t EncodeRunLength(const uint32* values, size_t count, uint8* output)
+    {
+        SDL_assert(values != nullptr || count == 0);
+        SDL_assert(output != nullptr);
+        
+        size_t size = 0;
+        size_t i = 0;
+        
+        while (i < count)
+        {
+            size_t repeat_count = GetRepeatCount(values, count, i);
+            if (repeat_count > 1)
+            {
+                output[size++] = (uint8)(RUN_LENGTH_REPEAT_BIT | (repeat_count - 1));
+                SDL_memcpy(output + size, values + i, sizeof(uint32));
+                size += sizeof(uint32);
+                i += repeat_count;
+                continue;
+            }
+            
+            // Literals run until the next repeat starts
+            size_t literal_begin = i;
+            size_t literal_count = 0;
+            
+            while (i < count && literal_count < RUN_LENGTH_MAXIMUM_RUN && GetRepeatCount(values, count, i) == 1)
+            {
+                i++;
+                literal_count++;
+            }
+            
+            output[size++] = (uint8)(literal_count - 1);
+            SDL_memcpy(output + size, values + literal_begin, literal_count * sizeof(uint32));
+            size += literal_count * sizeof(uint32);
+        }
+        
+        return size;
+    }
+    
+    // Fails unless the data decodes to exactly count values
+    bool DecodeRunLength(const uint8* data, size_t size, uint32* values, size_t count)
+    {
+        SDL_assert(data != nullptr || size == 0);
+        SDL_assert(values != nullptr || count == 0);
+        
+        size_t position = 0;
+        size_t i = 0;
+        
+        while (i < count)
+        {
+            if (position >= size)
+                return false;
+            
+            uint8 control = data[position++];
+            size_t run_count = (size_t)(control & ~RUN_LENGTH_REPEAT_BIT) + 1;
+            if (run_count > count - i)
+                return false;
+            
+            if (control & RUN_LENGTH_REPEAT_BIT)
+            {
+                if (size - position < sizeof(uint32))
+                    return false;
+                
+                uint32 value;
+                SDL_memcpy(&value, data + position, sizeof(uint32));
+                position += sizeof(uint32);
+                
+                for (size_t j = 0; j < run_count; j++)
+                    values[i + j] = value;
+            }
+            else
+            {
+                if ((size - position) / sizeof(uint32) < run_count)
+                    return false;
+                
+                SDL_memcpy(values + i, data + position, run_count * sizeof(uint32));
+                position += run_count * sizeof(uint32);
+            }
+            
+            i += run_count;
+        }
+        
+        return position == size;
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "core.h"
+
+namespace SBMap
+{
+    constexpr size_t RUN_LENGTH_MAXIMUM_RUN = 128;
+    
+    // A control byte with the high bit set repeats the next value, otherwise
+    // literal values follow. Its low bits hold the count minus one.
+    size_t EncodeRunLength(const uint32* values, size_t count, uint8* output);
+    bool DecodeRunLength(const uint8* data, size_t size, uint32* values, size_t count);
+    
+    constexpr size_t GetRunLengthMaximumSize(size_t count)
+    {
+        return count * (sizeof(uint32) + 1);
+    }
+}
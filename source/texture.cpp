@@ -96,6 +96,42 @@ namespace SBMap
         return *this;
     }
     
+    Image::Image(Image&& other)
+    {
+        pixels = other.pixels;
+        width = other.width;
+        height = other.height;
+        
+        other.pixels = nullptr;
+        other.width = 0;
+        other.height = 0;
+    }
+    
+    Image::~Image()
+    {
+        if (pixels)
+            stbi_image_free(pixels);
+    }
+    
+    Image& Image::operator=(Image&& other)
+    {
+        if (this != &other)
+        {
+            if (pixels)
+                stbi_image_free(pixels);
+            
+            pixels = other.pixels;
+            width = other.width;
+            height = other.height;
+            
+            other.pixels = nullptr;
+            other.width = 0;
+            other.height = 0;
+        }
+        
+        return *this;
+    }
+    
     Result<Texture2D> CreateTexture(SDL_Surface* surface, SDL_Renderer* renderer)
     {
         SDL_assert(surface != nullptr);
@@ -106,6 +142,10 @@ namespace SBMap
         if (surface->w > TEXTURE_MAXIMUM_WIDTH || surface->h > TEXTURE_MAXIMUM_HEIGHT)
             return Error{ "Image dimensions are greater than the maximum allowed." };
         
+        int32 maximum_texture_size = GetMaximumTextureSize(renderer);
+        if (surface->w > maximum_texture_size || surface->h > maximum_texture_size)
+            return Error{ "Image dimensions are greater than the renderer supports." };
+        
         SDL_Texture* handle = SDL_CreateTextureFromSurface(renderer, surface);
         if (!handle)
             return Error{ "Could not process image.", SDL_GetError() };
@@ -121,11 +161,133 @@ namespace SBMap
         return texture;
     }
     
-    Result<Texture2D> LoadTexture(const char* filepath, SDL_Renderer* renderer)
+    static Result<Texture2D> CreateEmptyTexture(int32 width, int32 height, SDL_TextureAccess access, SDL_Renderer* renderer)
     {
-        SDL_assert(filepath != nullptr);
         SDL_assert(renderer != nullptr);
         
+        if (width < TEXTURE_MINIMUM_WIDTH || height < TEXTURE_MINIMUM_HEIGHT)
+            return Error{ "Texture dimensions are smaller than the minimum allowed." };
+        if (width > TEXTURE_MAXIMUM_WIDTH || height > TEXTURE_MAXIMUM_HEIGHT)
+            return Error{ "Texture dimensions are greater than the maximum allowed." };
+        
+        int32 maximum_texture_size = GetMaximumTextureSize(renderer);
+        if (width > maximum_texture_size || height > maximum_texture_size)
+            return Error{ "Texture dimensions are greater than the renderer supports." };
+        
+        SDL_PixelFormat pixel_format = SDL_PIXELFORMAT_RGBA32;
+        SDL_Texture* handle = SDL_CreateTexture(renderer, pixel_format, access, width, height);
+        if (!handle)
+            return Error{ "Could not create texture.", SDL_GetError() };
+        
+        SDL_SetTextureScaleMode(handle, SDL_SCALEMODE_NEAREST);
+        SDL_SetTextureBlendMode(handle, SDL_BLENDMODE_BLEND);
+        
+        Texture2D texture;
+        texture.handle = handle;
+        texture.count = new size_t(1);
+        texture.width = width;
+        texture.height = height;
+        
+        return texture;
+    }
+    
+    Result<Texture2D> CreateRenderTexture(int32 width, int32 height, SDL_Renderer* renderer)
+    {
+        return CreateEmptyTexture(width, height, SDL_TEXTUREACCESS_TARGET, renderer);
+    }
+    
+    Result<Texture2D> CreateStreamingTexture(int32 width, int32 height, SDL_Renderer* renderer)
+    {
+        return CreateEmptyTexture(width, height, SDL_TEXTUREACCESS_STREAMING, renderer);
+    }
+    
+    static int32 GetPageCount(int32 size, int32 page_size, int32 page_overlap)
+    {
+        if (size <= page_size)
+            return 1;
+        
+        return (size - page_overlap - 1) / (page_size - page_overlap) + 1;
+    }
+    
+    Result<PagedTexture> CreatePagedTexture(SDL_Surface* surface, int32 page_overlap, SDL_Renderer* renderer)
+    {
+        SDL_assert(surface != nullptr);
+        SDL_assert(renderer != nullptr);
+        SDL_assert(page_overlap >= 0);
+        
+        if (surface->w < TEXTURE_MINIMUM_WIDTH || surface->h < TEXTURE_MINIMUM_HEIGHT)
+            return Error{ "Image dimensions are smaller than the minimum allowed." };
+        if (surface->w > PAGED_TEXTURE_MAXIMUM_WIDTH || surface->h > PAGED_TEXTURE_MAXIMUM_HEIGHT)
+            return Error{ "Image dimensions are greater than the maximum allowed." };
+        
+        int32 page_size = SDL_min(GetMaximumTextureSize(renderer), SDL_min(TEXTURE_MAXIMUM_WIDTH, TEXTURE_MAXIMUM_HEIGHT));
+        if (page_size <= page_overlap)
+            return Error{ "Renderer texture size limit is too small." };
+        
+        // Pixels are only copied when the format has to be converted
+        SDL_PixelFormat pixel_format = SDL_PIXELFORMAT_RGBA32;
+        bool convert = surface->format != pixel_format;
+        
+        auto converted_surface = MakeScope(convert ? SDL_ConvertSurface(surface, pixel_format) : nullptr, SDL_DestroySurface);
+        if (convert && !converted_surface)
+            return Error{ "Could not process image.", SDL_GetError() };
+        
+        SDL_Surface* source_surface = convert ? converted_surface.Get() : surface;
+        
+        PagedTexture texture;
+        texture.width = surface->w;
+        texture.height = surface->h;
+        texture.page_columns = GetPageCount(texture.width, page_size, page_overlap);
+        texture.page_rows = GetPageCount(texture.height, page_size, page_overlap);
+        texture.page_stride_x = texture.page_columns > 1 ? page_size - page_overlap : texture.width;
+        texture.page_stride_y = texture.page_rows > 1 ? page_size - page_overlap : texture.height;
+        
+        uint8* pixels = (uint8*)source_surface->pixels;
+        int32 pitch = source_surface->pitch;
+        
+        for (int32 page_y = 0; page_y < texture.page_rows; page_y++)
+        {
+            for (int32 page_x = 0; page_x < texture.page_columns; page_x++)
+            {
+                int32 begin_x = page_x * texture.page_stride_x;
+                int32 begin_y = page_y * texture.page_stride_y;
+                int32 page_width = SDL_min(page_size, texture.width - begin_x);
+                int32 page_height = SDL_min(page_size, texture.height - begin_y);
+                
+                uint8* page_pixels = pixels + (size_t)begin_y * (size_t)pitch + (size_t)begin_x * 4;
+                auto page_surface = MakeScope(SDL_CreateSurfaceFrom(page_width, page_height, pixel_format, page_pixels, pitch), SDL_DestroySurface);
+                if (!page_surface)
+                    return Error{ "Could not process image.", SDL_GetError() };
+                
+                auto result = CreateTexture(page_surface.Get(), renderer);
+                if (!result)
+                    return result.GetError();
+                
+                texture.pages.push_back(std::move(result.GetValue()));
+            }
+        }
+        
+        return texture;
+    }
+    
+    Result<PagedTexture> CreatePagedTexture(const Image& image, int32 page_overlap, SDL_Renderer* renderer)
+    {
+        SDL_assert(image.pixels != nullptr);
+        SDL_assert(renderer != nullptr);
+        
+        SDL_PixelFormat pixel_format = SDL_PIXELFORMAT_RGBA32;
+        auto surface = MakeScope(SDL_CreateSurfaceFrom(image.width, image.height, pixel_format, image.pixels, image.width * 4), SDL_DestroySurface);
+        if (!surface)
+            return Error{ "Could not process image.", SDL_GetError() };
+        
+        return CreatePagedTexture(surface.Get(), page_overlap, renderer);
+    }
+    
+    // The SDL error buffer belongs to the thread that set it, so errors only point at static strings
+    Result<Image> DecodeImage(const char* filepath)
+    {
+        SDL_assert(filepath != nullptr);
+        
         SDL_PathInfo path_info;
         if (!SDL_GetPathInfo(filepath, &path_info))
             return Error{ "Path does not exist." };
@@ -133,17 +295,13 @@ namespace SBMap
         if (path_info.type != SDL_PATHTYPE_FILE)
             return Error{ "Path exists but is not a file." };
         
-        int32 width, height, channels;
-        auto pixels = MakeScope(stbi_load(filepath, &width, &height, &channels, 4), stbi_image_free);
-        if (!pixels)
+        Image image;
+        int32 channels;
+        image.pixels = stbi_load(filepath, &image.width, &image.height, &channels, 4);
+        if (!image.pixels)
             return Error{ "Could not load image.", stbi_failure_reason() };
         
-        SDL_PixelFormat pixel_format = SDL_PIXELFORMAT_RGBA32;
-        auto surface = MakeScope(SDL_CreateSurfaceFrom(width, height, pixel_format, pixels.Get(), width * 4), SDL_DestroySurface);
-        if (!surface)
-            return Error{ "Could not process image.", SDL_GetError() };
-        
-        return CreateTexture(surface.Get(), renderer);
+        return image;
     }
     
     bool IsTextureValid(const Texture2D& texture)
@@ -158,8 +316,51 @@ namespace SBMap
         return true;
     }
     
+    bool IsPagedTextureValid(const PagedTexture& texture)
+    {
+        if (texture.pages.empty())
+            return false;
+        
+        SDL_assert(texture.pages.size() == (size_t)(texture.page_columns * texture.page_rows));
+        SDL_assert(texture.page_stride_x > 0);
+        SDL_assert(texture.page_stride_y > 0);
+        
+        for (const Texture2D& page : texture.pages)
+        {
+            if (!IsTextureValid(page))
+                return false;
+        }
+        
+        return true;
+    }
+    
+    // Pages hold a reference to their handles, so a freed handle cannot be reused meanwhile
+    bool IsSamePagedTexture(const PagedTexture& texture1, const PagedTexture& texture2)
+    {
+        if (texture1.pages.size() != texture2.pages.size())
+            return false;
+        if (texture1.pages.empty())
+            return true;
+        
+        return texture1.pages[0].handle == texture2.pages[0].handle;
+    }
+    
     uint64 GetTextureImGuiID(const Texture2D& texture)
     {
         return reinterpret_cast<uint64>(texture.handle);
     }
+    
+    int32 GetMaximumTextureSize(SDL_Renderer* renderer)
+    {
+        SDL_assert(renderer != nullptr);
+        
+        SDL_PropertiesID properties = SDL_GetRendererProperties(renderer);
+        int64 maximum_size = SDL_GetNumberProperty(properties, SDL_PROP_RENDERER_MAX_TEXTURE_SIZE_NUMBER, 0);
+        
+        // Some renderers do not report a limit
+        if (maximum_size <= 0)
+            return SDL_max(TEXTURE_MAXIMUM_WIDTH, TEXTURE_MAXIMUM_HEIGHT);
+        
+        return (int32)SDL_min(maximum_size, (int64)SDL_MAX_SINT32);
+    }
 }
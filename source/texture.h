@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include <SDL3/SDL.h>
 
 #include "core.h"
@@ -12,6 +14,9 @@ namespace SBMap
     constexpr int32 TEXTURE_MINIMUM_HEIGHT = 4;
     constexpr int32 TEXTURE_MAXIMUM_HEIGHT = 8192;
     
+    constexpr int32 PAGED_TEXTURE_MAXIMUM_WIDTH = 16384;
+    constexpr int32 PAGED_TEXTURE_MAXIMUM_HEIGHT = 16384;
+    
     struct Texture2D
     {
         SDL_Texture* handle = nullptr;
@@ -28,9 +33,48 @@ namespace SBMap
         Texture2D& operator=(Texture2D&& other);
     };
     
+    // Decoding does not touch the renderer, so it can run on any thread
+    struct Image
+    {
+        uint8* pixels = nullptr;
+        int32 width = 0;
+        int32 height = 0;
+        
+        Image() = default;
+        Image(const Image&) = delete;
+        Image(Image&& other);
+        ~Image();
+        
+        Image& operator=(const Image&) = delete;
+        Image& operator=(Image&& other);
+    };
+    
+    // Pages overlap, so a region no larger than the overlap lies fully inside
+    // the page its top left corner falls in
+    struct PagedTexture
+    {
+        std::vector<Texture2D> pages;
+        int32 page_stride_x = 0;
+        int32 page_stride_y = 0;
+        int32 page_columns = 0;
+        int32 page_rows = 0;
+        int32 width = 0;
+        int32 height = 0;
+    };
+    
     Result<Texture2D> CreateTexture(SDL_Surface* surface, SDL_Renderer* renderer);
-    Result<Texture2D> LoadTexture(const char* filepath, SDL_Renderer* renderer);
+    Result<Texture2D> CreateRenderTexture(int32 width, int32 height, SDL_Renderer* renderer);
+    Result<Texture2D> CreateStreamingTexture(int32 width, int32 height, SDL_Renderer* renderer);
+    
+    Result<PagedTexture> CreatePagedTexture(SDL_Surface* surface, int32 page_overlap, SDL_Renderer* renderer);
+    Result<PagedTexture> CreatePagedTexture(const Image& image, int32 page_overlap, SDL_Renderer* renderer);
+    
+    Result<Image> DecodeImage(const char* filepath);
     
     bool IsTextureValid(const Texture2D& texture);
+    bool IsPagedTextureValid(const PagedTexture& texture);
+    bool IsSamePagedTexture(const PagedTexture& texture1, const PagedTexture& texture2);
     uint64 GetTextureImGuiID(const Texture2D& texture);
+    
+    int32 GetMaximumTextureSize(SDL_Renderer* renderer);
 }
@@ -0,0 +1,149 @@
+#include <imgui.h>
+#include <imgui_impl_sdlrenderer3.h>
+#include <SDL3/SDL.h>
+
+#include "core.h"
+#include "tile_batch.h"
+
+namespace SBMap
+{
+    static void RenderTileBatchCallback(const ImDrawList* draw_list, const ImDrawCmd* command)
+    {
+        (void)draw_list;
+        
+        ImGuiPlatformIO& platform_io = ImGui::GetPlatformIO();
+        auto render_state = (ImGui_ImplSDLRenderer3_RenderState*)platform_io.Renderer_RenderState;
+        if (!render_state)
+            return;
+        
+        SDL_Renderer* renderer = render_state->Renderer;
+        ImDrawData* draw_data = ImGui::GetDrawData();
+        
+        // Project the clip rect the same way the renderer backend does for regular commands
+        float32 render_scale_x = 1.0f;
+        float32 render_scale_y = 1.0f;
+        SDL_GetRenderScale(renderer, &render_scale_x, &render_scale_y);
+        
+        ImVec2 clip_scale;
+        clip_scale.x = (render_scale_x == 1.0f) ? draw_data->FramebufferScale.x : 1.0f;
+        clip_scale.y = (render_scale_y == 1.0f) ? draw_data->FramebufferScale.y : 1.0f;
+        
+        ImVec2 clip_min;
+        clip_min.x = (command->ClipRect.x - draw_data->DisplayPos.x) * clip_scale.x;
+        clip_min.y = (command->ClipRect.y - draw_data->DisplayPos.y) * clip_scale.y;
+        
+        ImVec2 clip_max;
+        clip_max.x = (command->ClipRect.z - draw_data->DisplayPos.x) * clip_scale.x;
+        clip_max.y = (command->ClipRect.w - draw_data->DisplayPos.y) * clip_scale.y;
+        
+        float32 framebuffer_width = (float32)(int32)(draw_data->DisplaySize.x * clip_scale.x);
+        float32 framebuffer_height = (float32)(int32)(draw_data->DisplaySize.y * clip_scale.y);
+        
+        clip_min.x = SDL_max(clip_min.x, 0.0f);
+        clip_min.y = SDL_max(clip_min.y, 0.0f);
+        clip_max.x = SDL_min(clip_max.x, framebuffer_width);
+        clip_max.y = SDL_min(clip_max.y, framebuffer_height);
+        
+        if (clip_max.x <= clip_min.x || clip_max.y <= clip_min.y)
+            return;
+        
+        SDL_Rect clip_rect;
+        clip_rect.x = (int32)clip_min.x;
+        clip_rect.y = (int32)clip_min.y;
+        clip_rect.w = (int32)(clip_max.x - clip_min.x);
+        clip_rect.h = (int32)(clip_max.y - clip_min.y);
+        
+        SDL_SetRenderClipRect(renderer, &clip_rect);
+        
+        const TileBatch* batch = (const TileBatch*)command->UserCallbackData;
+        batch->Render(renderer);
+    }
+    
+    void TileBatch::Clear()
+    {
+        m_Ranges.clear();
+        m_RangeIndices.clear();
+        m_LastRange = 0;
+        m_VertexCount = 0;
+        m_IndexCount = 0;
+    }
+    
+    void TileBatch::AddQuad(SDL_Texture* texture, const SDL_FRect& dest_rect, const SDL_FRect& source_rect)
+    {
+        SDL_FColor color = { 1.0f, 1.0f, 1.0f, 1.0f };
+        AddQuad(texture, dest_rect, source_rect, color);
+    }
+    
+    void TileBatch::AddQuad(SDL_Texture* texture, const SDL_FRect& dest_rect, const SDL_FRect& source_rect, const SDL_FColor& color)
+    {
+        Range& range = GetRange(texture);
+        
+        int32 first_vertex = (int32)range.vertices.size();
+        
+        float32 dest_left = dest_rect.x;
+        float32 dest_top = dest_rect.y;
+        float32 dest_right = dest_rect.x + dest_rect.w;
+        float32 dest_bottom = dest_rect.y + dest_rect.h;
+        
+        float32 source_left = source_rect.x;
+        float32 source_top = source_rect.y;
+        float32 source_right = source_rect.x + source_rect.w;
+        float32 source_bottom = source_rect.y + source_rect.h;
+        
+        range.vertices.push_back({ { dest_left, dest_top }, color, { source_left, source_top } });
+        range.vertices.push_back({ { dest_right, dest_top }, color, { source_right, source_top } });
+        range.vertices.push_back({ { dest_right, dest_bottom }, color, { source_right, source_bottom } });
+        range.vertices.push_back({ { dest_left, dest_bottom }, color, { source_left, source_bottom } });
+        
+        range.indices.push_back(first_vertex + 0);
+        range.indices.push_back(first_vertex + 1);
+        range.indices.push_back(first_vertex + 2);
+        range.indices.push_back(first_vertex + 0);
+        range.indices.push_back(first_vertex + 2);
+        range.indices.push_back(first_vertex + 3);
+        
+        m_VertexCount += 4;
+        m_IndexCount += 6;
+    }
+    
+    void TileBatch::Render(SDL_Renderer* renderer) const
+    {
+        SDL_assert(renderer != nullptr);
+        
+        for (const Range& range : m_Ranges)
+        {
+            SDL_RenderGeometry(renderer, range.texture,
+                range.vertices.data(), (int32)range.vertices.size(),
+                range.indices.data(), (int32)range.indices.size());
+        }
+    }
+    
+    TileBatch::Range& TileBatch::GetRange(SDL_Texture* texture)
+    {
+        // Quads tend to come in runs of the same texture
+        if (m_LastRange < m_Ranges.size() && m_Ranges[m_LastRange].texture == texture)
+            return m_Ranges[m_LastRange];
+        
+        auto [it, inserted] = m_RangeIndices.try_emplace(texture, m_Ranges.size());
+        if (inserted)
+        {
+            Range range;
+            range.texture = texture;
+            m_Ranges.push_back(std::move(range));
+        }
+        
+        m_LastRange = it->second;
+        return m_Ranges[m_LastRange];
+    }
+    
+    void TileBatch::AddToDrawList(ImDrawList* draw_list) const
+    {
+        SDL_assert(draw_list != nullptr);
+        
+        if (IsEmpty())
+            return;
+        
+        draw_list->AddCallback(RenderTileBatchCallback, (void*)this);
+        draw_list->AddCallback(ImDrawCallback_ResetRenderState, nullptr);
+    }
+}
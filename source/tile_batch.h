@@ -0,0 +1,47 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <SDL3/SDL.h>
+
+#include "core.h"
+
+struct ImDrawList;
+
+namespace SBMap
+{
+    // Quads are grouped by texture, so quads with different textures should not overlap
+    class TileBatch
+    {
+    public:
+        void Clear();
+        void AddQuad(SDL_Texture* texture, const SDL_FRect& dest_rect, const SDL_FRect& source_rect);
+        void AddQuad(SDL_Texture* texture, const SDL_FRect& dest_rect, const SDL_FRect& source_rect, const SDL_FColor& color);
+        
+        void Render(SDL_Renderer* renderer) const;
+        void AddToDrawList(ImDrawList* draw_list) const;
+        
+        bool IsEmpty() const { return m_IndexCount == 0; }
+        size_t GetVertexCount() const { return m_VertexCount; }
+        size_t GetIndexCount() const { return m_IndexCount; }
+        size_t GetRangeCount() const { return m_Ranges.size(); }
+        
+    private:
+        struct Range
+        {
+            SDL_Texture* texture = nullptr;
+            std::vector<SDL_Vertex> vertices;
+            std::vector<int32> indices;
+        };
+        
+        Range& GetRange(SDL_Texture* texture);
+        
+    private:
+        std::vector<Range> m_Ranges;
+        std::unordered_map<SDL_Texture*, size_t> m_RangeIndices;
+        size_t m_LastRange = 0;
+        size_t m_VertexCount = 0;
+        size_t m_IndexCount = 0;
+    };
+}
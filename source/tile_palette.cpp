@@ -1,15 +1,35 @@
+#include <memory>
+#include <string>
+
 #include <imgui.h>
 #include <SDL3/SDL.h>
 
 #include "app.h"
 #include "core.h"
+#include "error.h"
 #include "error_popup.h"
+#include "job.h"
 #include "texture.h"
 #include "tile_palette.h"
 #include "tilemap.h"
 
 namespace SBMap
 {
+    struct AtlasFileRequest
+    {
+        TilePalette* tile_palette = nullptr;
+        std::string filepath;
+    };
+    
+    static void SDLCALL RunAtlasFileRequest(void* userdata)
+    {
+        AtlasFileRequest* request = (AtlasFileRequest*)userdata;
+        request->tile_palette->OpenAtlasFile(request->filepath.c_str());
+        
+        delete request;
+    }
+    
+    // Dialog callbacks may run on another thread
     static void OpenFileDialogCallback(void* userdata, const char* const* filelist, int filter)
     {
         (void)filter;
@@ -17,8 +37,9 @@ namespace SBMap
         if (!filelist || !(*filelist))
             return;
         
-        TilePalette* tile_palette = (TilePalette*)userdata;
-        tile_palette->OpenAtlasFile(*filelist);
+        AtlasFileRequest* request = new AtlasFileRequest{ (TilePalette*)userdata, *filelist };
+        if (!SDL_RunOnMainThread(RunAtlasFileRequest, request, false))
+            delete request;
     }
     
     TilePalette TilePalette::Create(AppContext& context)
@@ -36,6 +57,8 @@ namespace SBMap
     
     void TilePalette::ShowUI()
     {
+        UpdateAtlasLoad();
+        
         ImGui::Begin("Tile Palette");
         
         ShowSelectTileSectionUI();
@@ -57,25 +80,78 @@ namespace SBMap
             this, m_Context->GetWindow(), filters, SDL_arraysize(filters), nullptr, false);
     }
     
+    // Textures have to be created on the render thread, so only decoding runs on the worker
     void TilePalette::OpenAtlasFile(const char* filepath)
     {
-        auto result = LoadTexture(filepath, m_Context->GetRenderer());
-        if (result)
+        std::shared_ptr<AtlasLoad> atlas_load = std::make_shared<AtlasLoad>();
+        std::string path = filepath;
+        
+        auto result = Job::Start("SBMapAtlasLoad", [atlas_load, path](JobState& state)
         {
-            Texture2D& atlas_texture = result.GetValue();
-            m_Tileset = CreateTileset(atlas_texture, m_InputTileWidth, m_InputTileHeight);
-        }
-        else
+            auto decode_result = DecodeImage(path.c_str());
+            if (IsJobCancelled(state))
+                return;
+            
+            if (!decode_result)
+            {
+                atlas_load->error = decode_result.GetError();
+                return;
+            }
+            
+            atlas_load->image = std::move(decode_result.GetValue());
+            atlas_load->decoded = true;
+        });
+        
+        if (!result)
         {
             OpenErrorPopup("Failed to Open Atlas", result.GetError());
+            return;
         }
+        
+        m_AtlasJob = std::move(result.GetValue());
+        m_AtlasLoad = atlas_load;
     }
     
     void TilePalette::RemoveAtlas()
     {
+        m_AtlasJob = {};
+        m_AtlasLoad = nullptr;
         m_Tileset = {};
     }
     
+    void TilePalette::UpdateAtlasLoad()
+    {
+        if (!m_AtlasJob.IsFinished())
+            return;
+        
+        std::shared_ptr<AtlasLoad> atlas_load = std::move(m_AtlasLoad);
+        m_AtlasJob = {};
+        
+        if (!atlas_load->decoded)
+        {
+            OpenErrorPopup("Failed to Open Atlas", atlas_load->error);
+            return;
+        }
+        
+        auto result = CreatePagedTexture(atlas_load->image, TILESET_PAGE_OVERLAP, m_Context->GetRenderer());
+        if (!result)
+        {
+            OpenErrorPopup("Failed to Open Atlas", result.GetError());
+            return;
+        }
+        
+        auto tileset_result = CreateTileset(result.GetValue(), m_InputTileWidth, m_InputTileHeight);
+        if (!tileset_result)
+        {
+            OpenErrorPopup("Failed to Open Atlas", tileset_result.GetError());
+            return;
+        }
+        
+        m_Tileset = std::move(tileset_result.GetValue());
+        m_SelectedTileX = 0;
+        m_SelectedTileY = 0;
+    }
+    
     void TilePalette::SetTileSize()
     {
         int32 maximum_tile_width = SDL_clamp(m_Tileset.atlas.width, TILE_MINIMUM_WIDTH, TILE_MAXIMUM_WIDTH);
@@ -84,10 +160,7 @@ namespace SBMap
         m_InputTileWidth = SDL_clamp(m_InputTileWidth, TILE_MINIMUM_WIDTH, maximum_tile_width);
         m_InputTileHeight = SDL_clamp(m_InputTileHeight, TILE_MINIMUM_HEIGHT, maximum_tile_height);
         
-        m_Tileset.tile_width = m_InputTileWidth;
-        m_Tileset.tile_height = m_InputTileHeight;
-        m_Tileset.width = m_Tileset.atlas.width / m_Tileset.tile_width;
-        m_Tileset.height = m_Tileset.atlas.height / m_Tileset.tile_height;
+        ResizeTileset(m_Tileset, m_InputTileWidth, m_InputTileHeight);
         
         m_SelectedTileX = 0;
         m_SelectedTileY = 0;
@@ -104,7 +177,7 @@ namespace SBMap
     {
         ImGui::SeparatorText("Select Tile");
         
-        if (IsTilesetValid(m_Tileset))
+        if (IsTilesetValid(m_Tileset) && !IsLoadingAtlas())
         {
             ImVec2 content_size;
             content_size.x = (float32)m_Tileset.atlas.width * m_Scale;
@@ -136,8 +209,30 @@ namespace SBMap
                 }
             }
             
-            ImTextureRef atlas_image_ref = GetTextureImGuiID(m_Tileset.atlas);
-            ImGui::Image(atlas_image_ref, content_size);
+            // Overlapping parts of neighbouring pages hold the same pixels
+            ImDrawList* draw_list = ImGui::GetWindowDrawList();
+            const PagedTexture& atlas = m_Tileset.atlas;
+            
+            for (int32 page_y = 0; page_y < atlas.page_rows; page_y++)
+            {
+                for (int32 page_x = 0; page_x < atlas.page_columns; page_x++)
+                {
+                    const Texture2D& page = atlas.pages[(size_t)(page_x + page_y * atlas.page_columns)];
+                    
+                    ImVec2 page_min;
+                    page_min.x = window_begin.x + (float32)(page_x * atlas.page_stride_x) * m_Scale;
+                    page_min.y = window_begin.y + (float32)(page_y * atlas.page_stride_y) * m_Scale;
+                    
+                    ImVec2 page_max;
+                    page_max.x = page_min.x + (float32)page.width * m_Scale;
+                    page_max.y = page_min.y + (float32)page.height * m_Scale;
+                    
+                    ImTextureRef page_image_ref = GetTextureImGuiID(page);
+                    draw_list->AddImage(page_image_ref, page_min, page_max);
+                }
+            }
+            
+            ImGui::Dummy(content_size);
             
             ImVec2 marker_min;
             marker_min.x = window_begin.x + (float32)m_SelectedTileX * tile_width_scaled;
@@ -149,7 +244,6 @@ namespace SBMap
             
             ImColor marker_color = { 255, 255, 255, 255 };
             
-            ImDrawList* draw_list = ImGui::GetWindowDrawList();
             draw_list->AddRect(marker_min, marker_max, marker_color);
             
             ImGui::EndChild();
@@ -164,6 +258,9 @@ namespace SBMap
             
             ImTextureRef texture_ref = GetTextureImGuiID(checkerboard);
             ImGui::Image(texture_ref, image_size);
+            
+            if (IsLoadingAtlas())
+                ImGui::TextUnformatted("Loading atlas...");
         }
     }
     
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <memory>
+
 #include "core.h"
+#include "error.h"
+#include "job.h"
+#include "texture.h"
 #include "tilemap.h"
 
 namespace SBMap
@@ -18,11 +23,20 @@ namespace SBMap
         void OpenAtlasFile(const char* filepath);
         void RemoveAtlas();
         
+        bool IsLoadingAtlas() const { return m_AtlasJob.IsRunning(); }
         int32 GetSelectedTileX() const { return m_SelectedTileX; }
         int32 GetSelectedTileY() const { return m_SelectedTileY; }
         const Tileset& GetTileset() const { return m_Tileset; }
         
     private:
+        struct AtlasLoad
+        {
+            Image image;
+            Error error = {};
+            bool decoded = false;
+        };
+        
+        void UpdateAtlasLoad();
         void SetTileSize();
         void ResetTileSize();
         
@@ -32,6 +46,8 @@ namespace SBMap
     private:
         AppContext* m_Context = nullptr;
         Tileset m_Tileset = {};
+        Job m_AtlasJob;
+        std::shared_ptr<AtlasLoad> m_AtlasLoad;
         int32 m_SelectedTileX = 0;
         int32 m_SelectedTileY = 0;
         float32 m_Scale = 0.0f;
@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <SDL3/SDL.h>
 
+#include "cell_scan.h"
 #include "core.h"
 #include "error.h"
-#include "scope.h"
+#include "job.h"
+#include "mapped_file.h"
+#include "run_length.h"
 #include "texture.h"
 #include "tilemap.h"
 
@@ -24,25 +34,644 @@ namespace SBMap
         uint32 flags = 0;
     };
     
+    // Same packing as Tilemap::Cell
+    struct SBMCompactCell
+    {
+        uint32 bits = 0;
+    };
+    
+    struct SBMV2Header
+    {
+        uint8 magic[4] = {};
+        uint32 version = 0;
+        int32 width = 0;
+        int32 height = 0;
+        uint32 chunk_count = 0;
+    };
+    
+    struct SBMV2ChunkEntry
+    {
+        uint32 key = 0;
+        uint32 used_count = 0;
+        uint64 offset = 0;
+        uint32 size = 0;
+    };
+    
+    // Names the size and modification time of the file the journal belongs to
+    struct SBMJournalHeader
+    {
+        uint8 magic[4] = {};
+        uint32 version = 0;
+        uint64 base_size = 0;
+        int64 base_modify_time = 0;
+    };
+    
+    struct SBMJournalRecord
+    {
+        uint32 size = 0;
+        uint32 checksum = 0;
+    };
+    
+    struct SBMJournalEdit
+    {
+        int32 width = 0;
+        int32 height = 0;
+        uint32 chunk_count = 0;
+    };
+    
+    // A chunk without used cells was released and has no data
+    struct SBMJournalChunk
+    {
+        uint32 key = 0;
+        uint32 used_count = 0;
+        uint32 size = 0;
+    };
+    
     #pragma pack(pop)
     
-    constexpr size_t SBM_MINIMUM_SIZE = sizeof(SBMHeader) + sizeof(SBMCell);
+    static_assert(sizeof(SBMCompactCell) == sizeof(Tilemap::Cell));
     
-    Tileset CreateTileset(const Texture2D& atlas_texture, int32 tile_width, int32 tile_height)
+    constexpr size_t SBM_MINIMUM_SIZE = sizeof(SBMHeader) + sizeof(SBMCompactCell);
+    constexpr int32 SBM_JOB_UPDATE_ROWS = 64;
+    constexpr size_t SBM_WRITE_BLOCK_CELL_COUNT = 16384;
+    constexpr const char* SBM_TEMP_SUFFIX = ".tmp";
+    
+    constexpr int32 SBM_V2_CHUNK_CELL_COUNT = TILEMAP_CHUNK_WIDTH * TILEMAP_CHUNK_HEIGHT;
+    constexpr uint32 SBM_V2_CHUNKS_PER_THREAD = 256;
+    
+    constexpr uint32 SBM_JOURNAL_VERSION = 1;
+    constexpr const char* SBM_JOURNAL_SUFFIX = ".journal";
+    
+    static size_t GetChunkCellIndex(int32 cell_x, int32 cell_y)
     {
-        SDL_assert(IsTextureValid(atlas_texture));
-        SDL_assert(tile_width >= TILE_MINIMUM_WIDTH);
-        SDL_assert(tile_width <= TILE_MAXIMUM_WIDTH);
-        SDL_assert(tile_height >= TILE_MINIMUM_HEIGHT);
-        SDL_assert(tile_height <= TILE_MAXIMUM_HEIGHT);
+        return (size_t)((cell_x % TILEMAP_CHUNK_WIDTH) + (cell_y % TILEMAP_CHUNK_HEIGHT) * TILEMAP_CHUNK_WIDTH);
+    }
+    
+    static uint32 GetChunkCellFlags(const Tilemap::Chunk& chunk, int32 cell_x, int32 cell_y)
+    {
+        int32 row = cell_y % TILEMAP_CHUNK_HEIGHT;
+        int32 column = cell_x % TILEMAP_CHUNK_WIDTH;
+        
+        uint32 flags = 0;
+        for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+            flags |= ((chunk.flag_planes[plane][row] >> column) & 1) << plane;
+        
+        return flags;
+    }
+    
+    static bool IsCompactSBM(const SBMHeader& header)
+    {
+        return SDL_memcmp(header.magic, "SBMC", 4) == 0;
+    }
+    
+    static bool IsValidSBMCell(const SBMCell& sbm_cell)
+    {
+        if (sbm_cell.tile_x == -1 && sbm_cell.tile_y == -1)
+            return true;
+        
+        return
+            sbm_cell.tile_x >= 0 && sbm_cell.tile_x < (int32)TILEMAP_CELL_TILE_LIMIT &&
+            sbm_cell.tile_y >= 0 && sbm_cell.tile_y < (int32)TILEMAP_CELL_TILE_LIMIT;
+    }
+    
+    static Result<SBMHeader> ReadSBMHeader(const MappedFile& file)
+    {
+        if (file.size < SBM_MINIMUM_SIZE)
+            return Error{ "File is too small." };
+        
+        SBMHeader header;
+        SDL_memcpy(&header, file.data, sizeof(SBMHeader));
+        
+        if (!IsCompactSBM(header) && SDL_memcmp(header.magic, "SBMP", 4) != 0)
+            return Error{ "File has unsupported format." };
+        
+        if (header.width < TILEMAP_MINIMUM_WIDTH || header.height < TILEMAP_MINIMUM_HEIGHT)
+            return Error{ "Tilemap dimensions are smaller than the minimum allowed." };
+        if (header.width > TILEMAP_MAXIMUM_WIDTH || header.height > TILEMAP_MAXIMUM_HEIGHT)
+            return Error{ "Tilemap dimensions are greater than the maximum allowed." };
+        
+        size_t sbm_cell_size = IsCompactSBM(header) ? sizeof(SBMCompactCell) : sizeof(SBMCell);
+        size_t sbm_cell_array_count = (size_t)header.width * (size_t)header.height;
+        size_t sbm_cell_array_size = sbm_cell_array_count * sbm_cell_size;
+        size_t real_sbm_cell_array_size = file.size - sizeof(SBMHeader);
+        
+        if (sbm_cell_array_size != real_sbm_cell_array_size)
+            return Error{ "File has invalid data and is likely corrupted." };
+        
+        return header;
+    }
+    
+    static bool UpdateTilemapJob(JobState* job, int32 row, int32 row_count)
+    {
+        if (!job || row % SBM_JOB_UPDATE_ROWS != 0)
+            return true;
+        
+        SetJobProgress(*job, (float32)row / (float32)row_count);
+        return !IsJobCancelled(*job);
+    }
+    
+    // Loads run on worker threads, so error details need a buffer per thread
+    static thread_local char s_SBMErrorDetails[96] = {};
+    
+    static Error GetSBMCellError(const char* message, int32 cell_x, int32 cell_y, int32 width)
+    {
+        int64 cell_index = (int64)cell_y * (int64)width + (int64)cell_x;
+        SDL_snprintf(s_SBMErrorDetails, sizeof(s_SBMErrorDetails), "First bad cell is %lld at %d, %d.", (long long)cell_index, cell_x, cell_y);
+        
+        return Error{ message, s_SBMErrorDetails };
+    }
+    
+    static Error CopySBMError(const Error& error)
+    {
+        if (!error.details)
+            return error;
+        
+        SDL_strlcpy(s_SBMErrorDetails, error.details, sizeof(s_SBMErrorDetails));
+        return Error{ error.message, s_SBMErrorDetails };
+    }
+    
+    // Tiles and flags the packing cannot hold get a bit no valid cell has, which the scan reports
+    static void PackSBMCells(const SBMCell* sbm_cells, Tilemap::Cell* cells, int32 count)
+    {
+        for (int32 i = 0; i < count; i++)
+        {
+            const SBMCell& sbm_cell = sbm_cells[i];
+            
+            uint32 bits = sbm_cell.flags & TILEMAP_CELL_FLAGS_MASK;
+            if ((sbm_cell.flags & ~TILEMAP_CELL_FLAGS_MASK) != 0)
+                bits |= ~TILEMAP_CELL_VALID_MASK;
+            
+            if (sbm_cell.tile_x != -1 || sbm_cell.tile_y != -1)
+            {
+                if (IsValidSBMCell(sbm_cell))
+                {
+                    bits |= TILEMAP_CELL_TILE_BIT |
+                        ((uint32)sbm_cell.tile_x << TILEMAP_CELL_TILE_X_SHIFT) | ((uint32)sbm_cell.tile_y << TILEMAP_CELL_TILE_Y_SHIFT);
+                }
+                else
+                {
+                    bits |= ~TILEMAP_CELL_VALID_MASK;
+                }
+            }
+            
+            cells[i].bits = bits;
+        }
+    }
+    
+    // Chunks are fresh while loading, so used spans are copied in directly
+    static Result<bool> LoadSBMCells(Tilemap& tilemap, const char* data, bool compact, int32 tileset_width, int32 tileset_height, JobState* job)
+    {
+        for (int32 y = 0; y < tilemap.height; y++)
+        {
+            if (!UpdateTilemapJob(job, y, tilemap.height))
+                return Error{ "Loading was cancelled." };
+            
+            int32 row = y % TILEMAP_CHUNK_HEIGHT;
+            
+            for (int32 begin_x = 0; begin_x < tilemap.width; begin_x += TILEMAP_CHUNK_WIDTH)
+            {
+                int32 count = SDL_min(TILEMAP_CHUNK_WIDTH, tilemap.width - begin_x);
+                size_t cell_index = (size_t)y * (size_t)tilemap.width + (size_t)begin_x;
+                
+                Tilemap::Cell packed_cells[TILEMAP_CHUNK_WIDTH];
+                const Tilemap::Cell* cells = packed_cells;
+                
+                if (compact)
+                    cells = (const Tilemap::Cell*)((const SBMCompactCell*)data + cell_index);
+                else
+                    PackSBMCells((const SBMCell*)data + cell_index, packed_cells, count);
+                
+                Tilemap::Cell tiles[TILEMAP_CHUNK_WIDTH];
+                CellScan scan = ScanCells(cells, tiles, count, tileset_width, tileset_height);
+                
+                if (scan.used_mask == 0)
+                    continue;
+                if (scan.invalid_mask != 0)
+                    return GetSBMCellError("File has invalid data and is likely corrupted.", begin_x + std::countr_zero(scan.invalid_mask), y, tilemap.width);
+                if (scan.out_of_bounds_mask != 0)
+                    return GetSBMCellError("Tile out of tileset bounds.", begin_x + std::countr_zero(scan.out_of_bounds_mask), y, tilemap.width);
+                
+                Tilemap::Chunk& chunk = AcquireTilemapChunk(tilemap, begin_x / TILEMAP_CHUNK_WIDTH, y / TILEMAP_CHUNK_HEIGHT);
+                SDL_memcpy(chunk.cells + GetChunkCellIndex(begin_x, y), tiles, (size_t)count * sizeof(Tilemap::Cell));
+                
+                for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                    chunk.flag_planes[plane][row] |= scan.flag_masks[plane];
+                
+                chunk.tile_plane[row] |= scan.tile_mask;
+                chunk.used_count += std::popcount(scan.used_mask);
+            }
+        }
+        
+        return true;
+    }
+    
+    static bool IsVersionedSBM(const MappedFile& file)
+    {
+        return file.size >= sizeof(SBMV2Header) && SDL_memcmp(file.data, "SBMV", 4) == 0;
+    }
+    
+    static Result<SBMV2Header> ReadSBMV2Header(const MappedFile& file)
+    {
+        SBMV2Header header;
+        SDL_memcpy(&header, file.data, sizeof(SBMV2Header));
+        
+        if (header.version != (uint32)TilemapFileVersion::V2)
+            return Error{ "File has unsupported version." };
+        
+        if (header.width < TILEMAP_MINIMUM_WIDTH || header.height < TILEMAP_MINIMUM_HEIGHT)
+            return Error{ "Tilemap dimensions are smaller than the minimum allowed." };
+        if (header.width > TILEMAP_MAXIMUM_WIDTH || header.height > TILEMAP_MAXIMUM_HEIGHT)
+            return Error{ "Tilemap dimensions are greater than the maximum allowed." };
+        
+        int32 chunk_columns = (header.width + TILEMAP_CHUNK_WIDTH - 1) / TILEMAP_CHUNK_WIDTH;
+        int32 chunk_rows = (header.height + TILEMAP_CHUNK_HEIGHT - 1) / TILEMAP_CHUNK_HEIGHT;
+        
+        if (header.chunk_count > (uint32)(chunk_columns * chunk_rows))
+            return Error{ "File has invalid data and is likely corrupted." };
+        
+        size_t directory_size = (size_t)header.chunk_count * sizeof(SBMV2ChunkEntry);
+        if (file.size - sizeof(SBMV2Header) < directory_size)
+            return Error{ "File has invalid data and is likely corrupted." };
+        
+        const SBMV2ChunkEntry* entries = (const SBMV2ChunkEntry*)(file.data + sizeof(SBMV2Header));
+        for (uint32 i = 0; i < header.chunk_count; i++)
+        {
+            const SBMV2ChunkEntry& entry = entries[i];
+            int32 chunk_x = (int32)(entry.key & 0xFFFF);
+            int32 chunk_y = (int32)(entry.key >> 16);
+            
+            if (chunk_x >= chunk_columns || chunk_y >= chunk_rows)
+                return Error{ "File has invalid data and is likely corrupted." };
+            if (entry.used_count == 0 || entry.used_count > (uint32)SBM_V2_CHUNK_CELL_COUNT)
+                return Error{ "File has invalid data and is likely corrupted." };
+            if (entry.offset > file.size || entry.size > file.size - entry.offset)
+                return Error{ "File has invalid data and is likely corrupted." };
+        }
+        
+        return header;
+    }
+    
+    static Result<bool> DecodeSBMV2Chunk(const char* data, const SBMV2ChunkEntry& entry, int32 width, int32 height,
+        int32 tileset_width, int32 tileset_height, Tilemap::Chunk& chunk)
+    {
+        uint32 values[SBM_V2_CHUNK_CELL_COUNT];
+        if (!DecodeRunLength((const uint8*)data + entry.offset, entry.size, values, SBM_V2_CHUNK_CELL_COUNT))
+            return Error{ "File has invalid data and is likely corrupted." };
+        
+        int32 begin_x = (int32)(entry.key & 0xFFFF) * TILEMAP_CHUNK_WIDTH;
+        int32 begin_y = (int32)(entry.key >> 16) * TILEMAP_CHUNK_HEIGHT;
+        
+        int32 column_count = SDL_min(width - begin_x, TILEMAP_CHUNK_WIDTH);
+        uint32 column_mask = column_count == TILEMAP_CHUNK_WIDTH ? 0xFFFFFFFF : (1u << column_count) - 1;
+        
+        for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+        {
+            int32 y = begin_y + row;
+            const Tilemap::Cell* cells = (const Tilemap::Cell*)(values + row * TILEMAP_CHUNK_WIDTH);
+            Tilemap::Cell* tiles = chunk.cells + row * TILEMAP_CHUNK_WIDTH;
+            
+            CellScan scan = ScanCells(cells, tiles, TILEMAP_CHUNK_WIDTH, tileset_width, tileset_height);
+            
+            // Cells past the edge of the map have to be empty
+            uint32 outside_mask = scan.used_mask & ~(y < height ? column_mask : 0);
+            if (outside_mask != 0)
+                return Error{ "File has invalid data and is likely corrupted." };
+            if (scan.invalid_mask != 0)
+                return GetSBMCellError("File has invalid data and is likely corrupted.", begin_x + std::countr_zero(scan.invalid_mask), y, width);
+            if (scan.out_of_bounds_mask != 0)
+                return GetSBMCellError("Tile out of tileset bounds.", begin_x + std::countr_zero(scan.out_of_bounds_mask), y, width);
+            
+            for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                chunk.flag_planes[plane][row] = scan.flag_masks[plane];
+            
+            chunk.tile_plane[row] = scan.tile_mask;
+            chunk.used_count += std::popcount(scan.used_mask);
+        }
+        
+        if ((uint32)chunk.used_count != entry.used_count)
+            return Error{ "File has invalid data and is likely corrupted." };
+        
+        return true;
+    }
+    
+    struct SBMV2DecodeTask
+    {
+        const MappedFile* file = nullptr;
+        const SBMV2Header* header = nullptr;
+        const SBMV2ChunkEntry* entries = nullptr;
+        std::shared_ptr<Tilemap::Chunk>* chunks = nullptr;
+        uint32 begin = 0;
+        uint32 end = 0;
+        int32 tileset_width = 0;
+        int32 tileset_height = 0;
+        JobState* job = nullptr;
+        SDL_AtomicInt* decoded_count = nullptr;
+        const char* error_message = nullptr;
+        char error_details[96] = {};
+    };
+    
+    // Error details may point at a buffer owned by this thread, so they are copied
+    static int SDLCALL RunSBMV2DecodeTask(void* userdata)
+    {
+        SBMV2DecodeTask& task = *(SBMV2DecodeTask*)userdata;
+        
+        for (uint32 i = task.begin; i < task.end; i++)
+        {
+            if (task.job && IsJobCancelled(*task.job))
+            {
+                task.error_message = "Loading was cancelled.";
+                return 0;
+            }
+            
+            task.chunks[i] = std::make_shared<Tilemap::Chunk>();
+            
+            auto result = DecodeSBMV2Chunk(task.file->data, task.entries[i], task.header->width, task.header->height,
+                task.tileset_width, task.tileset_height, *task.chunks[i]);
+            if (!result)
+            {
+                const Error& error = result.GetError();
+                task.error_message = error.message;
+                
+                if (error.details)
+                    SDL_strlcpy(task.error_details, error.details, sizeof(task.error_details));
+                
+                return 0;
+            }
+            
+            int32 decoded_count = SDL_AddAtomicInt(task.decoded_count, 1) + 1;
+            if (task.job)
+                UpdateTilemapJob(task.job, decoded_count, (int32)task.header->chunk_count);
+        }
+        
+        return 0;
+    }
+    
+    // The calling thread also decodes any share whose thread failed to start
+    static Result<bool> LoadSBMV2Chunks(Tilemap& tilemap, const MappedFile& file, const SBMV2Header& header,
+        int32 tileset_width, int32 tileset_height, JobState* job)
+    {
+        uint32 chunk_count = header.chunk_count;
+        std::vector<std::shared_ptr<Tilemap::Chunk>> chunks(chunk_count);
+        
+        uint32 maximum_thread_count = (uint32)SDL_max(SDL_GetNumLogicalCPUCores(), 1);
+        uint32 thread_count = SDL_clamp(chunk_count / SBM_V2_CHUNKS_PER_THREAD, 1u, maximum_thread_count);
+        
+        SDL_AtomicInt decoded_count = {};
+        std::vector<SBMV2DecodeTask> tasks(thread_count);
+        
+        for (uint32 i = 0; i < thread_count; i++)
+        {
+            SBMV2DecodeTask& task = tasks[i];
+            task.file = &file;
+            task.header = &header;
+            task.entries = (const SBMV2ChunkEntry*)(file.data + sizeof(SBMV2Header));
+            task.chunks = chunks.data();
+            task.begin = (uint32)((uint64)chunk_count * i / thread_count);
+            task.end = (uint32)((uint64)chunk_count * (i + 1) / thread_count);
+            task.tileset_width = tileset_width;
+            task.tileset_height = tileset_height;
+            task.job = job;
+            task.decoded_count = &decoded_count;
+        }
+        
+        std::vector<SDL_Thread*> threads(thread_count, nullptr);
+        for (uint32 i = 1; i < thread_count; i++)
+            threads[i] = SDL_CreateThread(RunSBMV2DecodeTask, "SBMapChunkDecode", &tasks[i]);
+        
+        for (uint32 i = 0; i < thread_count; i++)
+        {
+            if (threads[i])
+                SDL_WaitThread(threads[i], nullptr);
+            else
+                RunSBMV2DecodeTask(&tasks[i]);
+        }
+        
+        for (const SBMV2DecodeTask& task : tasks)
+        {
+            if (task.error_message)
+                return CopySBMError(Error{ task.error_message, task.error_details[0] ? task.error_details : nullptr });
+        }
+        
+        const SBMV2ChunkEntry* entries = (const SBMV2ChunkEntry*)(file.data + sizeof(SBMV2Header));
+        tilemap.chunks.reserve(chunk_count);
+        
+        for (uint32 i = 0; i < chunk_count; i++)
+        {
+            if (!tilemap.chunks.emplace(entries[i].key, std::move(chunks[i])).second)
+                return Error{ "File has invalid data and is likely corrupted." };
+        }
+        
+        return true;
+    }
+    
+    static Result<Tilemap> LoadSBMV2(const MappedFile& file, int32 tileset_width, int32 tileset_height, JobState* job)
+    {
+        auto header_result = ReadSBMV2Header(file);
+        if (!header_result)
+            return header_result.GetError();
+        
+        const SBMV2Header& header = header_result.GetValue();
+        
+        Tilemap tilemap;
+        tilemap.width = header.width;
+        tilemap.height = header.height;
+        
+        auto result = LoadSBMV2Chunks(tilemap, file, header, tileset_width, tileset_height, job);
+        if (!result)
+            return result.GetError();
+        
+        return tilemap;
+    }
+    
+    static Result<Tilemap> LoadSBM(const MappedFile& file, int32 tileset_width, int32 tileset_height, JobState* job)
+    {
+        auto header_result = ReadSBMHeader(file);
+        if (!header_result)
+            return header_result.GetError();
+        
+        const SBMHeader& header = header_result.GetValue();
+        
+        Tilemap tilemap;
+        tilemap.width = header.width;
+        tilemap.height = header.height;
+        
+        const char* sbm_cell_data = file.data + sizeof(SBMHeader);
+        
+        auto result = LoadSBMCells(tilemap, sbm_cell_data, IsCompactSBM(header), tileset_width, tileset_height, job);
+        if (!result)
+            return result.GetError();
+        
+        return tilemap;
+    }
+    
+    static std::string GetSBMJournalPath(const char* filepath)
+    {
+        return std::string(filepath) + SBM_JOURNAL_SUFFIX;
+    }
+    
+    static bool IsSBMJournalOf(const SBMJournalHeader& header, const SDL_PathInfo& base_info)
+    {
+        return
+            SDL_memcmp(header.magic, "SBMJ", 4) == 0 &&
+            header.version == SBM_JOURNAL_VERSION &&
+            header.base_size == base_info.size &&
+            header.base_modify_time == base_info.modify_time;
+    }
+    
+    // The map is resized first, the same as it was when edited
+    static Result<bool> ApplySBMJournalEdit(Tilemap& tilemap, const char* data, size_t size, int32 tileset_width, int32 tileset_height)
+    {
+        if (size < sizeof(SBMJournalEdit))
+            return Error{ "Journal has invalid data and is likely corrupted." };
+        
+        SBMJournalEdit edit;
+        SDL_memcpy(&edit, data, sizeof(SBMJournalEdit));
+        
+        if (edit.width < TILEMAP_MINIMUM_WIDTH || edit.height < TILEMAP_MINIMUM_HEIGHT ||
+            edit.width > TILEMAP_MAXIMUM_WIDTH || edit.height > TILEMAP_MAXIMUM_HEIGHT)
+            return Error{ "Journal has invalid data and is likely corrupted." };
+        
+        ResizeTilemap(tilemap, edit.width, edit.height);
+        
+        int32 chunk_columns = (edit.width + TILEMAP_CHUNK_WIDTH - 1) / TILEMAP_CHUNK_WIDTH;
+        int32 chunk_rows = (edit.height + TILEMAP_CHUNK_HEIGHT - 1) / TILEMAP_CHUNK_HEIGHT;
+        size_t offset = sizeof(SBMJournalEdit);
+        
+        for (uint32 i = 0; i < edit.chunk_count; i++)
+        {
+            if (size - offset < sizeof(SBMJournalChunk))
+                return Error{ "Journal has invalid data and is likely corrupted." };
+            
+            SBMJournalChunk journal_chunk;
+            SDL_memcpy(&journal_chunk, data + offset, sizeof(SBMJournalChunk));
+            offset += sizeof(SBMJournalChunk);
+            
+            int32 chunk_x = (int32)(journal_chunk.key & 0xFFFF);
+            int32 chunk_y = (int32)(journal_chunk.key >> 16);
+            
+            if (chunk_x >= chunk_columns || chunk_y >= chunk_rows)
+                return Error{ "Journal has invalid data and is likely corrupted." };
+            if (journal_chunk.used_count > (uint32)SBM_V2_CHUNK_CELL_COUNT || journal_chunk.size > size - offset)
+                return Error{ "Journal has invalid data and is likely corrupted." };
+            
+            if (journal_chunk.used_count == 0)
+            {
+                tilemap.chunks.erase(journal_chunk.key);
+                continue;
+            }
+            
+            SBMV2ChunkEntry entry;
+            entry.key = journal_chunk.key;
+            entry.used_count = journal_chunk.used_count;
+            entry.offset = offset;
+            entry.size = journal_chunk.size;
+            
+            auto chunk = std::make_shared<Tilemap::Chunk>();
+            
+            auto result = DecodeSBMV2Chunk(data, entry, edit.width, edit.height, tileset_width, tileset_height, *chunk);
+            if (!result)
+                return result.GetError();
+            
+            tilemap.chunks[journal_chunk.key] = std::move(chunk);
+            offset += journal_chunk.size;
+        }
+        
+        return true;
+    }
+    
+    // Stops at the first record that is cut short or fails its checksum
+    static Result<bool> ReplaySBMJournal(Tilemap& tilemap, const char* filepath, const SDL_PathInfo& base_info,
+        int32 tileset_width, int32 tileset_height)
+    {
+        std::string journal_filepath = GetSBMJournalPath(filepath);
+        
+        SDL_PathInfo path_info;
+        if (!SDL_GetPathInfo(journal_filepath.c_str(), &path_info) || path_info.size < sizeof(SBMJournalHeader))
+            return true;
+        
+        auto file_result = MapFile(journal_filepath.c_str());
+        if (!file_result)
+            return file_result.GetError();
+        
+        const MappedFile& file = file_result.GetValue();
+        if (file.size < sizeof(SBMJournalHeader))
+            return true;
+        
+        SBMJournalHeader header;
+        SDL_memcpy(&header, file.data, sizeof(SBMJournalHeader));
+        
+        if (!IsSBMJournalOf(header, base_info))
+            return true;
+        
+        size_t offset = sizeof(SBMJournalHeader);
+        while (file.size - offset >= sizeof(SBMJournalRecord))
+        {
+            SBMJournalRecord record;
+            SDL_memcpy(&record, file.data + offset, sizeof(SBMJournalRecord));
+            offset += sizeof(SBMJournalRecord);
+            
+            if (record.size > file.size - offset)
+                break;
+            if (SDL_crc32(0, file.data + offset, record.size) != record.checksum)
+                break;
+            
+            auto result = ApplySBMJournalEdit(tilemap, file.data + offset, record.size, tileset_width, tileset_height);
+            if (!result)
+                return result.GetError();
+            
+            offset += record.size;
+        }
+        
+        return true;
+    }
+    
+    static void BuildTileUVTable(Tileset& tileset)
+    {
+        const PagedTexture& atlas = tileset.atlas;
+        
+        auto tile_uvs = std::make_shared<std::vector<TileUV>>((size_t)(tileset.width * tileset.height));
+        for (int32 tile_y = 0; tile_y < tileset.height; tile_y++)
+        {
+            int32 pixel_y = tile_y * tileset.tile_height;
+            int32 page_y = SDL_min(pixel_y / atlas.page_stride_y, atlas.page_rows - 1);
+            
+            for (int32 tile_x = 0; tile_x < tileset.width; tile_x++)
+            {
+                int32 pixel_x = tile_x * tileset.tile_width;
+                int32 page_x = SDL_min(pixel_x / atlas.page_stride_x, atlas.page_columns - 1);
+                
+                int32 page = page_x + page_y * atlas.page_columns;
+                float32 page_width = (float32)atlas.pages[(size_t)page].width;
+                float32 page_height = (float32)atlas.pages[(size_t)page].height;
+                
+                TileUV& tile_uv = (*tile_uvs)[(size_t)(tile_x + tile_y * tileset.width)];
+                tile_uv.rect.x = (float32)(pixel_x - page_x * atlas.page_stride_x) / page_width;
+                tile_uv.rect.y = (float32)(pixel_y - page_y * atlas.page_stride_y) / page_height;
+                tile_uv.rect.w = (float32)tileset.tile_width / page_width;
+                tile_uv.rect.h = (float32)tileset.tile_height / page_height;
+                tile_uv.page = page;
+            }
+        }
+        
+        tileset.tile_uvs = std::move(tile_uvs);
+    }
+    
+    Result<Tileset> CreateTileset(const PagedTexture& atlas_texture, int32 tile_width, int32 tile_height)
+    {
+        SDL_assert(IsPagedTextureValid(atlas_texture));
+        
+        if (tile_width < TILE_MINIMUM_WIDTH || tile_height < TILE_MINIMUM_HEIGHT)
+            return Error{ "Tile dimensions are smaller than the minimum allowed." };
+        if (tile_width > TILE_MAXIMUM_WIDTH || tile_height > TILE_MAXIMUM_HEIGHT)
+            return Error{ "Tile dimensions are greater than the maximum allowed." };
         
         int32 tileset_width = atlas_texture.width / tile_width;
         int32 tileset_height = atlas_texture.height / tile_height;
         
-        SDL_assert(tileset_width >= TILESET_MINIMUM_WIDTH);
-        SDL_assert(tileset_width <= TILESET_MAXIMUM_WIDTH);
-        SDL_assert(tileset_height >= TILESET_MINIMUM_HEIGHT);
-        SDL_assert(tileset_height <= TILESET_MAXIMUM_HEIGHT);
+        if (tileset_width < TILESET_MINIMUM_WIDTH || tileset_height < TILESET_MINIMUM_HEIGHT)
+            return Error{ "Atlas is smaller than a single tile." };
+        if (tileset_width > TILESET_MAXIMUM_WIDTH || tileset_height > TILESET_MAXIMUM_HEIGHT)
+            return Error{ "Atlas holds more tiles than the maximum allowed." };
         
         Tileset tileset;
         tileset.atlas = atlas_texture;
@@ -51,14 +680,37 @@ namespace SBMap
         tileset.width = tileset_width;
         tileset.height = tileset_height;
         
+        BuildTileUVTable(tileset);
+        
         return tileset;
     }
     
-    Result<Tilemap> LoadTilemapFromDisk(const Tileset& tileset, const char* filepath)
+    void ResizeTileset(Tileset& tileset, int32 tile_width, int32 tile_height)
+    {
+        SDL_assert(tile_width >= TILE_MINIMUM_WIDTH);
+        SDL_assert(tile_width <= TILE_MAXIMUM_WIDTH);
+        SDL_assert(tile_height >= TILE_MINIMUM_HEIGHT);
+        SDL_assert(tile_height <= TILE_MAXIMUM_HEIGHT);
+        
+        if (tileset.tile_width == tile_width && tileset.tile_height == tile_height && tileset.tile_uvs)
+            return;
+        
+        tileset.tile_width = tile_width;
+        tileset.tile_height = tile_height;
+        tileset.width = tileset.atlas.width / tile_width;
+        tileset.height = tileset.atlas.height / tile_height;
+        
+        if (IsPagedTextureValid(tileset.atlas))
+            BuildTileUVTable(tileset);
+        else
+            tileset.tile_uvs.reset();
+    }
+    
+    Result<Tilemap> LoadTilemapFromDisk(const char* filepath, int32 tileset_width, int32 tileset_height, JobState* job, TilemapFileVersion* version)
     {
         SDL_assert(filepath != nullptr);
         
-        if (!IsTilesetValid(tileset))
+        if (tileset_width < TILESET_MINIMUM_WIDTH || tileset_height < TILESET_MINIMUM_HEIGHT)
             return Error{ "Tileset is invalid." };
         
         SDL_PathInfo path_info;
@@ -67,97 +719,448 @@ namespace SBMap
         if (path_info.type != SDL_PATHTYPE_FILE)
             return Error{ "Path exists but is not a file." };
         
-        size_t file_size;
-        auto file_data = MakeScope((char*)SDL_LoadFile(filepath, &file_size), SDL_free);
-        if (!file_data)
-            return Error{ "Could not load file.", SDL_GetError() };
+        auto file_result = MapFile(filepath);
+        if (!file_result)
+            return file_result.GetError();
         
-        if (file_size < SBM_MINIMUM_SIZE)
-            return Error{ "File is too small." };
+        const MappedFile& file = file_result.GetValue();
         
-        SBMHeader header;
-        SDL_memcpy(&header, file_data.Get(), sizeof(SBMHeader));
-        if (SDL_memcmp(header.magic, "SBMP", 4) != 0)
-            return Error{ "File has unsupported format." };
+        bool versioned = IsVersionedSBM(file);
+        auto result = versioned ?
+            LoadSBMV2(file, tileset_width, tileset_height, job) :
+            LoadSBM(file, tileset_width, tileset_height, job);
+        if (!result)
+            return result.GetError();
         
-        if (header.width < TILEMAP_MINIMUM_WIDTH || header.height < TILEMAP_MINIMUM_HEIGHT)
-            return Error{ "Tilemap dimensions are smaller than the minimum allowed." };
-        if (header.width > TILEMAP_MAXIMUM_WIDTH || header.height > TILEMAP_MAXIMUM_HEIGHT)
-            return Error{ "Tilemap dimensions are greater than the maximum allowed." };
+        auto journal_result = ReplaySBMJournal(result.GetValue(), filepath, path_info, tileset_width, tileset_height);
+        if (!journal_result)
+            return journal_result.GetError();
+        
+        // LoadSBM already checked the header
+        if (version && versioned)
+            *version = TilemapFileVersion::V2;
+        else if (version)
+        {
+            SBMHeader header;
+            SDL_memcpy(&header, file.data, sizeof(SBMHeader));
+            *version = IsCompactSBM(header) ? TilemapFileVersion::V1Compact : TilemapFileVersion::V1;
+        }
         
-        size_t sbm_cell_array_count = (size_t)(header.width * header.height);
-        size_t sbm_cell_array_size = sbm_cell_array_count * sizeof(SBMCell);
-        size_t real_sbm_cell_array_size = file_size - sizeof(SBMHeader);
+        return std::move(result.GetValue());
+    }
+    
+    Result<TilemapFileInfo> InspectTilemapFile(const char* filepath)
+    {
+        SDL_assert(filepath != nullptr);
         
-        if (sbm_cell_array_size != real_sbm_cell_array_size)
-            return Error{ "File has invalid data and is likely corrupted." };
+        auto file_result = MapFile(filepath);
+        if (!file_result)
+            return file_result.GetError();
         
-        SBMCell* sbm_cell_array = (SBMCell*)(file_data.Get() + sizeof(SBMHeader));
-        std::vector<Tilemap::Cell> tilemap_cells(sbm_cell_array_count);
+        const MappedFile& file = file_result.GetValue();
         
-        for (size_t i = 0; i < sbm_cell_array_count; i++)
+        if (IsVersionedSBM(file))
         {
-            Tilemap::Cell& tilemap_cell = tilemap_cells[i];
+            auto v2_header_result = ReadSBMV2Header(file);
+            if (!v2_header_result)
+                return v2_header_result.GetError();
+            
+            const SBMV2Header& v2_header = v2_header_result.GetValue();
+            const SBMV2ChunkEntry* entries = (const SBMV2ChunkEntry*)(file.data + sizeof(SBMV2Header));
             
-            SBMCell& sbm_cell = sbm_cell_array[i];
-            if ((sbm_cell.tile_x != -1 || sbm_cell.tile_y != -1) &&
-                !IsInTilesetBounds(tileset, sbm_cell.tile_x, sbm_cell.tile_y))
-                return Error{ "Tile out of tileset bounds." };
+            TilemapFileInfo info;
+            info.version = TilemapFileVersion::V2;
+            info.width = v2_header.width;
+            info.height = v2_header.height;
+            info.compact = true;
             
-            tilemap_cell.tile_x = sbm_cell.tile_x;
-            tilemap_cell.tile_y = sbm_cell.tile_y;
-            tilemap_cell.flags = sbm_cell.flags;
+            for (uint32 i = 0; i < v2_header.chunk_count; i++)
+                info.used_cell_count += entries[i].used_count;
+            
+            return info;
         }
         
-        Tilemap tilemap;
-        tilemap.tileset = tileset;
-        tilemap.cells = std::move(tilemap_cells);
-        tilemap.width = header.width;
-        tilemap.height = header.height;
+        auto header_result = ReadSBMHeader(file);
+        if (!header_result)
+            return header_result.GetError();
         
-        return tilemap;
+        const SBMHeader& header = header_result.GetValue();
+        
+        TilemapFileInfo info;
+        info.version = IsCompactSBM(header) ? TilemapFileVersion::V1Compact : TilemapFileVersion::V1;
+        info.width = header.width;
+        info.height = header.height;
+        info.compact = IsCompactSBM(header);
+        
+        size_t sbm_cell_array_count = (size_t)header.width * (size_t)header.height;
+        const char* sbm_cell_data = file.data + sizeof(SBMHeader);
+        
+        // Tiles are not checked against any tileset, only against the packing
+        constexpr int32 tile_limit = (int32)TILEMAP_CELL_TILE_LIMIT;
+        
+        for (size_t begin = 0; begin < sbm_cell_array_count; begin += CELL_SCAN_MAXIMUM_COUNT)
+        {
+            int32 count = (int32)SDL_min(sbm_cell_array_count - begin, (size_t)CELL_SCAN_MAXIMUM_COUNT);
+            
+            Tilemap::Cell packed_cells[CELL_SCAN_MAXIMUM_COUNT];
+            const Tilemap::Cell* cells = packed_cells;
+            
+            if (info.compact)
+                cells = (const Tilemap::Cell*)((const SBMCompactCell*)sbm_cell_data + begin);
+            else
+                PackSBMCells((const SBMCell*)sbm_cell_data + begin, packed_cells, count);
+            
+            Tilemap::Cell tiles[CELL_SCAN_MAXIMUM_COUNT];
+            CellScan scan = ScanCells(cells, tiles, count, tile_limit, tile_limit);
+            
+            if (scan.invalid_mask != 0)
+            {
+                size_t cell_index = begin + (size_t)std::countr_zero(scan.invalid_mask);
+                int32 cell_x = (int32)(cell_index % (size_t)header.width);
+                int32 cell_y = (int32)(cell_index / (size_t)header.width);
+                
+                return GetSBMCellError("File has invalid data and is likely corrupted.", cell_x, cell_y, header.width);
+            }
+            
+            info.used_cell_count += std::popcount(scan.used_mask);
+        }
+        
+        return info;
     }
     
-    Result<bool> SaveTilemapToDisk(const Tilemap& tilemap, const char* filepath)
+    // Legacy files get the packed cells spread out into a second buffer
+    static bool WriteSBMBlock(SDL_IOStream* stream, const SBMCompactCell* cells, size_t count, std::vector<SBMCell>* sbm_cells)
     {
-        SDL_assert(filepath != nullptr);
+        if (!sbm_cells)
+        {
+            size_t size = count * sizeof(SBMCompactCell);
+            return SDL_WriteIO(stream, cells, size) == size;
+        }
         
-        if (!IsTilemapValid(tilemap))
-            return Error{ "Tilemap is incomplete and cannot be saved." };
+        for (size_t i = 0; i < count; i++)
+        {
+            Tilemap::Cell cell = { cells[i].bits };
+            
+            SBMCell& sbm_cell = (*sbm_cells)[i];
+            sbm_cell.tile_x = GetCellTileX(cell);
+            sbm_cell.tile_y = GetCellTileY(cell);
+            sbm_cell.flags = GetCellFlags(cell);
+        }
         
-        size_t sbm_cell_array_count = tilemap.cells.size();
-        size_t sbm_cell_array_size = sbm_cell_array_count * sizeof(SBMCell);
+        size_t size = count * sizeof(SBMCell);
+        return SDL_WriteIO(stream, sbm_cells->data(), size) == size;
+    }
+    
+    static Result<bool> WriteSBMStream(const Tilemap& tilemap, SDL_IOStream* stream, bool compact, JobState* job)
+    {
+        SBMHeader header;
+        SDL_memcpy(header.magic, compact ? "SBMC" : "SBMP", 4);
+        header.width = tilemap.width;
+        header.height = tilemap.height;
         
-        size_t buffer_size = sizeof(SBMHeader) + sbm_cell_array_size;
-        std::vector<char> buffer(buffer_size);
+        if (SDL_WriteIO(stream, &header, sizeof(SBMHeader)) != sizeof(SBMHeader))
+            return Error{ "Could not write to file.", SDL_GetError() };
         
-        SBMHeader header;
-        SDL_memcpy(header.magic, "SBMP", 4);
+        std::vector<SBMCompactCell> block(SBM_WRITE_BLOCK_CELL_COUNT);
+        size_t block_count = 0;
+        
+        std::vector<SBMCell> sbm_block(compact ? 0 : SBM_WRITE_BLOCK_CELL_COUNT);
+        std::vector<SBMCell>* sbm_cells = compact ? nullptr : &sbm_block;
+        
+        for (int32 y = 0; y < tilemap.height; y++)
+        {
+            if (!UpdateTilemapJob(job, y, tilemap.height))
+                return Error{ "Saving was cancelled." };
+            
+            for (int32 begin_x = 0; begin_x < tilemap.width; begin_x += TILEMAP_CHUNK_WIDTH)
+            {
+                if (block_count + TILEMAP_CHUNK_WIDTH > block.size())
+                {
+                    if (!WriteSBMBlock(stream, block.data(), block_count, sbm_cells))
+                        return Error{ "Could not write to file.", SDL_GetError() };
+                    
+                    block_count = 0;
+                }
+                
+                int32 end_x = SDL_min(begin_x + TILEMAP_CHUNK_WIDTH, tilemap.width);
+                size_t span_count = (size_t)(end_x - begin_x);
+                SBMCompactCell* sbm_cell_span = block.data() + block_count;
+                block_count += span_count;
+                
+                const Tilemap::Chunk* chunk = FindTilemapChunk(tilemap, begin_x / TILEMAP_CHUNK_WIDTH, y / TILEMAP_CHUNK_HEIGHT);
+                if (!chunk)
+                {
+                    SDL_memset(sbm_cell_span, 0, span_count * sizeof(SBMCompactCell));
+                    continue;
+                }
+                
+                const Tilemap::Cell* chunk_row = chunk->cells + GetChunkCellIndex(begin_x, y);
+                SDL_memcpy(sbm_cell_span, chunk_row, span_count * sizeof(SBMCompactCell));
+                
+                for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                {
+                    uint32 plane_row = chunk->flag_planes[plane][y % TILEMAP_CHUNK_HEIGHT];
+                    for (size_t i = 0; i < span_count; i++)
+                        sbm_cell_span[i].bits |= ((plane_row >> i) & 1) << plane;
+                }
+            }
+        }
+        
+        if (!WriteSBMBlock(stream, block.data(), block_count, sbm_cells))
+            return Error{ "Could not write to file.", SDL_GetError() };
+        if (!SDL_FlushIO(stream))
+            return Error{ "Could not write to file.", SDL_GetError() };
+        
+        return true;
+    }
+    
+    static size_t EncodeSBMV2Chunk(const Tilemap::Chunk& chunk, uint8* output)
+    {
+        uint32 values[SBM_V2_CHUNK_CELL_COUNT];
+        
+        for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+        {
+            for (int32 column = 0; column < TILEMAP_CHUNK_WIDTH; column++)
+            {
+                uint32 flags = 0;
+                for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                    flags |= ((chunk.flag_planes[plane][row] >> column) & 1) << plane;
+                
+                int32 index = column + row * TILEMAP_CHUNK_WIDTH;
+                values[index] = chunk.cells[index].bits | flags;
+            }
+        }
+        
+        return EncodeRunLength(values, SBM_V2_CHUNK_CELL_COUNT, output);
+    }
+    
+    // The directory is written as a placeholder and filled in at the end
+    static Result<bool> WriteSBMV2Stream(const Tilemap& tilemap, SDL_IOStream* stream, JobState* job)
+    {
+        std::vector<uint32> keys;
+        keys.reserve(tilemap.chunks.size());
+        
+        for (const auto& [key, chunk] : tilemap.chunks)
+            keys.push_back(key);
+        
+        std::sort(keys.begin(), keys.end());
+        
+        SBMV2Header header;
+        SDL_memcpy(header.magic, "SBMV", 4);
+        header.version = (uint32)TilemapFileVersion::V2;
         header.width = tilemap.width;
         header.height = tilemap.height;
+        header.chunk_count = (uint32)keys.size();
+        
+        std::vector<SBMV2ChunkEntry> entries(keys.size());
+        size_t directory_size = entries.size() * sizeof(SBMV2ChunkEntry);
         
-        SDL_memcpy(buffer.data(), &header, sizeof(SBMHeader));
+        if (SDL_WriteIO(stream, &header, sizeof(SBMV2Header)) != sizeof(SBMV2Header))
+            return Error{ "Could not write to file.", SDL_GetError() };
+        if (SDL_WriteIO(stream, entries.data(), directory_size) != directory_size)
+            return Error{ "Could not write to file.", SDL_GetError() };
         
-        SBMCell* sbm_cell_array = (SBMCell*)(buffer.data() + sizeof(SBMHeader));
-        for (size_t i = 0; i < sbm_cell_array_count; i++)
+        std::vector<uint8> encoded(GetRunLengthMaximumSize(SBM_V2_CHUNK_CELL_COUNT));
+        uint64 offset = sizeof(SBMV2Header) + directory_size;
+        
+        for (size_t i = 0; i < keys.size(); i++)
         {
-            const Tilemap::Cell& tilemap_cell = tilemap.cells[i];
-            SBMCell& sbm_cell = sbm_cell_array[i];
+            if (!UpdateTilemapJob(job, (int32)i, (int32)keys.size()))
+                return Error{ "Saving was cancelled." };
+            
+            const Tilemap::Chunk& chunk = *tilemap.chunks.at(keys[i]);
             
-            sbm_cell.tile_x = tilemap_cell.tile_x;
-            sbm_cell.tile_y = tilemap_cell.tile_y;
-            sbm_cell.flags = tilemap_cell.flags;
+            size_t encoded_size = EncodeSBMV2Chunk(chunk, encoded.data());
+            if (SDL_WriteIO(stream, encoded.data(), encoded_size) != encoded_size)
+                return Error{ "Could not write to file.", SDL_GetError() };
+            
+            SBMV2ChunkEntry& entry = entries[i];
+            entry.key = keys[i];
+            entry.used_count = (uint32)chunk.used_count;
+            entry.offset = offset;
+            entry.size = (uint32)encoded_size;
+            
+            offset += encoded_size;
         }
         
-        if (!SDL_SaveFile(filepath, buffer.data(), buffer_size))
+        if (SDL_SeekIO(stream, (int64)sizeof(SBMV2Header), SDL_IO_SEEK_SET) < 0)
+            return Error{ "Could not write to file.", SDL_GetError() };
+        if (SDL_WriteIO(stream, entries.data(), directory_size) != directory_size)
+            return Error{ "Could not write to file.", SDL_GetError() };
+        if (!SDL_FlushIO(stream))
             return Error{ "Could not write to file.", SDL_GetError() };
         
         return true;
     }
     
+    // Written to a temporary file that is renamed over the target once complete
+    Result<bool> SaveTilemapToDisk(const Tilemap& tilemap, const char* filepath, TilemapFileVersion version, JobState* job)
+    {
+        SDL_assert(filepath != nullptr);
+        
+        if (tilemap.width < TILEMAP_MINIMUM_WIDTH || tilemap.height < TILEMAP_MINIMUM_HEIGHT)
+            return Error{ "Tilemap is incomplete and cannot be saved." };
+        
+        std::string temp_filepath = std::string(filepath) + SBM_TEMP_SUFFIX;
+        
+        SDL_IOStream* stream = SDL_IOFromFile(temp_filepath.c_str(), "wb");
+        if (!stream)
+            return Error{ "Could not create file.", SDL_GetError() };
+        
+        auto result = version == TilemapFileVersion::V2 ?
+            WriteSBMV2Stream(tilemap, stream, job) :
+            WriteSBMStream(tilemap, stream, version == TilemapFileVersion::V1Compact, job);
+        if (!result)
+        {
+            SDL_CloseIO(stream);
+            SDL_RemovePath(temp_filepath.c_str());
+            return result.GetError();
+        }
+        
+        if (!SyncFileStream(stream))
+        {
+            Error error = { "Could not write to file.", SDL_GetError() };
+            SDL_CloseIO(stream);
+            SDL_RemovePath(temp_filepath.c_str());
+            return error;
+        }
+        
+        if (!SDL_CloseIO(stream))
+        {
+            Error error = { "Could not write to file.", SDL_GetError() };
+            SDL_RemovePath(temp_filepath.c_str());
+            return error;
+        }
+        
+        if (!SDL_RenamePath(temp_filepath.c_str(), filepath))
+        {
+            Error error = { "Could not replace file.", SDL_GetError() };
+            SDL_RemovePath(temp_filepath.c_str());
+            return error;
+        }
+        
+        // A journal that outlives this no longer matches the file and is ignored on load
+        SDL_RemovePath(GetSBMJournalPath(filepath).c_str());
+        
+        return true;
+    }
+    
+    // Written in one go, so an interrupted append leaves at most a partial last record
+    static std::vector<char> BuildSBMJournalRecord(const Tilemap& tilemap, const uint32* chunk_keys, size_t chunk_key_count)
+    {
+        std::vector<char> record(sizeof(SBMJournalRecord) + sizeof(SBMJournalEdit));
+        
+        SBMJournalEdit edit;
+        edit.width = tilemap.width;
+        edit.height = tilemap.height;
+        
+        int32 chunk_columns = (tilemap.width + TILEMAP_CHUNK_WIDTH - 1) / TILEMAP_CHUNK_WIDTH;
+        int32 chunk_rows = (tilemap.height + TILEMAP_CHUNK_HEIGHT - 1) / TILEMAP_CHUNK_HEIGHT;
+        
+        for (size_t i = 0; i < chunk_key_count; i++)
+        {
+            int32 chunk_x = (int32)(chunk_keys[i] & 0xFFFF);
+            int32 chunk_y = (int32)(chunk_keys[i] >> 16);
+            
+            if (chunk_x >= chunk_columns || chunk_y >= chunk_rows)
+                continue;
+            
+            const Tilemap::Chunk* chunk = FindTilemapChunk(tilemap, chunk_x, chunk_y);
+            size_t begin = record.size();
+            
+            SBMJournalChunk journal_chunk;
+            journal_chunk.key = chunk_keys[i];
+            
+            if (chunk)
+            {
+                record.resize(begin + sizeof(SBMJournalChunk) + GetRunLengthMaximumSize(SBM_V2_CHUNK_CELL_COUNT));
+                journal_chunk.used_count = (uint32)chunk->used_count;
+                journal_chunk.size = (uint32)EncodeSBMV2Chunk(*chunk, (uint8*)record.data() + begin + sizeof(SBMJournalChunk));
+            }
+            
+            record.resize(begin + sizeof(SBMJournalChunk) + journal_chunk.size);
+            SDL_memcpy(record.data() + begin, &journal_chunk, sizeof(SBMJournalChunk));
+            edit.chunk_count++;
+        }
+        
+        SDL_memcpy(record.data() + sizeof(SBMJournalRecord), &edit, sizeof(SBMJournalEdit));
+        
+        SBMJournalRecord header;
+        header.size = (uint32)(record.size() - sizeof(SBMJournalRecord));
+        header.checksum = SDL_crc32(0, record.data() + sizeof(SBMJournalRecord), header.size);
+        SDL_memcpy(record.data(), &header, sizeof(SBMJournalRecord));
+        
+        return record;
+    }
+    
+    static SDL_IOStream* OpenSBMJournal(const char* journal_filepath, const SDL_PathInfo& base_info)
+    {
+        SDL_IOStream* stream = SDL_IOFromFile(journal_filepath, "r+b");
+        if (stream)
+        {
+            SBMJournalHeader header;
+            if (SDL_ReadIO(stream, &header, sizeof(SBMJournalHeader)) == sizeof(SBMJournalHeader) &&
+                IsSBMJournalOf(header, base_info) && SDL_SeekIO(stream, 0, SDL_IO_SEEK_END) >= 0)
+                return stream;
+            
+            SDL_CloseIO(stream);
+        }
+        
+        stream = SDL_IOFromFile(journal_filepath, "wb");
+        if (!stream)
+            return nullptr;
+        
+        SBMJournalHeader header;
+        SDL_memcpy(header.magic, "SBMJ", 4);
+        header.version = SBM_JOURNAL_VERSION;
+        header.base_size = base_info.size;
+        header.base_modify_time = base_info.modify_time;
+        
+        if (SDL_WriteIO(stream, &header, sizeof(SBMJournalHeader)) != sizeof(SBMJournalHeader))
+        {
+            SDL_CloseIO(stream);
+            return nullptr;
+        }
+        
+        return stream;
+    }
+    
+    Result<int64> AppendTilemapJournal(const Tilemap& tilemap, const char* filepath, const uint32* chunk_keys, size_t chunk_key_count)
+    {
+        SDL_assert(filepath != nullptr);
+        
+        if (tilemap.width < TILEMAP_MINIMUM_WIDTH || tilemap.height < TILEMAP_MINIMUM_HEIGHT)
+            return Error{ "Tilemap is incomplete and cannot be saved." };
+        
+        SDL_PathInfo base_info;
+        if (!SDL_GetPathInfo(filepath, &base_info) || base_info.type != SDL_PATHTYPE_FILE)
+            return Error{ "Tilemap file does not exist." };
+        
+        std::vector<char> record = BuildSBMJournalRecord(tilemap, chunk_keys, chunk_key_count);
+        std::string journal_filepath = GetSBMJournalPath(filepath);
+        
+        SDL_IOStream* stream = OpenSBMJournal(journal_filepath.c_str(), base_info);
+        if (!stream)
+            return Error{ "Could not open journal file.", SDL_GetError() };
+        
+        if (SDL_WriteIO(stream, record.data(), record.size()) != record.size())
+        {
+            Error error = { "Could not write to journal file.", SDL_GetError() };
+            SDL_CloseIO(stream);
+            return error;
+        }
+        
+        int64 journal_size = SDL_TellIO(stream);
+        
+        if (!SDL_CloseIO(stream))
+            return Error{ "Could not write to journal file.", SDL_GetError() };
+        
+        return journal_size;
+    }
+    
     bool IsTilesetValid(const Tileset& tileset)
     {
-        if (!IsTextureValid(tileset.atlas))
+        if (!IsPagedTextureValid(tileset.atlas))
             return false;
         
         SDL_assert(tileset.tile_width >= TILE_MINIMUM_WIDTH);
@@ -169,6 +1172,7 @@ namespace SBMap
         SDL_assert(tileset.width <= TILESET_MAXIMUM_WIDTH);
         SDL_assert(tileset.height >= TILESET_MINIMUM_HEIGHT);
         SDL_assert(tileset.height <= TILESET_MAXIMUM_HEIGHT);
+        SDL_assert(tileset.tile_uvs && tileset.tile_uvs->size() == (size_t)(tileset.width * tileset.height));
         
         return true;
     }
@@ -182,7 +1186,6 @@ namespace SBMap
         SDL_assert(tilemap.width <= TILEMAP_MAXIMUM_WIDTH);
         SDL_assert(tilemap.height >= TILEMAP_MINIMUM_HEIGHT);
         SDL_assert(tilemap.height <= TILEMAP_MAXIMUM_HEIGHT);
-        SDL_assert(tilemap.cells.size() == (size_t)(tilemap.width * tilemap.height));
         
         return true;
     }
@@ -207,10 +1210,275 @@ namespace SBMap
         return cell_x < tilemap.width && cell_y < tilemap.height;
     }
     
-    Tilemap::Cell& GetTilemapCell(Tilemap& tilemap, int32 cell_x, int32 cell_y)
+    const TileUV& GetTileUV(const Tileset& tileset, int32 tile_x, int32 tile_y)
+    {
+        SDL_assert(IsInTilesetBounds(tileset, tile_x, tile_y));
+        size_t tile_index = (size_t)(tile_x + tile_y * tileset.width);
+        return (*tileset.tile_uvs)[tile_index];
+    }
+    
+    bool IsCellRangeEmpty(const CellRange& range)
+    {
+        return range.begin_x >= range.end_x || range.begin_y >= range.end_y;
+    }
+    
+    CellRange IntersectCellRange(const CellRange& range1, const CellRange& range2)
+    {
+        CellRange range;
+        range.begin_x = SDL_max(range1.begin_x, range2.begin_x);
+        range.begin_y = SDL_max(range1.begin_y, range2.begin_y);
+        range.end_x = SDL_max(SDL_min(range1.end_x, range2.end_x), range.begin_x);
+        range.end_y = SDL_max(SDL_min(range1.end_y, range2.end_y), range.begin_y);
+        
+        return range;
+    }
+    
+    CellRange UniteCellRange(const CellRange& range1, const CellRange& range2)
+    {
+        if (IsCellRangeEmpty(range1))
+            return range2;
+        if (IsCellRangeEmpty(range2))
+            return range1;
+        
+        CellRange range;
+        range.begin_x = SDL_min(range1.begin_x, range2.begin_x);
+        range.begin_y = SDL_min(range1.begin_y, range2.begin_y);
+        range.end_x = SDL_max(range1.end_x, range2.end_x);
+        range.end_y = SDL_max(range1.end_y, range2.end_y);
+        
+        return range;
+    }
+    
+    void ResizeTilemap(Tilemap& tilemap, int32 width, int32 height)
+    {
+        SDL_assert(width >= TILEMAP_MINIMUM_WIDTH && width <= TILEMAP_MAXIMUM_WIDTH);
+        SDL_assert(height >= TILEMAP_MINIMUM_HEIGHT && height <= TILEMAP_MAXIMUM_HEIGHT);
+        
+        // Cells outside the new bounds are cleared so they do not come back on growing
+        for (auto it = tilemap.chunks.begin(); it != tilemap.chunks.end();)
+        {
+            int32 begin_x = (int32)(it->first & 0xFFFF) * TILEMAP_CHUNK_WIDTH;
+            int32 begin_y = (int32)(it->first >> 16) * TILEMAP_CHUNK_HEIGHT;
+            
+            if (begin_x >= width || begin_y >= height)
+            {
+                it = tilemap.chunks.erase(it);
+                continue;
+            }
+            
+            if (begin_x + TILEMAP_CHUNK_WIDTH <= width && begin_y + TILEMAP_CHUNK_HEIGHT <= height)
+            {
+                ++it;
+                continue;
+            }
+            
+            Tilemap::Chunk& chunk = UnshareTilemapChunk(it->second);
+            
+            int32 kept_columns = SDL_min(width - begin_x, TILEMAP_CHUNK_WIDTH);
+            uint32 kept_mask = kept_columns == TILEMAP_CHUNK_WIDTH ? 0xFFFFFFFF : (1u << kept_columns) - 1;
+            
+            for (int32 y = begin_y; y < begin_y + TILEMAP_CHUNK_HEIGHT; y++)
+            {
+                uint32 row_mask = y < height ? kept_mask : 0;
+                for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                    chunk.flag_planes[plane][y - begin_y] &= row_mask;
+                
+                chunk.tile_plane[y - begin_y] &= row_mask;
+                
+                for (int32 x = begin_x; x < begin_x + TILEMAP_CHUNK_WIDTH; x++)
+                {
+                    if (x >= width || y >= height)
+                        chunk.cells[GetChunkCellIndex(x, y)] = {};
+                }
+            }
+            
+            RecountTilemapChunk(chunk);
+            
+            if (chunk.used_count == 0)
+                it = tilemap.chunks.erase(it);
+            else
+                ++it;
+        }
+        
+        tilemap.width = width;
+        tilemap.height = height;
+    }
+    
+    // The copy shares its chunks with the source and leaves out the tileset
+    Tilemap CopyTilemapCells(const Tilemap& tilemap)
+    {
+        Tilemap copy;
+        copy.width = tilemap.width;
+        copy.height = tilemap.height;
+        copy.chunks = tilemap.chunks;
+        
+        return copy;
+    }
+    
+    Tilemap::Cell GetTilemapCell(const Tilemap& tilemap, int32 cell_x, int32 cell_y)
+    {
+        SDL_assert(IsInTilemapBounds(tilemap, cell_x, cell_y));
+        
+        const Tilemap::Chunk* chunk = FindTilemapChunk(tilemap, cell_x / TILEMAP_CHUNK_WIDTH, cell_y / TILEMAP_CHUNK_HEIGHT);
+        if (!chunk)
+            return {};
+        
+        Tilemap::Cell cell = chunk->cells[GetChunkCellIndex(cell_x, cell_y)];
+        cell.bits |= GetChunkCellFlags(*chunk, cell_x, cell_y);
+        
+        return cell;
+    }
+    
+    void SetTilemapCell(Tilemap& tilemap, int32 cell_x, int32 cell_y, const Tilemap::Cell& value)
     {
         SDL_assert(IsInTilemapBounds(tilemap, cell_x, cell_y));
-        size_t cell_index = (size_t)(cell_x + cell_y * tilemap.width);
-        return tilemap.cells[cell_index];
+        SDL_assert(IsCellValid(value));
+        
+        // Bits without a place in the chunk would leave the used count wrong
+        if (!IsCellValid(value))
+            return;
+        
+        int32 chunk_x = cell_x / TILEMAP_CHUNK_WIDTH;
+        int32 chunk_y = cell_y / TILEMAP_CHUNK_HEIGHT;
+        
+        bool value_empty = IsCellEmpty(value);
+        if (value_empty && !FindTilemapChunk(tilemap, chunk_x, chunk_y))
+            return;
+        
+        Tilemap::Chunk& chunk = AcquireTilemapChunk(tilemap, chunk_x, chunk_y);
+        Tilemap::Cell& cell = chunk.cells[GetChunkCellIndex(cell_x, cell_y)];
+        
+        int32 row = cell_y % TILEMAP_CHUNK_HEIGHT;
+        uint32 column_bit = 1u << (cell_x % TILEMAP_CHUNK_WIDTH);
+        
+        bool cell_empty = !HasCellTile(cell) && GetChunkCellFlags(chunk, cell_x, cell_y) == 0;
+        chunk.used_count += (cell_empty ? 0 : -1) + (value_empty ? 0 : 1);
+        
+        cell.bits = value.bits & ~TILEMAP_CELL_FLAGS_MASK;
+        
+        if (HasCellTile(value))
+            chunk.tile_plane[row] |= column_bit;
+        else
+            chunk.tile_plane[row] &= ~column_bit;
+        
+        uint32 flags = GetCellFlags(value);
+        
+        for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+        {
+            if (flags & (1u << plane))
+                chunk.flag_planes[plane][row] |= column_bit;
+            else
+                chunk.flag_planes[plane][row] &= ~column_bit;
+        }
+        
+        if (chunk.used_count == 0)
+            tilemap.chunks.erase(GetTilemapChunkKey(chunk_x, chunk_y));
+    }
+    
+    uint32 GetTilemapChunkKey(int32 chunk_x, int32 chunk_y)
+    {
+        SDL_assert(chunk_x >= 0 && chunk_x < 0x10000);
+        SDL_assert(chunk_y >= 0 && chunk_y < 0x10000);
+        return (uint32)chunk_x | ((uint32)chunk_y << 16);
+    }
+    
+    const Tilemap::Chunk* FindTilemapChunk(const Tilemap& tilemap, int32 chunk_x, int32 chunk_y)
+    {
+        auto it = tilemap.chunks.find(GetTilemapChunkKey(chunk_x, chunk_y));
+        if (it == tilemap.chunks.end())
+            return nullptr;
+        
+        return it->second.get();
+    }
+    
+    Tilemap::Chunk* FindTilemapChunk(Tilemap& tilemap, int32 chunk_x, int32 chunk_y)
+    {
+        auto it = tilemap.chunks.find(GetTilemapChunkKey(chunk_x, chunk_y));
+        if (it == tilemap.chunks.end())
+            return nullptr;
+        
+        return &UnshareTilemapChunk(it->second);
+    }
+    
+    Tilemap::Chunk& AcquireTilemapChunk(Tilemap& tilemap, int32 chunk_x, int32 chunk_y)
+    {
+        std::shared_ptr<Tilemap::Chunk>& chunk = tilemap.chunks[GetTilemapChunkKey(chunk_x, chunk_y)];
+        if (!chunk)
+        {
+            chunk = std::make_shared<Tilemap::Chunk>();
+            return *chunk;
+        }
+        
+        return UnshareTilemapChunk(chunk);
+    }
+    
+    // Copies drop their references on other threads, the fence orders their reads before any write
+    Tilemap::Chunk& UnshareTilemapChunk(std::shared_ptr<Tilemap::Chunk>& chunk)
+    {
+        SDL_assert(chunk != nullptr);
+        
+        if (chunk.use_count() > 1)
+            chunk = std::make_shared<Tilemap::Chunk>(*chunk);
+        else
+            std::atomic_thread_fence(std::memory_order_acquire);
+        
+        return *chunk;
+    }
+    
+    // The caller releases the chunk if it ends up empty
+    void RecountTilemapChunk(Tilemap::Chunk& chunk)
+    {
+        int32 used_count = 0;
+        for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+        {
+            uint32 used_mask = chunk.tile_plane[row];
+            for (int32 plane = 0; plane < TILEMAP_FLAG_PLANE_COUNT; plane++)
+                used_mask |= chunk.flag_planes[plane][row];
+            
+            used_count += std::popcount(used_mask);
+        }
+        
+        chunk.used_count = used_count;
+    }
+    
+    Tilemap::Cell GetTilemapChunkCell(const Tilemap::Chunk& chunk, int32 column, int32 row)
+    {
+        SDL_assert(column >= 0 && column < TILEMAP_CHUNK_WIDTH && row >= 0 && row < TILEMAP_CHUNK_HEIGHT);
+        
+        Tilemap::Cell cell = chunk.cells[GetChunkCellIndex(column, row)];
+        cell.bits |= GetChunkCellFlags(chunk, column, row);
+        
+        return cell;
+    }
+    
+    uint32 MatchTilemapChunkRow(const Tilemap::Chunk& chunk, int32 row, uint32 tile_bits)
+    {
+        const Tilemap::Cell* cells = chunk.cells + row * TILEMAP_CHUNK_WIDTH;
+        uint32 match = 0;
+    
+    #ifdef SDL_SSE2_INTRINSICS
+        __m128i target = _mm_set1_epi32((int32)tile_bits);
+        for (int32 column = 0; column < TILEMAP_CHUNK_WIDTH; column += 4)
+        {
+            __m128i cell_bits = _mm_loadu_si128((const __m128i*)(cells + column));
+            int32 column_match = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(cell_bits, target)));
+            match |= (uint32)column_match << column;
+        }
+    #else
+        for (int32 column = 0; column < TILEMAP_CHUNK_WIDTH; column++)
+            match |= (uint32)(cells[column].bits == tile_bits) << column;
+    #endif
+        
+        return match;
+    }
+    
+    int32 GetTileFlagPlane(uint32 tile_flag)
+    {
+        SDL_assert(std::has_single_bit(tile_flag));
+        
+        int32 plane = std::countr_zero(tile_flag);
+        SDL_assert(plane < TILEMAP_FLAG_PLANE_COUNT);
+        
+        return plane;
     }
 }
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include <SDL3/SDL.h>
+
 #include "core.h"
 #include "error.h"
+#include "job.h"
 #include "texture.h"
 
 namespace SBMap
@@ -15,17 +20,43 @@ namespace SBMap
     
     constexpr int32 TILESET_MINIMUM_WIDTH = 1;
     constexpr int32 TILESET_MINIMUM_HEIGHT = 1;
-    constexpr int32 TILESET_MAXIMUM_WIDTH = 1024;
-    constexpr int32 TILESET_MAXIMUM_HEIGHT = 1024;
+    constexpr int32 TILESET_MAXIMUM_WIDTH = 4096;
+    constexpr int32 TILESET_MAXIMUM_HEIGHT = 4096;
+    
+    // Atlas pages overlap by the largest tile size, so no tile is split across pages
+    constexpr int32 TILESET_PAGE_OVERLAP = SDL_max(TILE_MAXIMUM_WIDTH, TILE_MAXIMUM_HEIGHT);
     
     constexpr int32 TILEMAP_MINIMUM_WIDTH = 1;
     constexpr int32 TILEMAP_MINIMUM_HEIGHT = 1;
-    constexpr int32 TILEMAP_MAXIMUM_WIDTH = 1024;
-    constexpr int32 TILEMAP_MAXIMUM_HEIGHT = 1024;
+    constexpr int32 TILEMAP_MAXIMUM_WIDTH = 65536;
+    constexpr int32 TILEMAP_MAXIMUM_HEIGHT = 65536;
+    
+    constexpr int32 TILEMAP_CHUNK_WIDTH = 32;
+    constexpr int32 TILEMAP_CHUNK_HEIGHT = 32;
+    constexpr int32 TILEMAP_FLAG_PLANE_COUNT = 3;
+    
+    constexpr uint32 TILEMAP_CELL_FLAGS_MASK = 0x00000007;
+    constexpr uint32 TILEMAP_CELL_TILE_BIT = 0x00000010;
+    constexpr uint32 TILEMAP_CELL_TILE_X_SHIFT = 8;
+    constexpr uint32 TILEMAP_CELL_TILE_Y_SHIFT = 20;
+    constexpr uint32 TILEMAP_CELL_TILE_LIMIT = 1 << 12;
+    constexpr uint32 TILEMAP_CELL_VALID_MASK = 0xFFFFFF17;
+    
+    static_assert(TILESET_MAXIMUM_WIDTH <= (int32)TILEMAP_CELL_TILE_LIMIT);
+    static_assert(TILESET_MAXIMUM_HEIGHT <= (int32)TILEMAP_CELL_TILE_LIMIT);
+    static_assert(TILEMAP_CHUNK_WIDTH == 32, "Flag plane rows are one uint32 wide");
+    static_assert(TILEMAP_CELL_FLAGS_MASK == (1u << TILEMAP_FLAG_PLANE_COUNT) - 1, "Every flag bit needs a plane");
+    
+    struct TileUV
+    {
+        SDL_FRect rect = {};
+        int32 page = 0;
+    };
     
     struct Tileset
     {
-        Texture2D atlas;
+        PagedTexture atlas;
+        std::shared_ptr<const std::vector<TileUV>> tile_uvs;
         int32 tile_width = 0;
         int32 tile_height = 0;
         int32 width = 0;
@@ -44,20 +75,63 @@ namespace SBMap
         
         struct Cell
         {
-            int32 tile_x = -1;
-            int32 tile_y = -1;
-            uint32 flags = 0;
+            uint32 bits = 0;
+        };
+        
+        // Cells only keep their tile, flags live in one bitplane per flag.
+        // The tile plane marks the cells that have a tile, so counting needs no cells.
+        struct Chunk
+        {
+            Cell cells[TILEMAP_CHUNK_WIDTH * TILEMAP_CHUNK_HEIGHT];
+            alignas(16) uint32 flag_planes[TILEMAP_FLAG_PLANE_COUNT][TILEMAP_CHUNK_HEIGHT] = {};
+            alignas(16) uint32 tile_plane[TILEMAP_CHUNK_HEIGHT] = {};
+            int32 used_count = 0;
         };
         
-        std::vector<Cell> cells;
+        std::unordered_map<uint32, std::shared_ptr<Chunk>> chunks;
         Tileset tileset;
         int32 width = 0;
         int32 height = 0;
     };
     
-    Tileset CreateTileset(const Texture2D& atlas_texture, int32 tile_width, int32 tile_height);
-    Result<Tilemap> LoadTilemapFromDisk(const Tileset& tileset, const char* filepath);
-    Result<bool> SaveTilemapToDisk(const Tilemap& tilemap, const char* filepath);
+    // Version 1 files are legacy SBMP files with 12 byte cells or SBMC files with
+    // packed cells. Version 2 files are chunked SBMV files.
+    enum class TilemapFileVersion
+    {
+        V1 = 1,
+        V2 = 2,
+        V1Compact = 3,
+    };
+    
+    struct TilemapFileInfo
+    {
+        TilemapFileVersion version = TilemapFileVersion::V1;
+        int32 width = 0;
+        int32 height = 0;
+        int64 used_cell_count = 0;
+        bool compact = false;
+    };
+    
+    struct CellRange
+    {
+        int32 begin_x = 0;
+        int32 begin_y = 0;
+        int32 end_x = 0;
+        int32 end_y = 0;
+    };
+    
+    Result<Tileset> CreateTileset(const PagedTexture& atlas_texture, int32 tile_width, int32 tile_height);
+    void ResizeTileset(Tileset& tileset, int32 tile_width, int32 tile_height);
+    
+    // Neither touches the tileset textures, so both can run as a job. Version is set to the format that was read.
+    Result<Tilemap> LoadTilemapFromDisk(const char* filepath, int32 tileset_width, int32 tileset_height, JobState* job = nullptr, TilemapFileVersion* version = nullptr);
+    Result<bool> SaveTilemapToDisk(const Tilemap& tilemap, const char* filepath, TilemapFileVersion version = TilemapFileVersion::V2, JobState* job = nullptr);
+    
+    Result<TilemapFileInfo> InspectTilemapFile(const char* filepath);
+    
+    // Returns the size of the journal. Callers do a full save after loading
+    // rather than appending behind a journal cut short by a crash.
+    Result<int64> AppendTilemapJournal(const Tilemap& tilemap, const char* filepath, const uint32* chunk_keys, size_t chunk_key_count);
     
     bool IsTilesetValid(const Tileset& tileset);
     bool IsTilemapValid(const Tilemap& tilemap);
@@ -65,5 +139,96 @@ namespace SBMap
     bool IsInTilesetBounds(const Tileset& tileset, int32 tile_x, int32 tile_y);
     bool IsInTilemapBounds(const Tilemap& tilemap, int32 cell_x, int32 cell_y);
     
-    Tilemap::Cell& GetTilemapCell(Tilemap& tilemap, int32 cell_x, int32 cell_y);
+    const TileUV& GetTileUV(const Tileset& tileset, int32 tile_x, int32 tile_y);
+    
+    bool IsCellRangeEmpty(const CellRange& range);
+    CellRange IntersectCellRange(const CellRange& range1, const CellRange& range2);
+    CellRange UniteCellRange(const CellRange& range1, const CellRange& range2);
+    
+    void ResizeTilemap(Tilemap& tilemap, int32 width, int32 height);
+    Tilemap CopyTilemapCells(const Tilemap& tilemap);
+    
+    Tilemap::Cell GetTilemapCell(const Tilemap& tilemap, int32 cell_x, int32 cell_y);
+    void SetTilemapCell(Tilemap& tilemap, int32 cell_x, int32 cell_y, const Tilemap::Cell& value);
+    
+    uint32 GetTilemapChunkKey(int32 chunk_x, int32 chunk_y);
+    const Tilemap::Chunk* FindTilemapChunk(const Tilemap& tilemap, int32 chunk_x, int32 chunk_y);
+    Tilemap::Chunk* FindTilemapChunk(Tilemap& tilemap, int32 chunk_x, int32 chunk_y);
+    Tilemap::Chunk& AcquireTilemapChunk(Tilemap& tilemap, int32 chunk_x, int32 chunk_y);
+    
+    // Chunks can be shared with copies of the map, so writes go through here
+    Tilemap::Chunk& UnshareTilemapChunk(std::shared_ptr<Tilemap::Chunk>& chunk);
+    void RecountTilemapChunk(Tilemap::Chunk& chunk);
+    Tilemap::Cell GetTilemapChunkCell(const Tilemap::Chunk& chunk, int32 column, int32 row);
+    uint32 MatchTilemapChunkRow(const Tilemap::Chunk& chunk, int32 row, uint32 tile_bits);
+    
+    // Mask of the columns from begin up to end in a chunk row or flag plane row
+    inline uint32 GetTilemapChunkColumnMask(int32 begin_column, int32 end_column)
+    {
+        if (begin_column >= end_column)
+            return 0;
+        
+        uint32 end_mask = end_column >= TILEMAP_CHUNK_WIDTH ? 0xFFFFFFFF : (1u << end_column) - 1;
+        return end_mask & ~((1u << begin_column) - 1);
+    }
+    
+    int32 GetTileFlagPlane(uint32 tile_flag);
+    
+    inline bool IsCellEmpty(const Tilemap::Cell& cell)
+    {
+        return cell.bits == 0;
+    }
+    
+    inline bool HasCellTile(const Tilemap::Cell& cell)
+    {
+        return (cell.bits & TILEMAP_CELL_TILE_BIT) != 0;
+    }
+    
+    // Same rule the cell scan applies to loaded cells
+    inline bool IsCellValid(const Tilemap::Cell& cell)
+    {
+        uint32 allowed_bits = HasCellTile(cell) ? TILEMAP_CELL_VALID_MASK : TILEMAP_CELL_FLAGS_MASK;
+        return (cell.bits & ~allowed_bits) == 0;
+    }
+    
+    inline int32 GetCellTileX(const Tilemap::Cell& cell)
+    {
+        if (!HasCellTile(cell))
+            return -1;
+        
+        return (int32)((cell.bits >> TILEMAP_CELL_TILE_X_SHIFT) & (TILEMAP_CELL_TILE_LIMIT - 1));
+    }
+    
+    inline int32 GetCellTileY(const Tilemap::Cell& cell)
+    {
+        if (!HasCellTile(cell))
+            return -1;
+        
+        return (int32)((cell.bits >> TILEMAP_CELL_TILE_Y_SHIFT) & (TILEMAP_CELL_TILE_LIMIT - 1));
+    }
+    
+    inline uint32 GetCellFlags(const Tilemap::Cell& cell)
+    {
+        return cell.bits & TILEMAP_CELL_FLAGS_MASK;
+    }
+    
+    inline void SetCellTile(Tilemap::Cell& cell, int32 tile_x, int32 tile_y)
+    {
+        SDL_assert(tile_x >= 0 && tile_x < (int32)TILEMAP_CELL_TILE_LIMIT);
+        SDL_assert(tile_y >= 0 && tile_y < (int32)TILEMAP_CELL_TILE_LIMIT);
+        
+        cell.bits = GetCellFlags(cell) | TILEMAP_CELL_TILE_BIT |
+            ((uint32)tile_x << TILEMAP_CELL_TILE_X_SHIFT) | ((uint32)tile_y << TILEMAP_CELL_TILE_Y_SHIFT);
+    }
+    
+    inline void ClearCellTile(Tilemap::Cell& cell)
+    {
+        cell.bits = GetCellFlags(cell);
+    }
+    
+    inline void SetCellFlags(Tilemap::Cell& cell, uint32 flags)
+    {
+        SDL_assert((flags & ~TILEMAP_CELL_FLAGS_MASK) == 0);
+        cell.bits = (cell.bits & ~TILEMAP_CELL_FLAGS_MASK) | flags;
+    }
 }
@@ -0,0 +1,314 @@
+#include <string>
+
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_main.h>
+
+#include "core.h"
+#include "error.h"
+#include "flag_layers.h"
+#include "flood_fill.h"
+#include "scope.h"
+#include "tilemap.h"
+
+namespace SBMap
+{
+    constexpr const char* TEST_TEMP_TILEMAP_FILENAME = "test.sbm";
+    constexpr int32 TEST_TILESET_WIDTH = 16;
+    constexpr int32 TEST_TILESET_HEIGHT = 16;
+    
+    struct TestCase
+    {
+        const char* name = nullptr;
+        bool (*function)() = nullptr;
+    };
+    
+    static std::string s_TempTilemapPath;
+    static int32 s_FailureCount = 0;
+    
+    #define TEST_CHECK(condition) \
+        do \
+        { \
+            if (!(condition)) \
+            { \
+                SDL_Log("    %s:%d: %s", __FILE__, __LINE__, #condition); \
+                s_FailureCount++; \
+                return false; \
+            } \
+        } while (false)
+    
+    // Invalid input is expected to trip asserts in debug builds, the checks after them decide
+    static SDL_AssertState SDLCALL IgnoreAssertion(const SDL_AssertData*, void*)
+    {
+        return SDL_ASSERTION_IGNORE;
+    }
+    
+    static bool WriteTempFile(const void* data, size_t size)
+    {
+        return SDL_SaveFile(s_TempTilemapPath.c_str(), data, size);
+    }
+    
+    static int32 GetChunkUsedCount(const Tilemap& tilemap, int32 chunk_x, int32 chunk_y)
+    {
+        const Tilemap::Chunk* chunk = FindTilemapChunk(tilemap, chunk_x, chunk_y);
+        return chunk ? chunk->used_count : 0;
+    }
+    
+    static uint32 NextRandom(uint32& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    
+    // Counts every chunk cell by cell, the way the planes are meant to summarize them
+    static bool IsTilemapConsistent(const Tilemap& tilemap)
+    {
+        for (const auto& [key, chunk] : tilemap.chunks)
+        {
+            int32 used_count = 0;
+            for (int32 row = 0; row < TILEMAP_CHUNK_HEIGHT; row++)
+            {
+                for (int32 column = 0; column < TILEMAP_CHUNK_WIDTH; column++)
+                {
+                    Tilemap::Cell cell = GetTilemapChunkCell(*chunk, column, row);
+                    if (((chunk->tile_plane[row] >> column) & 1) != (uint32)HasCellTile(cell))
+                        return false;
+                    
+                    used_count += IsCellEmpty(cell) ? 0 : 1;
+                }
+            }
+            
+            if (used_count == 0 || used_count != chunk->used_count)
+                return false;
+        }
+        
+        return true;
+    }
+    
+    static bool TestUnknownFlagBitIsRejected()
+    {
+        Tilemap tilemap;
+        ResizeTilemap(tilemap, 64, 64);
+        
+        Tilemap::Cell wall;
+        SetCellFlags(wall, Tilemap::TileFlagsWall);
+        SetTilemapCell(tilemap, 1, 1, wall);
+        TEST_CHECK(GetChunkUsedCount(tilemap, 0, 0) == 1);
+        
+        // Bit 3 has no flag plane
+        Tilemap::Cell unknown;
+        unknown.bits = 1u << TILEMAP_FLAG_PLANE_COUNT;
+        TEST_CHECK(!IsCellValid(unknown));
+        
+        SetTilemapCell(tilemap, 2, 2, unknown);
+        unknown.bits |= Tilemap::TileFlagsWall;
+        SetTilemapCell(tilemap, 1, 1, unknown);
+        
+        TEST_CHECK(GetChunkUsedCount(tilemap, 0, 0) == 1);
+        TEST_CHECK(IsCellEmpty(GetTilemapCell(tilemap, 2, 2)));
+        TEST_CHECK(GetTilemapCell(tilemap, 1, 1).bits == wall.bits);
+        
+        // Compact cells hold the bit directly
+        uint32 compact_file[3 + 4] = {};
+        SDL_memcpy(compact_file, "SBMC", 4);
+        compact_file[1] = 2;
+        compact_file[2] = 2;
+        compact_file[3 + 3] = 1u << TILEMAP_FLAG_PLANE_COUNT;
+        TEST_CHECK(WriteTempFile(compact_file, sizeof(compact_file)));
+        
+        auto compact_result = LoadTilemapFromDisk(s_TempTilemapPath.c_str(), TEST_TILESET_WIDTH, TEST_TILESET_HEIGHT, nullptr);
+        TEST_CHECK(compact_result.IsError());
+        TEST_CHECK(compact_result.GetError().details && SDL_strstr(compact_result.GetError().details, "at 1, 1") != nullptr);
+        
+        // Legacy cells are tile x, tile y and flags
+        int32 legacy_file[3 + 4 * 3] = {};
+        SDL_memcpy(legacy_file, "SBMP", 4);
+        legacy_file[1] = 2;
+        legacy_file[2] = 2;
+        for (int32 i = 0; i < 4; i++)
+        {
+            legacy_file[3 + i * 3 + 0] = -1;
+            legacy_file[3 + i * 3 + 1] = -1;
+        }
+        legacy_file[3 + 2 * 3 + 2] = 1 << TILEMAP_FLAG_PLANE_COUNT;
+        TEST_CHECK(WriteTempFile(legacy_file, sizeof(legacy_file)));
+        
+        auto legacy_result = LoadTilemapFromDisk(s_TempTilemapPath.c_str(), TEST_TILESET_WIDTH, TEST_TILESET_HEIGHT, nullptr);
+        TEST_CHECK(legacy_result.IsError());
+        TEST_CHECK(legacy_result.GetError().details && SDL_strstr(legacy_result.GetError().details, "at 0, 1") != nullptr);
+        
+        auto info_result = InspectTilemapFile(s_TempTilemapPath.c_str());
+        TEST_CHECK(info_result.IsError());
+        
+        return true;
+    }
+    
+    static bool TestTilePlaneFollowsEdits()
+    {
+        Tilemap tilemap;
+        ResizeTilemap(tilemap, 100, 70);
+        
+        uint32 random = 0x12345678;
+        for (int32 i = 0; i < 4000; i++)
+        {
+            uint32 value = NextRandom(random);
+            
+            Tilemap::Cell cell;
+            if (value & 1)
+                SetCellTile(cell, (int32)((value >> 8) % TEST_TILESET_WIDTH), (int32)((value >> 16) % TEST_TILESET_HEIGHT));
+            
+            SetCellFlags(cell, (value >> 1) & (value >> 4) & TILEMAP_CELL_FLAGS_MASK);
+            SetTilemapCell(tilemap, (int32)((value >> 3) % 100), (int32)((value >> 19) % 70), cell);
+        }
+        
+        TEST_CHECK(IsTilemapConsistent(tilemap));
+        
+        Tilemap::Cell tile_cell;
+        SetCellTile(tile_cell, 3, 4);
+        
+        Tilemap::Cell empty_cell;
+        SetTilemapCell(tilemap, 50, 35, empty_cell);
+        TEST_CHECK(!IsCellRangeEmpty(FloodFillTiles(tilemap, 50, 35, tile_cell)));
+        TEST_CHECK(IsTilemapConsistent(tilemap));
+        TEST_CHECK(!IsCellRangeEmpty(FloodFillTiles(tilemap, 50, 35, empty_cell)));
+        TEST_CHECK(IsTilemapConsistent(tilemap));
+        
+        CellRange map_range;
+        map_range.end_x = tilemap.width;
+        map_range.end_y = tilemap.height;
+        
+        FillFlagLayer(tilemap, Tilemap::TileFlagsWall, map_range);
+        InvertFlagLayer(tilemap, Tilemap::TileFlagsLeftGoal, map_range);
+        TEST_CHECK(IsTilemapConsistent(tilemap));
+        
+        ClearFlagLayer(tilemap, Tilemap::TileFlagsWall, map_range);
+        ClearFlagLayer(tilemap, Tilemap::TileFlagsLeftGoal, map_range);
+        ClearFlagLayer(tilemap, Tilemap::TileFlagsRightGoal, map_range);
+        TEST_CHECK(IsTilemapConsistent(tilemap));
+        
+        ResizeTilemap(tilemap, 45, 40);
+        TEST_CHECK(IsTilemapConsistent(tilemap));
+        
+        for (TilemapFileVersion version : { TilemapFileVersion::V1, TilemapFileVersion::V1Compact, TilemapFileVersion::V2 })
+        {
+            TEST_CHECK(SaveTilemapToDisk(tilemap, s_TempTilemapPath.c_str(), version).IsValue());
+            
+            TilemapFileVersion loaded_version = {};
+            auto result = LoadTilemapFromDisk(s_TempTilemapPath.c_str(), TEST_TILESET_WIDTH, TEST_TILESET_HEIGHT, nullptr, &loaded_version);
+            TEST_CHECK(result.IsValue());
+            TEST_CHECK(loaded_version == version);
+            TEST_CHECK(result.GetValue().chunks.size() == tilemap.chunks.size());
+            TEST_CHECK(IsTilemapConsistent(result.GetValue()));
+        }
+        
+        return true;
+    }
+    
+    static bool TestLegacyFileRoundTrip()
+    {
+        Tilemap tilemap;
+        ResizeTilemap(tilemap, 40, 3);
+        
+        Tilemap::Cell tile_cell;
+        SetCellTile(tile_cell, 5, 7);
+        SetCellFlags(tile_cell, Tilemap::TileFlagsWall | Tilemap::TileFlagsRightGoal);
+        SetTilemapCell(tilemap, 33, 1, tile_cell);
+        
+        Tilemap::Cell flag_cell;
+        SetCellFlags(flag_cell, Tilemap::TileFlagsLeftGoal);
+        SetTilemapCell(tilemap, 0, 2, flag_cell);
+        
+        TEST_CHECK(SaveTilemapToDisk(tilemap, s_TempTilemapPath.c_str(), TilemapFileVersion::V1).IsValue());
+        
+        size_t size = 0;
+        auto data = MakeScope((char*)SDL_LoadFile(s_TempTilemapPath.c_str(), &size), SDL_free);
+        TEST_CHECK(data);
+        
+        // A 12 byte header of magic, width and height, then 12 bytes per cell
+        constexpr size_t header_size = 12;
+        constexpr size_t cell_size = 12;
+        TEST_CHECK(size == header_size + 40 * 3 * cell_size);
+        TEST_CHECK(SDL_memcmp(data.Get(), "SBMP", 4) == 0);
+        
+        int32 header[3];
+        SDL_memcpy(header, data.Get(), sizeof(header));
+        TEST_CHECK(header[1] == 40 && header[2] == 3);
+        
+        // Cells are tile x, tile y and flags, with -1 where there is no tile
+        auto read_cell = [&](int32 cell_x, int32 cell_y, int32 (&values)[3])
+        {
+            SDL_memcpy(values, data.Get() + header_size + (size_t)(cell_x + cell_y * 40) * cell_size, sizeof(values));
+        };
+        
+        int32 values[3];
+        read_cell(33, 1, values);
+        TEST_CHECK(values[0] == 5 && values[1] == 7 && values[2] == (int32)(Tilemap::TileFlagsWall | Tilemap::TileFlagsRightGoal));
+        read_cell(0, 2, values);
+        TEST_CHECK(values[0] == -1 && values[1] == -1 && values[2] == (int32)Tilemap::TileFlagsLeftGoal);
+        read_cell(39, 0, values);
+        TEST_CHECK(values[0] == -1 && values[1] == -1 && values[2] == 0);
+        
+        auto info_result = InspectTilemapFile(s_TempTilemapPath.c_str());
+        TEST_CHECK(info_result.IsValue());
+        TEST_CHECK(info_result.GetValue().version == TilemapFileVersion::V1);
+        TEST_CHECK(info_result.GetValue().used_cell_count == 2);
+        
+        auto load_result = LoadTilemapFromDisk(s_TempTilemapPath.c_str(), TEST_TILESET_WIDTH, TEST_TILESET_HEIGHT, nullptr);
+        TEST_CHECK(load_result.IsValue());
+        
+        const Tilemap& loaded = load_result.GetValue();
+        TEST_CHECK(loaded.width == 40 && loaded.height == 3);
+        
+        for (int32 y = 0; y < loaded.height; y++)
+        {
+            for (int32 x = 0; x < loaded.width; x++)
+                TEST_CHECK(GetTilemapCell(loaded, x, y).bits == GetTilemapCell(tilemap, x, y).bits);
+        }
+        
+        return true;
+    }
+    
+    static const TestCase s_TestCases[] =
+    {
+        { "unknown_flag_bit_is_rejected", TestUnknownFlagBitIsRejected },
+        { "tile_plane_follows_edits", TestTilePlaneFollowsEdits },
+        { "legacy_file_round_trip", TestLegacyFileRoundTrip },
+    };
+    
+    static int RunTests()
+    {
+        SDL_SetAssertionHandler(IgnoreAssertion, nullptr);
+        
+        char* pref_path = SDL_GetPrefPath("Zake", "SBMap");
+        if (!pref_path)
+        {
+            SDL_Log("Could not find a directory for temporary files: %s", SDL_GetError());
+            return 1;
+        }
+        
+        s_TempTilemapPath = std::string(pref_path) + TEST_TEMP_TILEMAP_FILENAME;
+        SDL_free(pref_path);
+        
+        int32 failed_count = 0;
+        for (const TestCase& test_case : s_TestCases)
+        {
+            int32 failure_count = s_FailureCount;
+            bool passed = test_case.function() && s_FailureCount == failure_count;
+            SDL_Log("%-40s %s", test_case.name, passed ? "passed" : "FAILED");
+            
+            failed_count += passed ? 0 : 1;
+        }
+        
+        SDL_RemovePath(s_TempTilemapPath.c_str());
+        SDL_RemovePath((s_TempTilemapPath + ".journal").c_str());
+        SDL_SetAssertionHandler(nullptr, nullptr);
+        
+        return failed_count == 0 ? 0 : 1;
+    }
+}
+
+int main(int, char**)
+{
+    return SBMap::RunTests();
+}